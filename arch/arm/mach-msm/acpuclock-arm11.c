@@ -28,6 +28,12 @@
 #include <linux/cpufreq.h>
 #include <linux/mutex.h>
 #include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
 #include <mach/board.h>
 #include <mach/msm_iomap.h>
 
@@ -65,6 +71,10 @@ struct clock_state
 	uint32_t			vdd_switch_time_us;
 	unsigned long			power_collapse_khz;
 	unsigned long			wait_for_irq_khz;
+	int				current_vdd;
+	unsigned			vdd_drops;
+	unsigned			vdd_drops_deferred;
+	unsigned			vdd_raises_saved;
 };
 
 static struct clk *ebi1_clk;
@@ -101,6 +111,25 @@ struct clkctl_acpu_speed {
         short           pll2_lval;
 };
 
+/*
+ * The steps taken between every pair of table entries are worked out
+ * once at init, along with the PLLs they need, so a switch only has to
+ * walk its plan.  The measured cost of each switch is kept alongside.
+ */
+#define ACPU_PLAN_MAX_STEPS	8
+
+struct acpu_plan {
+	s8		step[ACPU_PLAN_MAX_STEPS];
+	s8		nsteps;		/* -1 if there is no path */
+	u8		plls;		/* PLLs used along the way */
+	u32		count;
+	u32		max_ns;
+	u64		total_ns;
+};
+
+static struct acpu_plan *acpu_plans;
+static int acpu_tbl_size;
+
 /*
  * ACPU speed table. Complete table is shown but certain speeds are commented
  * out to optimized speed switching. Initalize loops_per_jiffy to 0.
@@ -249,6 +278,11 @@ static int acpu_debug_mask;
 module_param_call(debug_mask, param_set_int, param_get_int,
 		&acpu_debug_mask, S_IWUSR | S_IRUGO);
 
+/* how long a lower speed must hold before its lower VDD is applied */
+static int vdd_drop_delay_ms = 100;
+module_param_call(vdd_drop_delay_ms, param_set_int, param_get_int,
+		&vdd_drop_delay_ms, S_IWUSR | S_IRUGO);
+
 static int pc_pll_request(unsigned id, unsigned on)
 {
 	int res;
@@ -321,7 +355,8 @@ static int acpuclk_set_vdd_level(int vdd)
 
 	writel((1 << 7) | (vdd << 3), A11S_VDD_SVS_PLEVEL_ADDR);
 	udelay(drv_state.vdd_switch_time_us);
-	if ((readl(A11S_VDD_SVS_PLEVEL_ADDR) & 0x7) != vdd) {
+	drv_state.current_vdd = readl(A11S_VDD_SVS_PLEVEL_ADDR) & 0x7;
+	if (drv_state.current_vdd != vdd) {
 		if (acpu_debug_mask & PERF_SWITCH_VDD_DEBUG)
 			printk(KERN_ERR "acpuclock: VDD set failed\n");
 		return -EIO;
@@ -411,12 +446,89 @@ static void acpuclk_set_div(const struct clkctl_acpu_speed *hunt_s) {
 	}
 }
 
+/* Work out the steps from one table entry to another, the same way the
+ * old per-switch walk did: jump straight there if within
+ * max_speed_delta_khz, else follow the table's up/down steppings.
+ */
+static void acpuclk_build_plan(int from, int to, struct acpu_plan *plan)
+{
+	struct clkctl_acpu_speed *cur_s = &acpu_freq_tbl[from];
+	struct clkctl_acpu_speed *tgt_s = &acpu_freq_tbl[to];
+
+	plan->nsteps = 0;
+	plan->plls = 0;
+	while (cur_s != tgt_s) {
+		int d = abs((int)(cur_s->a11clk_khz - tgt_s->a11clk_khz));
+		if (d > drv_state.max_speed_delta_khz) {
+			int clk_index = tgt_s->a11clk_khz > cur_s->a11clk_khz ?
+				cur_s->up : cur_s->down;
+			if (clk_index < 0)
+				goto invalid;
+			cur_s = &acpu_freq_tbl[clk_index];
+		} else {
+			cur_s = tgt_s;
+		}
+
+		if (plan->nsteps == ACPU_PLAN_MAX_STEPS)
+			goto invalid;
+		plan->step[plan->nsteps++] = cur_s - acpu_freq_tbl;
+		if (cur_s->pll != ACPU_PLL_TCXO)
+			plan->plls |= 1 << cur_s->pll;
+	}
+	return;
+
+invalid:
+	printk(KERN_ERR "acpuclock: no path from %u to %u\n",
+		acpu_freq_tbl[from].a11clk_khz, tgt_s->a11clk_khz);
+	plan->nsteps = -1;
+}
+
+static void __init acpuclk_plan_init(void)
+{
+	int from, to;
+
+	for (acpu_tbl_size = 0; acpu_freq_tbl[acpu_tbl_size].a11clk_khz;
+	     acpu_tbl_size++)
+		;
+
+	acpu_plans = kzalloc(sizeof(*acpu_plans) *
+			     acpu_tbl_size * acpu_tbl_size, GFP_KERNEL);
+	if (!acpu_plans) {
+		pr_err("acpuclock: no memory for transition plans\n");
+		return;
+	}
+
+	for (from = 0; from < acpu_tbl_size; from++)
+		for (to = 0; to < acpu_tbl_size; to++)
+			acpuclk_build_plan(from, to,
+				&acpu_plans[from * acpu_tbl_size + to]);
+}
+
+static void acpuclk_vdd_drop(struct work_struct *work)
+{
+	int vdd;
+
+	mutex_lock(&drv_state.lock);
+	vdd = drv_state.current_speed->vdd;
+	if (vdd < drv_state.current_vdd) {
+		if (acpuclk_set_vdd_level(vdd) < 0)
+			printk(KERN_ERR "acpuclock: Unable to drop ACPU vdd\n");
+		else
+			drv_state.vdd_drops++;
+	}
+	mutex_unlock(&drv_state.lock);
+}
+static DECLARE_DELAYED_WORK(vdd_drop_work, acpuclk_vdd_drop);
+
 int acpuclk_set_rate(unsigned long rate, enum setrate_reason reason)
 {
 	uint32_t reg_clkctl;
 	struct clkctl_acpu_speed *cur_s, *tgt_s, *strt_s;
+	struct acpu_plan *plan;
+	ktime_t start = ktime_get();
 	int rc = 0;
 	unsigned int plls_enabled = 0, pll;
+	int i;
 
 	strt_s = cur_s = drv_state.current_speed;
 
@@ -442,37 +554,50 @@ int acpuclk_set_rate(unsigned long rate, enum setrate_reason reason)
 			tgt_s--;
 	}
 
+	if (acpu_plans)
+		plan = &acpu_plans[(strt_s - acpu_freq_tbl) * acpu_tbl_size +
+				   (tgt_s - acpu_freq_tbl)];
+	else {
+		/* the plans could not be allocated, work it out here */
+		static struct acpu_plan fallback;
+		plan = &fallback;
+		acpuclk_build_plan(strt_s - acpu_freq_tbl,
+				   tgt_s - acpu_freq_tbl, plan);
+	}
+	if (plan->nsteps < 0) /* This should not happen. */
+		return -EINVAL;
+
 	if (strt_s->pll != ACPU_PLL_TCXO)
 		plls_enabled |= 1 << strt_s->pll;
 
-	if (reason == SETRATE_CPUFREQ) {
+	if (reason == SETRATE_CPUFREQ)
 		mutex_lock(&drv_state.lock);
-		if (strt_s->pll != tgt_s->pll && tgt_s->pll != ACPU_PLL_TCXO) {
-			rc = pc_pll_request(tgt_s->pll, 1);
-			if (rc < 0) {
-				pr_err("PLL%d enable failed (%d)\n",
-					tgt_s->pll, rc);
-				goto out;
-			}
-			plls_enabled |= 1 << tgt_s->pll;
-		}
-		/* Increase VDD if needed. */
-		if (tgt_s->vdd > cur_s->vdd) {
-			if ((rc = acpuclk_set_vdd_level(tgt_s->vdd)) < 0) {
-				printk(KERN_ERR "Unable to switch ACPU vdd\n");
-				goto out;
-			}
-		}
-	} else {
-		/* Power collapse should also increase VDD. */
-		if (tgt_s->vdd > cur_s->vdd) {
-			if ((rc = acpuclk_set_vdd_level(tgt_s->vdd)) < 0) {
-				printk(KERN_ERR "Unable to switch ACPU vdd\n");
-				goto out;
-			}
+
+	/* Request every PLL the plan goes through before stepping.
+	 * Power collapse should also request pll.(19.2->528)
+	 */
+	for (pll = ACPU_PLL_0; pll <= ACPU_PLL_2; pll++) {
+		if (!(plan->plls & (1 << pll)) || (plls_enabled & (1 << pll)))
+			continue;
+		rc = pc_pll_request(pll, 1);
+		if (rc < 0) {
+			pr_err("PLL%d enable failed (%d)\n", pll, rc);
+			goto out;
 		}
+		plls_enabled |= 1 << pll;
 	}
 
+	/* Increase VDD if needed.  A drop may still be pending, in which
+	 * case the rail is already high enough.
+	 */
+	if (tgt_s->vdd > drv_state.current_vdd) {
+		if ((rc = acpuclk_set_vdd_level(tgt_s->vdd)) < 0) {
+			printk(KERN_ERR "Unable to switch ACPU vdd\n");
+			goto out;
+		}
+	} else if (reason == SETRATE_CPUFREQ && tgt_s->vdd > cur_s->vdd)
+		drv_state.vdd_raises_saved++;
+
 	/* Set wait states for CPU inbetween frequency changes */
 	reg_clkctl = readl(A11S_CLK_CNTL_ADDR);
 	reg_clkctl |= (100 << 16); /* set WT_ST_CNT */
@@ -483,43 +608,12 @@ int acpuclk_set_rate(unsigned long rate, enum setrate_reason reason)
 			__func__, strt_s->a11clk_khz * 1000,
 			tgt_s->a11clk_khz * 1000);
 
-	while (cur_s != tgt_s) {
-		/*
-		 * Always jump to target freq if within 256mhz, regulardless of
-		 * PLL. If differnece is greater, use the predefinied
-		 * steppings in the table.
-		 */
-		int d = abs((int)(cur_s->a11clk_khz - tgt_s->a11clk_khz));
-		if (d > drv_state.max_speed_delta_khz) {
-			/* Step up or down depending on target vs current. */
-			int clk_index = tgt_s->a11clk_khz > cur_s->a11clk_khz ?
-				cur_s->up : cur_s->down;
-			if (clk_index < 0) { /* This should not happen. */
-				printk(KERN_ERR "cur:%u target: %u\n",
-					cur_s->a11clk_khz, tgt_s->a11clk_khz);
-				rc = -EINVAL;
-				goto out;
-			}
-			cur_s = &acpu_freq_tbl[clk_index];
-		} else {
-			cur_s = tgt_s;
-		}
+	for (i = 0; i < plan->nsteps; i++) {
+		cur_s = &acpu_freq_tbl[plan->step[i]];
 		if (acpu_debug_mask & PERF_SWITCH_STEP_DEBUG)
 			printk(KERN_DEBUG "%s: STEP khz = %u, pll = %d\n",
 				__func__, cur_s->a11clk_khz, cur_s->pll);
 
-		/* Power collapse should also request pll.(19.2->528) */
-		if (cur_s->pll != ACPU_PLL_TCXO
-		    && !(plls_enabled & (1 << cur_s->pll))) {
-			rc = pc_pll_request(cur_s->pll, 1);
-			if (rc < 0) {
-				pr_err("PLL%d enable failed (%d)\n",
-					cur_s->pll, rc);
-				goto out;
-			}
-			plls_enabled |= 1 << cur_s->pll;
-		}
-
 		acpuclk_set_div(cur_s);
 		drv_state.current_speed = cur_s;
 		/* Re-adjust lpj for the new clock speed. */
@@ -557,15 +651,36 @@ int acpuclk_set_rate(unsigned long rate, enum setrate_reason reason)
 	if (reason == SETRATE_PC)
 		return 0;
 
-	/* Drop VDD level if we can. */
-	if (tgt_s->vdd < strt_s->vdd) {
-		if (acpuclk_set_vdd_level(tgt_s->vdd) < 0)
+	/* Drop VDD level if we can.  For cpufreq, wait until the new speed
+	 * has held for a while so that a quick bounce back up does not pay
+	 * for it twice; the idle and suspend paths run without the mutex
+	 * and drop it right away.
+	 */
+	if (tgt_s->vdd < drv_state.current_vdd) {
+		if (reason == SETRATE_CPUFREQ && vdd_drop_delay_ms > 0) {
+			cancel_delayed_work(&vdd_drop_work);
+			schedule_delayed_work(&vdd_drop_work,
+				msecs_to_jiffies(vdd_drop_delay_ms));
+			drv_state.vdd_drops_deferred++;
+		} else if (acpuclk_set_vdd_level(tgt_s->vdd) < 0)
 			printk(KERN_ERR "acpuclock: Unable to drop ACPU vdd\n");
+		else
+			drv_state.vdd_drops++;
 	}
 
 	if (acpu_debug_mask & PERF_SWITCH_DEBUG)
 		printk(KERN_DEBUG "%s: ACPU speed change complete\n",
 				__func__);
+
+	/* plan stats are protected by the mutex */
+	if (rc == 0 && reason == SETRATE_CPUFREQ) {
+		u32 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		plan->count++;
+		plan->total_ns += ns;
+		if (ns > plan->max_ns)
+			plan->max_ns = ns;
+	}
 out:
 	if (reason == SETRATE_CPUFREQ)
 		mutex_unlock(&drv_state.lock);
@@ -604,6 +719,7 @@ static void __init acpuclk_init(void)
 	}
 
 	drv_state.current_speed = speed;
+	drv_state.current_vdd = readl(A11S_VDD_SVS_PLEVEL_ADDR) & 0x07;
 
 	rc = clk_set_rate(ebi1_clk, speed->axiclk_khz * 1000);
 	if (rc < 0)
@@ -718,7 +834,66 @@ void __init msm_acpu_clock_init(struct msm_acpu_clock_platform_data *clkdata)
 	acpu_freq_tbl_fixup();
 	acpuclk_init();
 	lpj_init();
+	acpuclk_plan_init();
 #ifdef CONFIG_CPU_FREQ
 	cpufreq_frequency_table_get_attr(freq_table, smp_processor_id());
 #endif
 }
+
+#if defined(CONFIG_DEBUG_FS)
+static int acpuclk_switch_show(struct seq_file *m, void *unused)
+{
+	struct acpu_plan *plan;
+	int from, to;
+
+	if (!acpu_plans)
+		return 0;
+
+	mutex_lock(&drv_state.lock);
+	seq_printf(m, "from_khz  to_khz  steps  count  avg_us  max_us\n");
+	for (from = 0; from < acpu_tbl_size; from++)
+		for (to = 0; to < acpu_tbl_size; to++) {
+			plan = &acpu_plans[from * acpu_tbl_size + to];
+			if (!plan->count)
+				continue;
+			seq_printf(m, "%8u %7u %6d %6u %7llu %7u\n",
+				acpu_freq_tbl[from].a11clk_khz,
+				acpu_freq_tbl[to].a11clk_khz,
+				plan->nsteps, plan->count,
+				div_u64(plan->total_ns, plan->count) / 1000,
+				plan->max_ns / 1000);
+		}
+	seq_printf(m, "vdd drops %u, deferred %u, raises saved %u\n",
+		drv_state.vdd_drops, drv_state.vdd_drops_deferred,
+		drv_state.vdd_raises_saved);
+	mutex_unlock(&drv_state.lock);
+	return 0;
+}
+
+static int acpuclk_switch_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, acpuclk_switch_show, NULL);
+}
+
+static const struct file_operations acpuclk_switch_fops = {
+	.owner = THIS_MODULE,
+	.open = acpuclk_switch_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init acpuclk_debug_init(void)
+{
+	struct dentry *dent;
+
+	dent = debugfs_create_dir("acpuclock", 0);
+	if (IS_ERR(dent))
+		return PTR_ERR(dent);
+
+	debugfs_create_file("switch_stats", 0444, dent, NULL,
+			    &acpuclk_switch_fops);
+	return 0;
+}
+late_initcall(acpuclk_debug_init);
+#endif
@@ -85,13 +85,13 @@ heroc_mddi_eid_power(struct msm_mddi_client_data *client_data, int on)
 
 		/* 2V8(pmic gp5) */
 		id = PM_VREG_PDOWN_GP5_ID;
-		msm_proc_comm(PCOM_VREG_PULLDOWN, &on_off, &id);
+		msm_proc_comm_post(PCOM_VREG_PULLDOWN, on_off, id);
 		vreg_disable(vreg_lcm_2v85);
 		mdelay(1);
 
 		/* 2V6(pmic synt) */
 		id = PM_VREG_PDOWN_SYNT_ID;
-		msm_proc_comm(PCOM_VREG_PULLDOWN, &on_off, &id);
+		msm_proc_comm_post(PCOM_VREG_PULLDOWN, on_off, id);
 		vreg_disable(vreg_lcm_2v6);
 	}
 }
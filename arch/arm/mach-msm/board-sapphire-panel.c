@@ -438,7 +438,7 @@ static void sapphire_mddi_power_client(struct msm_mddi_client_data *client_data,
 		vreg_disable(vreg_lcm_2v85);
 		on_off = 1;
 		id = PM_VREG_PDOWN_AUX_ID;
-		msm_proc_comm(PCOM_VREG_PULLDOWN, &on_off, &id);
+		msm_proc_comm_post(PCOM_VREG_PULLDOWN, on_off, id);
 		msleep(5);
 		if (is_12pin_camera())
 			gpio_set_value(V_VDDE2E_VDD2_GPIO_5M, 0);
@@ -448,7 +448,7 @@ static void sapphire_mddi_power_client(struct msm_mddi_client_data *client_data,
 		msleep(200);
 		gpio_set_value(SAPPHIRE_MDDI_1V5_EN, 0);
 		id = PM_VREG_PDOWN_MDDI_ID;
-		msm_proc_comm(PCOM_VREG_PULLDOWN, &on_off, &id);
+		msm_proc_comm_post(PCOM_VREG_PULLDOWN, on_off, id);
 	}
 }
 
@@ -402,13 +402,13 @@ static void trout_mddi_power_client(struct msm_mddi_client_data *client_data,
 		vreg_disable(vreg_lcm_2v85);
 		on_off = 1;
 		id = PM_VREG_PDOWN_AUX_ID;
-		msm_proc_comm(PCOM_VREG_PULLDOWN, &on_off, &id);
+		msm_proc_comm_post(PCOM_VREG_PULLDOWN, on_off, id);
 		msleep(5);
 		gpio_set_value(V_VDDE2E_VDD2_GPIO, 0);
 		msleep(200);
 		vreg_disable(vreg_mddi_1v5);
 		id = PM_VREG_PDOWN_MDDI_ID;
-		msm_proc_comm(PCOM_VREG_PULLDOWN, &on_off, &id);
+		msm_proc_comm_post(PCOM_VREG_PULLDOWN, on_off, id);
 	}
 }
 
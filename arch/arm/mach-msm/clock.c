@@ -44,9 +44,12 @@ static inline int pc_clk_enable(unsigned id)
 	return msm_proc_comm(PCOM_CLKCTL_RPC_ENABLE, &id, NULL);
 }
 
+/* Nobody waits for a clock to stop; a later request for it still
+ * reaches the modem after this one.
+ */
 static inline void pc_clk_disable(unsigned id)
 {
-	msm_proc_comm(PCOM_CLKCTL_RPC_DISABLE, &id, NULL);
+	msm_proc_comm_post(PCOM_CLKCTL_RPC_DISABLE, id, 0);
 }
 
 static inline int pc_clk_set_rate(unsigned id, unsigned rate)
@@ -21,6 +21,7 @@
 #include <linux/power_supply.h>
 #include <linux/platform_device.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/wakelock.h>
 #include <asm/gpio.h>
 #include <mach/msm_rpcrouter.h>
@@ -101,6 +102,14 @@ struct htc_battery_info {
 	/* lock held while calling the arm9 to query the battery info */
 	struct mutex rpc_lock;
 	struct battery_info_reply rep;
+
+	/* rep is reused until cache_time expires or cache_gen changes */
+	int cache_valid;
+	unsigned int cache_gen;
+	unsigned int fetches;
+	unsigned int cache_hits;
+	unsigned int invalidations;
+
 	int (*func_show_batt_attr)(struct device_attribute *attr, char *buf);
 	int gpio_mbat_in;
 	int gpio_usb_id;
@@ -115,8 +124,14 @@ static struct msm_rpc_endpoint *endpoint;
 
 static struct htc_battery_info htc_batt_info;
 
-/* Remove cache mechanism to prevent cable status not sync. */
-static unsigned int cache_time;
+/* Reads are served from the last fetch for up to cache_time ms.  The
+ * charging source is not part of the fetch (it follows the cable
+ * notifications), and any notification from the modem drops the cache,
+ * so the cable status can't go out of sync.
+ */
+static unsigned int cache_time = 1000;
+module_param_named(cache_time_ms, cache_time, uint,
+		   S_IRUGO | S_IWUSR | S_IWGRP);
 
 static int htc_battery_initial = 0;
 static int htc_full_level_flag = 0;
@@ -179,6 +194,7 @@ static struct power_supply htc_power_supplies[] = {
 };
 
 static int update_batt_info(void);
+static int htc_batt_refresh(void);
 static void usb_status_notifier_func(int online);
 //static int g_usb_online;
 static struct t_usb_status_notifier usb_status_notifier = {
@@ -262,7 +278,7 @@ unsigned int batt_get_status(enum power_supply_property psp)
 {
 	union power_supply_propval val;
 
-	if (update_batt_info())
+	if (htc_batt_refresh())
 		return -EINVAL;
 
 	switch (psp) {
@@ -304,6 +320,36 @@ static int batt_debug_get(void *data, u64 *val)
 }
 
 DEFINE_SIMPLE_ATTRIBUTE(batt_debug_fops, batt_debug_get, batt_debug_set, "%llu\n");
+
+static int batt_cache_stats_show(struct seq_file *m, void *unused)
+{
+	unsigned int fetches, hits;
+
+	mutex_lock(&htc_batt_info.rpc_lock);
+	fetches = htc_batt_info.fetches;
+	hits = htc_batt_info.cache_hits;
+	seq_printf(m, "cache_time_ms: %u\n", cache_time);
+	seq_printf(m, "fetches:       %u\n", fetches);
+	seq_printf(m, "cache_hits:    %u\n", hits);
+	seq_printf(m, "invalidations: %u\n", htc_batt_info.invalidations);
+	seq_printf(m, "hit_rate:      %u%%\n",
+		   fetches + hits ? hits * 100 / (fetches + hits) : 0);
+	mutex_unlock(&htc_batt_info.rpc_lock);
+	return 0;
+}
+
+static int batt_cache_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, batt_cache_stats_show, NULL);
+}
+
+static const struct file_operations batt_cache_stats_fops = {
+	.open = batt_cache_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int __init batt_debug_init(void)
 {
 	struct dentry *dent;
@@ -313,6 +359,8 @@ static int __init batt_debug_init(void)
 		return PTR_ERR(dent);
 
 	debugfs_create_file("charger_state", 0644, dent, NULL, &batt_debug_fops);
+	debugfs_create_file("cache_stats", 0444, dent, NULL,
+			    &batt_cache_stats_fops);
 
 	return 0;
 }
@@ -961,6 +1009,11 @@ static int htc_battery_get_property(struct power_supply *psy,
 				    enum power_supply_property psp,
 				    union power_supply_propval *val)
 {
+	if (psp == POWER_SUPPLY_PROP_STATUS ||
+	    psp == POWER_SUPPLY_PROP_HEALTH ||
+	    psp == POWER_SUPPLY_PROP_CAPACITY)
+		htc_batt_refresh();
+
 	switch (psp) {
 	case POWER_SUPPLY_PROP_STATUS:
 		val->intval = htc_battery_get_charging_status();
@@ -1247,31 +1300,56 @@ static int update_batt_info(void)
 	return ret;
 }
 
-static ssize_t htc_battery_show_property(struct device *dev,
-					 struct device_attribute *attr,
-					 char *buf)
+/* Drop the cached battery info, e.g. because the modem told us
+ * something changed.
+ */
+static void htc_batt_cache_invalidate(void)
 {
-	int i = 0;
-	const ptrdiff_t off = attr - htc_battery_attrs;
+	htc_batt_info.cache_gen++;
+	htc_batt_info.cache_valid = 0;
+	htc_batt_info.invalidations++;
+}
 
-	/* rpc lock is used to prevent two threads from calling
-	 * into the get info rpc at the same time
-	 */
+/* Bring htc_batt_info.rep up to date unless the cached copy is still
+ * fresh.  rpc_lock serializes the fetches, so readers that queue up
+ * behind one fetch reuse its result instead of issuing their own.
+ */
+static int htc_batt_refresh(void)
+{
+	unsigned int gen;
+	int ret = 0;
 
 	mutex_lock(&htc_batt_info.rpc_lock);
-	/* check cache time to decide if we need to update */
-	if (htc_batt_info.update_time &&
-            time_before(jiffies, htc_batt_info.update_time +
+	if (htc_batt_info.cache_valid &&
+	    time_before(jiffies, htc_batt_info.update_time +
 			msecs_to_jiffies(cache_time))) {
-		BATT_LOG("%s: use cached values", __func__);
-                goto dont_need_update;
+		htc_batt_info.cache_hits++;
+		if (htc_batt_debug_mask & HTC_BATT_DEBUG_USER_QUERY)
+			BATT_LOG("%s: use cached values", __func__);
+		goto done;
 	}
 
-	if (!update_batt_info())
+	gen = htc_batt_info.cache_gen;
+	htc_batt_info.fetches++;
+	ret = update_batt_info();
+	if (!ret) {
 		htc_batt_info.update_time = jiffies;
-
-dont_need_update:
+		/* an invalidation during the fetch may predate the reply */
+		htc_batt_info.cache_valid = (gen == htc_batt_info.cache_gen);
+	}
+done:
 	mutex_unlock(&htc_batt_info.rpc_lock);
+	return ret;
+}
+
+static ssize_t htc_battery_show_property(struct device *dev,
+					 struct device_attribute *attr,
+					 char *buf)
+{
+	int i = 0;
+	const ptrdiff_t off = attr - htc_battery_attrs;
+
+	htc_batt_refresh();
 
 	mutex_lock(&htc_batt_info.lock);
 	switch (off) {
@@ -1365,8 +1443,11 @@ static int htc_battery_core_probe(struct platform_device *pdev)
 
 	mutex_lock(&htc_batt_info.rpc_lock);
 	htc_batt_info.rep.charging_source = CHARGER_BATTERY;
+	htc_batt_info.fetches++;
 	if (htc_get_batt_info(&htc_batt_info.rep) < 0)
 		BATT_ERR("%s: get info failed", __func__);
+	else
+		htc_batt_info.cache_valid = 1;
 
 	if (htc_rpc_set_delta(1) < 0)
 		BATT_ERR("%s: set delta failed", __func__);
@@ -1407,6 +1488,9 @@ struct rpc_dem_battery_update_args {
 static int handle_battery_call(struct msm_rpc_server *server,
 			       struct rpc_request_hdr *req, unsigned len)
 {
+	if (req->procedure != RPC_BATT_MTOA_NULL)
+		htc_batt_cache_invalidate();
+
 	switch (req->procedure) {
 	case RPC_BATT_MTOA_NULL:
 		return 0;
@@ -1473,6 +1557,7 @@ static int ds2784_notifier_func(struct notifier_block *nfb,
 		arg = *(u8 *)param;
 
 	BATT_LOG("ds2784_notify: %d %d", action, arg);
+	htc_batt_cache_invalidate();
 	switch (action) {
 	case DS2784_CHARGING_CONTROL:
 		if (htc_batt_info.charger == LINEAR_CHARGER)
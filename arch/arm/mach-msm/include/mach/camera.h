@@ -10,6 +10,7 @@
 #include <linux/cdev.h>
 #include <linux/platform_device.h>
 #include <linux/wakelock.h>
+#include <linux/ktime.h>
 #include "linux/types.h"
 
 #include <mach/board.h>
@@ -27,6 +28,10 @@
 #define NUM_WB_EXP_STAT_OUTPUT_BUFFERS  3
 #define NUM_AUTOFOCUS_MULTI_WINDOW_GRIDS 16
 #define NUM_AF_STAT_OUTPUT_BUFFERS      3
+#define MSM_PMEM_HASH_BITS              4
+#define MSM_FRAME_RING_SIZE             16 /* power of 2 */
+#define MSM_QCMD_POOL_COUNT             32
+#define MSM_QCMD_POOL_DATA              384
 
 enum msm_queue {
 	MSM_CAM_Q_CTRL,     /* control command or control command status */
@@ -86,11 +91,13 @@ struct msm_sensor_ctrl {
 struct msm_queue_cmd {
 	struct list_head list_config;
 	struct list_head list_control;
-	struct list_head list_frame;
 	struct list_head list_pict;
+	struct list_head list_dropped;
 	enum msm_queue type;
 	void *command;
 	int on_heap;
+	struct msm_qcmd_pool *pool; /* NULL if allocated from the heap */
+	ktime_t stamp; /* when the VFE callback queued it */
 };
 
 struct msm_device_queue {
@@ -102,6 +109,35 @@ struct msm_device_queue {
 	const char *name;
 };
 
+/* Single-producer, single-consumer ring of preview frames.  Only the
+ * producer moves head; tail is moved with cmpxchg by the consumer, and
+ * by the producer when it drops the oldest frame of a full ring.
+ * Dropped frames wait on dropped_list for the consumer to hand their
+ * buffers back to the VFE.
+ */
+struct msm_frame_ring {
+	struct msm_queue_cmd *slot[MSM_FRAME_RING_SIZE];
+	unsigned head;
+	atomic_t tail;
+	/* protects dropped_list and msm_sync.unblock_poll_frame */
+	spinlock_t lock;
+	struct list_head dropped_list;
+	wait_queue_head_t wait;
+	unsigned max;
+	unsigned dropped;
+};
+
+/* Preallocated buffers for VFE responses of up to MSM_QCMD_POOL_DATA
+ * bytes, so the VFE callbacks do not have to kmalloc every frame.
+ */
+struct msm_qcmd_pool {
+	spinlock_t lock;
+	void *mem;
+	struct msm_queue_cmd *free[MSM_QCMD_POOL_COUNT];
+	int nfree;
+	unsigned misses; /* allocations that went to the heap */
+};
+
 struct msm_sync {
 	/* These two queues are accessed from a process context only.  They contain
 	 * pmem descriptors for the preview frames and the stats coming from the
@@ -110,6 +146,13 @@ struct msm_sync {
 	struct hlist_head pmem_frames;
 	struct hlist_head pmem_stats;
 
+	/* Both lists above are also indexed by the physical address the
+	 * VFE reports and by the user virtual address, so the per-frame
+	 * lookups don't have to walk them.
+	 */
+	struct hlist_head pmem_phys[1 << MSM_PMEM_HASH_BITS];
+	struct hlist_head pmem_virt[1 << MSM_PMEM_HASH_BITS];
+
 	/* The message queue is used by the control thread to send commands
 	 * to the config thread, and also by the DSP to send messages to the
 	 * config thread.  Thus it is the only queue that is accessed from
@@ -120,7 +163,7 @@ struct msm_sync {
 	/* This queue contains preview frames. It is accessed by the DSP (in
 	 * in interrupt context, and by the frame thread.
 	 */
-	struct msm_device_queue frame_q;
+	struct msm_frame_ring frame_q;
 	int unblock_poll_frame;
 
 	/* This queue contains snapshot frames.  It is accessed by the DSP (in
@@ -128,6 +171,8 @@ struct msm_sync {
 	 */
 	struct msm_device_queue pict_q;
 
+	struct msm_qcmd_pool qcmd_pool;
+
 	struct msm_camera_sensor_info *sdata;
 	struct msm_camvfe_fn vfefn;
 	struct msm_sensor_ctrl sctrl;
@@ -149,6 +194,12 @@ struct msm_sync {
 
 	const char *apps_id;
 
+	/* preview frame statistics, reset on first open */
+	unsigned frame_count;
+	unsigned frame_lookup_miss;
+	u64 frame_latency_us; /* VFE callback to MSM_CAM_IOCTL_GETFRAME */
+	unsigned frame_latency_max_us;
+
 	struct mutex lock;
 	struct list_head list;
 };
@@ -187,6 +238,8 @@ struct register_address_value_pair {
 
 struct msm_pmem_region {
 	struct hlist_node list;
+	struct hlist_node phys_list; /* msm_sync.pmem_phys */
+	struct hlist_node virt_list; /* msm_sync.pmem_virt */
 	unsigned long paddr;
 	unsigned long kvaddr;
 	unsigned long len;
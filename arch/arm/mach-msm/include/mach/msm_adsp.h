@@ -48,6 +48,16 @@ int msm_adsp_write(struct msm_adsp_module *module,
 		   unsigned queue_id,
 		   void *data, size_t len);
 
+struct msm_adsp_cmd {
+	unsigned queue;
+	void *data;
+	size_t len;
+};
+
+/* Write several commands in one go; returns the number written. */
+int msm_adsp_write_batch(struct msm_adsp_module *module,
+			 struct msm_adsp_cmd *cmds, unsigned count);
+
 /* Command Queue Indexes */
 #define QDSP_lpmCommandQueue              0
 #define QDSP_mpuAfeQueue                  1
@@ -20,6 +20,7 @@
 #define __ARCH_ARM_MACH_PERF_LOCK_H
 
 #include <linux/list.h>
+#include <linux/ktime.h>
 
 /*
  * Performance level determine differnt EBI1 rate
@@ -37,6 +38,12 @@ struct perf_lock {
 	unsigned int flags;
 	unsigned int level;
 	const char *name;
+
+	/* timeout and accounting, maintained by perflock.c */
+	ktime_t expires;
+	ktime_t activated;
+	u64 held_ns;
+	unsigned int activations;
 };
 
 struct perflock_platform_data {
@@ -51,16 +58,24 @@ static inline void perf_lock_init(struct perf_lock *lock,
 	unsigned int level, const char *name) { return; }
 static inline void perf_lock(struct perf_lock *lock) { return; }
 static inline void perf_unlock(struct perf_lock *lock) { return; }
+static inline void perf_lock_timeout(struct perf_lock *lock,
+	unsigned long timeout_ms) { return; }
 static inline int is_perf_lock_active(struct perf_lock *lock) { return 0; }
 static inline int is_perf_locked(void) { return 0; }
+static inline unsigned int perflock_get_floor(void) { return 0; }
+static inline void perflock_set_soft_floor(int soft) { return; }
 #else
 extern void __init perflock_init(struct perflock_platform_data *pdata);
 extern void perf_lock_init(struct perf_lock *lock,
 	unsigned int level, const char *name);
 extern void perf_lock(struct perf_lock *lock);
 extern void perf_unlock(struct perf_lock *lock);
+extern void perf_lock_timeout(struct perf_lock *lock,
+	unsigned long timeout_ms);
 extern int is_perf_lock_active(struct perf_lock *lock);
 extern int is_perf_locked(void);
+extern unsigned int perflock_get_floor(void);
+extern void perflock_set_soft_floor(int soft);
 #endif
 
 
@@ -33,12 +33,26 @@
 
 #define SMIOC_SETMODE _IOW(SMEM_LOG_BASE, 1, int)
 #define SMIOC_SETLOG _IOW(SMEM_LOG_BASE, 2, int)
+#define SMIOC_GETINFO _IOR(SMEM_LOG_BASE, 3, struct smem_log_info)
+#define SMIOC_FLUSH _IO(SMEM_LOG_BASE, 4)
 
 #define SMIOC_TEXT 0x00000001
 #define SMIOC_BINARY 0x00000002
 #define SMIOC_LOG 0x00000003
 #define SMIOC_STATIC_LOG 0x00000004
 
+/* Layout of the selected log inside the read-only mmap of the binary
+ * device.  Offsets are in bytes from the start of the mapping; each
+ * entry is item_size bytes and *idx is the next slot to be written.
+ */
+struct smem_log_info {
+	uint32_t events_offset;
+	uint32_t idx_offset;
+	uint32_t num_entries;
+	uint32_t item_size;
+	uint32_t map_size;
+};
+
 /* Event indentifier format:
  * bit  31-28 is processor ID 8 => apps, 4 => Q6, 0 => modem
  * bits 27-16 are subsystem id (event base)
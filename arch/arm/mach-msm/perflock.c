@@ -22,12 +22,16 @@
 #include <linux/earlysuspend.h>
 #include <linux/cpufreq.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
 #include <mach/perflock.h>
 #include "proc_comm.h"
 #include "acpuclock.h"
 
 #define PERF_LOCK_INITIALIZED	(1U << 0)
 #define PERF_LOCK_ACTIVE	(1U << 1)
+#define PERF_LOCK_TIMED		(1U << 2)
 
 enum {
 	PERF_LOCK_DEBUG = 1U << 0,
@@ -46,6 +50,23 @@ static unsigned int *perf_acpu_table;
 static unsigned int table_size;
 static unsigned int curr_lock_speed;
 static struct cpufreq_policy *cpufreq_policy;
+/* set while a governor applies the lock speed itself */
+static int soft_floor;
+
+/*
+ * Number of active locks at each level.  The highest level with a
+ * non-zero count decides the speed, so nothing has to walk the list
+ * of active locks to answer get_perflock_speed().
+ */
+static unsigned int level_count[PERF_LOCK_INVALID];
+static int top_level = -1;
+
+/* time spent with each level on top; index 0 is "no lock" */
+static u64 level_time_ns[PERF_LOCK_INVALID + 1];
+static ktime_t level_since;
+
+/* one timer serves every perf_lock_timeout() lock */
+static struct hrtimer expire_timer;
 
 #ifdef CONFIG_PERF_LOCK_DEBUG
 static int debug_mask = PERF_LOCK_DEBUG | PERF_EXPIRE_DEBUG |
@@ -184,7 +205,7 @@ static int perflock_notifier_call(struct notifier_block *self,
 		}
 #endif
 		lock_speed = get_perflock_speed() / 1000;
-		if (lock_speed) {
+		if (lock_speed && !soft_floor) {
 			policy->min = lock_speed;
 			policy->max = lock_speed;
 			if (debug_mask & PERF_CPUFREQ_LOCK_DEBUG) {
@@ -210,24 +231,34 @@ static struct notifier_block perflock_notifier = {
 	.notifier_call = perflock_notifier_call,
 };
 
+/* Called with list_lock held whenever a level count changes. */
+static void perf_level_update(void)
+{
+	ktime_t now;
+	int level;
+
+	for (level = PERF_LOCK_INVALID - 1; level >= 0; level--)
+		if (level_count[level])
+			break;
+	if (level == top_level)
+		return;
+
+	now = ktime_get();
+	level_time_ns[top_level + 1] +=
+		ktime_to_ns(ktime_sub(now, level_since));
+	level_since = now;
+	top_level = level;
+}
+
 static unsigned int get_perflock_speed(void)
 {
-	unsigned long irqflags;
-	struct perf_lock *lock;
-	unsigned int perf_level = 0;
+	int level = top_level;
 
 	/* Get the maxmimum perf level. */
-	if (list_empty(&active_perf_locks))
+	if (level < 0 || !perf_acpu_table)
 		return 0;
 
-	spin_lock_irqsave(&list_lock, irqflags);
-	list_for_each_entry(lock, &active_perf_locks, link) {
-		if (lock->level > perf_level)
-			perf_level = lock->level;
-	}
-	spin_unlock_irqrestore(&list_lock, irqflags);
-
-	return perf_acpu_table[perf_level];
+	return perf_acpu_table[level];
 }
 
 static void print_active_locks(void)
@@ -268,6 +299,8 @@ void perf_lock_init(struct perf_lock *lock,
 	lock->name = name;
 	lock->flags = PERF_LOCK_INITIALIZED;
 	lock->level = level;
+	lock->held_ns = 0;
+	lock->activations = 0;
 
 	INIT_LIST_HEAD(&lock->link);
 	spin_lock_irqsave(&list_lock, irqflags);
@@ -295,16 +328,20 @@ void perf_lock(struct perf_lock *lock)
 		pr_info("%s: '%s', flags %d level %d\n",
 			__func__, lock->name, lock->flags, lock->level);
 	if (lock->flags & PERF_LOCK_ACTIVE) {
+		spin_unlock_irqrestore(&list_lock, irqflags);
 		pr_err("%s: over-locked\n", __func__);
 		return;
 	}
 	lock->flags |= PERF_LOCK_ACTIVE;
-	list_del(&lock->link);
-	list_add(&lock->link, &active_perf_locks);
+	lock->activated = ktime_get();
+	lock->activations++;
+	list_move(&lock->link, &active_perf_locks);
+	level_count[lock->level]++;
+	perf_level_update();
 	spin_unlock_irqrestore(&list_lock, irqflags);
 
 	/* Update cpufreq policy - scaling_min/scaling_max */
-	if (cpufreq_policy &&
+	if (cpufreq_policy && !soft_floor &&
 			(curr_lock_speed != (get_perflock_speed() / 1000)))
 		cpufreq_update_policy(cpufreq_policy->cpu);
 }
@@ -325,6 +362,16 @@ static void do_expire_perf_locks(struct work_struct *work)
 }
 static DECLARE_DELAYED_WORK(work_expire_perf_locks, do_expire_perf_locks);
 
+/* Called with list_lock held. */
+static void __perf_unlock(struct perf_lock *lock)
+{
+	lock->flags &= ~(PERF_LOCK_ACTIVE | PERF_LOCK_TIMED);
+	lock->held_ns += ktime_to_ns(ktime_sub(ktime_get(), lock->activated));
+	list_move(&lock->link, &inactive_perf_locks);
+	level_count[lock->level]--;
+	perf_level_update();
+}
+
 /**
  * perf_unlock - de-activate a perf lock
  * @lock: perf lock to de-activate
@@ -343,22 +390,88 @@ void perf_unlock(struct perf_lock *lock)
 		pr_info("%s: '%s', flags %d level %d\n",
 			__func__, lock->name, lock->flags, lock->level);
 	if (!(lock->flags & PERF_LOCK_ACTIVE)) {
+		spin_unlock_irqrestore(&list_lock, irqflags);
 		pr_err("%s: under-locked\n", __func__);
 		return;
 	}
-	lock->flags &= ~PERF_LOCK_ACTIVE;
-	list_del(&lock->link);
-	list_add(&lock->link, &inactive_perf_locks);
+	__perf_unlock(lock);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 
 	/* Prevent lock/unlock quickly, add a timeout to release perf_lock */
-	if (cpufreq_policy &&
+	if (cpufreq_policy && !soft_floor &&
 			(curr_lock_speed != (get_perflock_speed() / 1000)))
 		schedule_delayed_work(&work_expire_perf_locks,
 			PERF_UNLOCK_DELAY);
 }
 EXPORT_SYMBOL(perf_unlock);
 
+static enum hrtimer_restart perf_expire_timer_func(struct hrtimer *timer)
+{
+	struct perf_lock *lock, *n;
+	ktime_t now = ktime_get();
+	ktime_t next = { .tv64 = KTIME_MAX };
+	unsigned long irqflags;
+	int expired = 0;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	list_for_each_entry_safe(lock, n, &active_perf_locks, link) {
+		if (!(lock->flags & PERF_LOCK_TIMED))
+			continue;
+		if (lock->expires.tv64 <= now.tv64) {
+			if (debug_mask & PERF_EXPIRE_DEBUG)
+				pr_info("%s: '%s' expired\n",
+					__func__, lock->name);
+			__perf_unlock(lock);
+			expired = 1;
+		} else if (lock->expires.tv64 < next.tv64)
+			next = lock->expires;
+	}
+	spin_unlock_irqrestore(&list_lock, irqflags);
+
+	/* the caller asked for this timeout, don't stretch it further */
+	if (expired && cpufreq_policy && !soft_floor &&
+			(curr_lock_speed != (get_perflock_speed() / 1000)))
+		schedule_delayed_work(&work_expire_perf_locks, 0);
+
+	if (next.tv64 == KTIME_MAX)
+		return HRTIMER_NORESTART;
+	hrtimer_set_expires(timer, next);
+	return HRTIMER_RESTART;
+}
+
+/**
+ * perf_lock_timeout - activate a perf lock for a limited time
+ * @lock: perf lock to activate
+ * @timeout_ms: milliseconds after which @lock is released
+ *
+ * Activate @lock, or push out the release time of an already active
+ * one.  perf_unlock() may still be used to release it early.
+ */
+void perf_lock_timeout(struct perf_lock *lock, unsigned long timeout_ms)
+{
+	unsigned long irqflags;
+	ktime_t expires;
+	int active;
+
+	expires = ktime_add(ktime_get(),
+			    ktime_set(timeout_ms / MSEC_PER_SEC,
+				      (timeout_ms % MSEC_PER_SEC) *
+				      NSEC_PER_MSEC));
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	active = lock->flags & PERF_LOCK_ACTIVE;
+	lock->flags |= PERF_LOCK_TIMED;
+	lock->expires = expires;
+	if (!hrtimer_active(&expire_timer) ||
+	    hrtimer_get_expires(&expire_timer).tv64 > expires.tv64)
+		hrtimer_start(&expire_timer, expires, HRTIMER_MODE_ABS);
+	spin_unlock_irqrestore(&list_lock, irqflags);
+
+	if (!active)
+		perf_lock(lock);
+}
+EXPORT_SYMBOL(perf_lock_timeout);
+
 /**
  * is_perf_lock_active - query if a perf_lock is active or not
  * @lock: target perf lock
@@ -378,22 +491,119 @@ EXPORT_SYMBOL(is_perf_lock_active);
  */
 int is_perf_locked(void)
 {
-	return (!list_empty(&active_perf_locks));
+	return top_level >= 0;
 }
 EXPORT_SYMBOL(is_perf_locked);
 
+/**
+ * perflock_get_floor - speed requested by the active perf locks
+ * RETURN: speed in kHz, 0 if no perf lock is active
+ */
+unsigned int perflock_get_floor(void)
+{
+	return get_perflock_speed() / 1000;
+}
+EXPORT_SYMBOL(perflock_get_floor);
 
-#ifdef CONFIG_PERFLOCK_BOOT_LOCK
-/* Stop cpufreq and lock cpu, shorten boot time. */
-#define BOOT_LOCK_TIMEOUT	(60 * HZ)
-static struct perf_lock boot_perf_lock;
+static void do_update_policy(struct work_struct *work)
+{
+	if (cpufreq_policy)
+		cpufreq_update_policy(cpufreq_policy->cpu);
+}
+static DECLARE_WORK(work_update_policy, do_update_policy);
+
+/**
+ * perflock_set_soft_floor - let the governor apply perf lock speeds
+ * @soft: 1 to stop pinning policy->min/max to the lock speed
+ *
+ * With @soft set the governor is expected to use perflock_get_floor()
+ * as a floor while the CPU is busy.
+ */
+void perflock_set_soft_floor(int soft)
+{
+	soft_floor = soft;
+
+	/* re-evaluate the policy outside of the governor callback */
+	schedule_work(&work_update_policy);
+}
+EXPORT_SYMBOL(perflock_set_soft_floor);
 
-static void do_expire_boot_lock(struct work_struct *work)
+#ifdef CONFIG_DEBUG_FS
+static void perflock_show_lock(struct seq_file *m, struct perf_lock *lock,
+			       ktime_t now)
 {
-	perf_unlock(&boot_perf_lock);
-	pr_info("Release 'boot-time' perf_lock\n");
+	u64 held = lock->held_ns;
+
+	if (lock->flags & PERF_LOCK_ACTIVE)
+		held += ktime_to_ns(ktime_sub(now, lock->activated));
+
+	seq_printf(m, "%-16s %5u %6s %11u %10llu\n", lock->name,
+		   lock->level, (lock->flags & PERF_LOCK_ACTIVE) ? "yes" : "no",
+		   lock->activations, div_u64(held, NSEC_PER_MSEC));
 }
-static DECLARE_DELAYED_WORK(work_expire_boot_lock, do_expire_boot_lock);
+
+static int perflock_stats_show(struct seq_file *m, void *unused)
+{
+	unsigned long irqflags;
+	struct perf_lock *lock;
+	ktime_t now;
+	u64 t;
+	int i;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	now = ktime_get();
+
+	seq_printf(m, "level  speed_khz  active   time_ms\n");
+	for (i = -1; i < PERF_LOCK_INVALID; i++) {
+		t = level_time_ns[i + 1];
+		if (i == top_level)
+			t += ktime_to_ns(ktime_sub(now, level_since));
+		if (i < 0)
+			seq_printf(m, "none   %9s  %6s", "-", "-");
+		else
+			seq_printf(m, "%-6d %9u  %6u", i,
+				   perf_acpu_table ? perf_acpu_table[i] / 1000
+						   : 0,
+				   level_count[i]);
+		seq_printf(m, " %9llu\n", div_u64(t, NSEC_PER_MSEC));
+	}
+
+	seq_printf(m, "\n%-16s level active activations    held_ms\n",
+		   "name");
+	list_for_each_entry(lock, &active_perf_locks, link)
+		perflock_show_lock(m, lock, now);
+	list_for_each_entry(lock, &inactive_perf_locks, link)
+		perflock_show_lock(m, lock, now);
+	spin_unlock_irqrestore(&list_lock, irqflags);
+	return 0;
+}
+
+static int perflock_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, perflock_stats_show, NULL);
+}
+
+static const struct file_operations perflock_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = perflock_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init perflock_debug_init(void)
+{
+	debugfs_create_file("perflock", 0444, NULL, NULL,
+			    &perflock_stats_fops);
+	return 0;
+}
+late_initcall(perflock_debug_init);
+#endif
+
+#ifdef CONFIG_PERFLOCK_BOOT_LOCK
+/* Stop cpufreq and lock cpu, shorten boot time. */
+#define BOOT_LOCK_TIMEOUT_MS	(60 * MSEC_PER_SEC)
+static struct perf_lock boot_perf_lock;
 #endif
 
 static void perf_acpu_table_fixup(void)
@@ -417,6 +627,10 @@ void __init perflock_init(struct perflock_platform_data *pdata)
 	policy_min = policy.cpuinfo.min_freq;
 	policy_max = policy.cpuinfo.max_freq;
 
+	hrtimer_init(&expire_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	expire_timer.function = perf_expire_timer_func;
+	level_since = ktime_get();
+
 	if (!pdata)
 		goto invalid_config;
 
@@ -435,8 +649,7 @@ void __init perflock_init(struct perflock_platform_data *pdata)
 #ifdef CONFIG_PERFLOCK_BOOT_LOCK
 	/* Stop cpufreq and lock cpu, shorten boot time. */
 	perf_lock_init(&boot_perf_lock, PERF_LOCK_HIGHEST, "boot-time");
-	perf_lock(&boot_perf_lock);
-	schedule_delayed_work(&work_expire_boot_lock, BOOT_LOCK_TIMEOUT);
+	perf_lock_timeout(&boot_perf_lock, BOOT_LOCK_TIMEOUT_MS);
 	pr_info("Acquire 'boot-time' perf_lock\n");
 #endif
 
@@ -26,6 +26,8 @@
 #include <linux/suspend.h>
 #include <linux/reboot.h>
 #include <linux/earlysuspend.h>
+#include <linux/suspend_profile.h>
+#include <linux/math64.h>
 #include <mach/msm_iomap.h>
 #include <mach/system.h>
 #include <asm/io.h>
@@ -74,6 +76,8 @@ static int msm_pm_idle_sleep_min_time = CONFIG_MSM7X00A_IDLE_SLEEP_MIN_TIME;
 module_param_named(idle_sleep_min_time, msm_pm_idle_sleep_min_time, int, S_IRUGO | S_IWUSR | S_IWGRP);
 static int msm_pm_idle_spin_time = CONFIG_MSM7X00A_IDLE_SPIN_TIME;
 module_param_named(idle_spin_time, msm_pm_idle_spin_time, int, S_IRUGO | S_IWUSR | S_IWGRP);
+static int msm_pm_idle_predict = 1;
+module_param_named(idle_predict, msm_pm_idle_predict, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
 #define A11S_CLK_SLEEP_EN (MSM_CSR_BASE + 0x11c)
 #define A11S_PWRDOWN (MSM_CSR_BASE + 0x440)
@@ -189,6 +193,125 @@ static void msm_pm_add_stat(enum msm_pm_time_stats_id id, int64_t t)
 }
 #endif
 
+/*
+ * Idle residency prediction.  The next timer event is only an upper bound
+ * on how long we stay idle; other interrupts often end the idle period
+ * much earlier, and a power collapse that is cut short costs more than it
+ * saves.  The prediction is the timer bound scaled by how much of it we
+ * actually got the last times a similar bound was requested, or the
+ * recent idle length if the last few idle periods were all about the same.
+ * Power collapse is only used when the prediction is still above
+ * idle_sleep_min_time, so the predictor can only demote a sleep to wfi.
+ */
+#define MSM_PM_IDLE_HISTORY 8
+#define MSM_PM_IDLE_BUCKETS 8		/* <1ms, <2ms, ... >=64ms */
+#define MSM_PM_IDLE_FACTOR_SHIFT 10
+
+enum {
+	MSM_PM_IDLE_MODE_SPIN,
+	MSM_PM_IDLE_MODE_WFI,
+	MSM_PM_IDLE_MODE_SLEEP,
+	MSM_PM_IDLE_MODE_COUNT
+};
+
+static const char *msm_pm_idle_mode_names[MSM_PM_IDLE_MODE_COUNT] = {
+	[MSM_PM_IDLE_MODE_SPIN] = "spin",
+	[MSM_PM_IDLE_MODE_WFI] = "wfi",
+	[MSM_PM_IDLE_MODE_SLEEP] = "sleep",
+};
+
+static struct msm_pm_idle_predictor {
+	uint32_t history[MSM_PM_IDLE_HISTORY];	/* recent idle lengths, us */
+	int next;
+	/* fraction of the timer bound actually spent idle, per bound size */
+	uint32_t factor[MSM_PM_IDLE_BUCKETS];
+
+	unsigned count[MSM_PM_IDLE_MODE_COUNT];
+	uint64_t residency_us[MSM_PM_IDLE_MODE_COUNT];
+	unsigned demoted;	/* timer allowed sleep, prediction did not */
+	unsigned short_sleeps;	/* slept for less than the min time */
+	unsigned long_wfis;	/* wfi lasted longer than the min time */
+	unsigned early_wakeups;	/* woke before half the timer bound */
+} msm_pm_idle = {
+	.factor = {
+		[0 ... MSM_PM_IDLE_BUCKETS - 1] = 1 << MSM_PM_IDLE_FACTOR_SHIFT
+	},
+};
+
+static int msm_pm_idle_bucket(uint32_t bound_us)
+{
+	int bucket = fls(bound_us >> 10);
+
+	return min(bucket, MSM_PM_IDLE_BUCKETS - 1);
+}
+
+/* Typical idle length if the recent history is consistent, else 0 */
+static uint32_t msm_pm_idle_typical_us(void)
+{
+	uint64_t sum = 0, variance = 0;
+	uint32_t avg;
+	int i;
+
+	for (i = 0; i < MSM_PM_IDLE_HISTORY; i++)
+		sum += msm_pm_idle.history[i];
+	avg = div_u64(sum, MSM_PM_IDLE_HISTORY);
+	for (i = 0; i < MSM_PM_IDLE_HISTORY; i++) {
+		int64_t d = (int64_t)msm_pm_idle.history[i] - avg;
+		variance += d * d;
+	}
+	variance = div_u64(variance, MSM_PM_IDLE_HISTORY);
+
+	/* standard deviation under a sixth of the average */
+	if ((uint64_t)avg * avg > 36 * variance)
+		return avg;
+	return 0;
+}
+
+static uint32_t msm_pm_idle_predict_us(uint32_t bound_us)
+{
+	uint32_t predicted, typical;
+
+	predicted = ((uint64_t)bound_us *
+		msm_pm_idle.factor[msm_pm_idle_bucket(bound_us)]) >>
+		MSM_PM_IDLE_FACTOR_SHIFT;
+	typical = msm_pm_idle_typical_us();
+	if (typical && typical < predicted)
+		predicted = typical;
+	return predicted;
+}
+
+static void msm_pm_idle_update(int mode, uint32_t bound_us, uint32_t idle_us)
+{
+	uint32_t min_us = msm_pm_idle_sleep_min_time / NSEC_PER_USEC;
+	uint32_t ratio;
+	int bucket;
+
+	msm_pm_idle.count[mode]++;
+	msm_pm_idle.residency_us[mode] += idle_us;
+	if (mode == MSM_PM_IDLE_MODE_SLEEP && idle_us < min_us)
+		msm_pm_idle.short_sleeps++;
+	if (mode == MSM_PM_IDLE_MODE_WFI && idle_us >= min_us)
+		msm_pm_idle.long_wfis++;
+	if (idle_us < bound_us / 2)
+		msm_pm_idle.early_wakeups++;
+
+	/* keep the variance math in range, longer idles all look alike */
+	msm_pm_idle.history[msm_pm_idle.next] =
+		min_t(uint32_t, idle_us, USEC_PER_SEC);
+	msm_pm_idle.next = (msm_pm_idle.next + 1) % MSM_PM_IDLE_HISTORY;
+
+	if (!bound_us)
+		return;
+	if (idle_us >= bound_us)
+		ratio = 1 << MSM_PM_IDLE_FACTOR_SHIFT;
+	else
+		ratio = div_u64((uint64_t)idle_us << MSM_PM_IDLE_FACTOR_SHIFT,
+				bound_us);
+	bucket = msm_pm_idle_bucket(bound_us);
+	msm_pm_idle.factor[bucket] =
+		(msm_pm_idle.factor[bucket] * 7 + ratio) / 8;
+}
+
 static int
 msm_pm_wait_state(uint32_t wait_all_set, uint32_t wait_all_clear,
                   uint32_t wait_any_set, uint32_t wait_any_clear)
@@ -406,7 +529,11 @@ static int msm_sleep(int sleep_mode, uint32_t sleep_delay, int from_idle)
 		if (!from_idle) printk(KERN_INFO "[R] suspend end\n");
 		/* reset idle sleep mode when suspend. */
 		if (!from_idle) msm_pm_idle_sleep_mode = CONFIG_MSM7X00A_IDLE_SLEEP_MODE;
+		if (!from_idle)
+			suspend_profile_mark(SUSPEND_PROFILE_SLEEP_ENTER);
 		collapsed = msm_pm_collapse();
+		if (!from_idle)
+			suspend_profile_mark(SUSPEND_PROFILE_SLEEP_EXIT);
 		if (!from_idle) printk(KERN_INFO "[R] resume start\n");
 #ifdef CONFIG_CACHE_L2X0
 		l2x0_resume(collapsed);
@@ -430,7 +557,11 @@ static int msm_sleep(int sleep_mode, uint32_t sleep_delay, int from_idle)
 		if (msm_pm_debug_mask & MSM_PM_DEBUG_SMSM_STATE)
 			smsm_print_sleep_info(0);
 	} else {
+		if (!from_idle)
+			suspend_profile_mark(SUSPEND_PROFILE_SLEEP_ENTER);
 		msm_arch_idle();
+		if (!from_idle)
+			suspend_profile_mark(SUSPEND_PROFILE_SLEEP_EXIT);
 		rv = 0;
 	}
 #ifdef CONFIG_HTC_POWER_COLLAPSE_MAGIC
@@ -514,6 +645,9 @@ void arch_idle(void)
 	int ret;
 	int64_t sleep_time;
 	int low_power = 0;
+	int mode;
+	uint32_t bound_us;
+	ktime_t idle_start;
 #ifdef CONFIG_MSM_IDLE_STATS
 	int64_t t1;
 	static int64_t t2;
@@ -529,6 +663,9 @@ void arch_idle(void)
 		return;
 
 	sleep_time = msm_timer_enter_idle();
+	idle_start = ktime_get();
+	bound_us = min_t(uint64_t, div_u64(sleep_time, NSEC_PER_USEC),
+			 UINT_MAX);
 #ifdef CONFIG_MSM_IDLE_STATS
 	t1 = ktime_to_ns(ktime_get());
 	msm_pm_add_stat(MSM_PM_STAT_NOT_IDLE, t1 - t2);
@@ -537,8 +674,22 @@ void arch_idle(void)
 	if (msm_pm_debug_mask & MSM_PM_DEBUG_IDLE)
 		printk(KERN_INFO "arch_idle: sleep time %llu, allow_sleep %d\n",
 		       sleep_time, allow_sleep);
+	if (allow_sleep && msm_pm_idle_predict &&
+	    sleep_time >= msm_pm_idle_sleep_min_time) {
+		uint32_t predicted_us = msm_pm_idle_predict_us(bound_us);
+
+		if ((int64_t)predicted_us * NSEC_PER_USEC <
+		    msm_pm_idle_sleep_min_time) {
+			if (msm_pm_debug_mask & MSM_PM_DEBUG_IDLE)
+				printk(KERN_INFO "arch_idle: predicted %u us, "
+				       "no sleep\n", predicted_us);
+			msm_pm_idle.demoted++;
+			allow_sleep = 0;
+		}
+	}
 	if (sleep_time < msm_pm_idle_sleep_min_time || !allow_sleep) {
 		unsigned long saved_rate;
+		mode = MSM_PM_IDLE_MODE_SPIN;
 		/* only spin while trying wfi ramp down */
 		if (acpuclk_get_wfi_rate() && msm_pm_idle_spin() < 0) {
 #ifdef CONFIG_MSM_IDLE_STATS
@@ -546,6 +697,7 @@ void arch_idle(void)
 #endif
 			goto abort_idle;
 		}
+		mode = MSM_PM_IDLE_MODE_WFI;
 		saved_rate = acpuclk_wait_for_irq();
 
 
@@ -578,6 +730,7 @@ void arch_idle(void)
 		exit_stat = MSM_PM_STAT_IDLE_WFI;
 #endif
   	} else {
+		mode = MSM_PM_IDLE_MODE_SPIN;
 		if (msm_pm_idle_spin() < 0) {
 #ifdef CONFIG_MSM_IDLE_STATS
 			exit_stat = MSM_PM_STAT_IDLE_SPIN;
@@ -585,6 +738,7 @@ void arch_idle(void)
 			goto abort_idle;
 		}
 
+		mode = MSM_PM_IDLE_MODE_SLEEP;
 		low_power = 1;
 		do_div(sleep_time, NSEC_PER_SEC / 32768);
 		if (sleep_time > 0x6DDD000) {
@@ -601,6 +755,8 @@ void arch_idle(void)
 	}
 abort_idle:
 	msm_timer_exit_idle(low_power);
+	msm_pm_idle_update(mode, bound_us,
+		ktime_to_us(ktime_sub(ktime_get(), idle_start)));
 #ifdef CONFIG_MSM_IDLE_STATS
 	t2 = ktime_to_ns(ktime_get());
 	msm_pm_add_stat(exit_stat, t2 - t1);
@@ -763,6 +919,44 @@ static int msm_pm_read_proc(char *page, char **start, off_t off,
 }
 #endif
 
+static int msm_pm_idle_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	char *p = page;
+	int len;
+	int i;
+
+	p += sprintf(p, "predictor: %s\n",
+		     msm_pm_idle_predict ? "enabled" : "disabled");
+	p += sprintf(p, "mode       count   residency_us     avg_us\n");
+	for (i = 0; i < MSM_PM_IDLE_MODE_COUNT; i++) {
+		unsigned n = msm_pm_idle.count[i];
+		uint64_t us = msm_pm_idle.residency_us[i];
+
+		p += sprintf(p, "%-5s %10u %14llu %10llu\n",
+			     msm_pm_idle_mode_names[i], n, us,
+			     n ? div_u64(us, n) : 0);
+	}
+	p += sprintf(p, "demoted: %u\nshort_sleeps: %u\nlong_wfis: %u\n"
+		     "early_wakeups: %u\n", msm_pm_idle.demoted,
+		     msm_pm_idle.short_sleeps, msm_pm_idle.long_wfis,
+		     msm_pm_idle.early_wakeups);
+	p += sprintf(p, "factor:");
+	for (i = 0; i < MSM_PM_IDLE_BUCKETS; i++)
+		p += sprintf(p, " %u", msm_pm_idle.factor[i]);
+	p += sprintf(p, "\ntypical_us: %u\n", msm_pm_idle_typical_us());
+
+	*start = page + off;
+
+	len = p - page;
+	if (len > off)
+		len -= off;
+	else
+		len = 0;
+
+	return len < count ? len  : count;
+}
+
 void msm_pm_set_max_sleep_time(int64_t max_sleep_time_ns)
 {
 	int64_t max_sleep_time_bs = max_sleep_time_ns;
@@ -847,6 +1041,8 @@ static int __init msm_pm_init(void)
 	create_proc_read_entry("msm_pm_stats", S_IRUGO,
 				NULL, msm_pm_read_proc, NULL);
 #endif
+	create_proc_read_entry("msm_pm_idle", S_IRUGO,
+				NULL, msm_pm_idle_read_proc, NULL);
 
 	if (board_mfg_mode() == 0)
 	{
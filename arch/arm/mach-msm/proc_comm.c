@@ -18,6 +18,14 @@
 #include <linux/errno.h>
 #include <linux/io.h>
 #include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
 #include <mach/msm_iomap.h>
 #include <mach/system.h>
 
@@ -46,6 +54,38 @@ static inline void notify_other_proc_comm(void)
 
 static DEFINE_SPINLOCK(proc_comm_lock);
 
+/* Asynchronous requests waiting for the worker, oldest first. */
+static LIST_HEAD(proc_comm_queue);
+
+/* Asynchronous requests the modem has answered, waiting for the
+ * worker to call their done callbacks.
+ */
+static LIST_HEAD(proc_comm_reaped);
+
+/* The asynchronous request whose command the modem is working on, if
+ * any.  A synchronous caller finishes it before issuing its own.
+ */
+static struct msm_proc_comm_req *proc_comm_inflight;
+
+/* The modem raises no interrupt when it is done with a command, so
+ * the worker sleeps between polls, backing off from MIN to MAX.
+ */
+#define PROC_COMM_POLL_MIN_US	20
+#define PROC_COMM_POLL_MAX_US	1000
+
+static struct workqueue_struct *proc_comm_wq;
+static void proc_comm_work_func(struct work_struct *work);
+static DECLARE_WORK(proc_comm_work, proc_comm_work_func);
+
+struct proc_comm_stats {
+	unsigned count;
+	unsigned async;
+	unsigned coalesced;
+	unsigned max_us;
+	u64 total_us;
+};
+static struct proc_comm_stats proc_comm_stats[PCOM_NUM_CMDS];
+
 /* The higher level SMD support will install this to
  * provide a way to check for and handle modem restart.
  */
@@ -71,11 +111,70 @@ static int proc_comm_wait_for(void __iomem *addr, unsigned value)
 	}
 }
 
-int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
+/* Hand @req to the modem.  Called with proc_comm_lock held. */
+static void proc_comm_issue(struct msm_proc_comm_req *req)
+{
+	void __iomem *base = MSM_SHARED_RAM_BASE;
+
+	while (proc_comm_wait_for(base + MDM_STATUS, PCOM_READY))
+		;
+
+	writel(req->cmd, base + APP_COMMAND);
+	writel(req->data1, base + APP_DATA1);
+	writel(req->data2, base + APP_DATA2);
+
+	notify_other_proc_comm();
+}
+
+/* Wait for the modem to finish @req, reissuing it if the modem
+ * restarted meanwhile, and collect the result.  Called with
+ * proc_comm_lock held.
+ */
+static void proc_comm_reap(struct msm_proc_comm_req *req)
 {
 	void __iomem *base = MSM_SHARED_RAM_BASE;
+
+	while (proc_comm_wait_for(base + APP_COMMAND, PCOM_CMD_DONE))
+		proc_comm_issue(req);
+
+	if (readl(base + APP_STATUS) != PCOM_CMD_FAIL) {
+		req->data1 = readl(base + APP_DATA1);
+		req->data2 = readl(base + APP_DATA2);
+		req->result = 0;
+	} else {
+		req->result = -EIO;
+	}
+
+	writel(PCOM_CMD_IDLE, base + APP_COMMAND);
+}
+
+/* Called with proc_comm_lock held. */
+static void proc_comm_account(struct msm_proc_comm_req *req, int async)
+{
+	struct proc_comm_stats *st;
+	unsigned us;
+
+	if (req->cmd >= PCOM_NUM_CMDS)
+		return;
+
+	st = &proc_comm_stats[req->cmd];
+	us = ktime_to_us(ktime_sub(ktime_get(), req->queued));
+	st->count++;
+	st->async += async;
+	st->total_us += us;
+	if (us > st->max_us)
+		st->max_us = us;
+}
+
+int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
+{
+	struct msm_proc_comm_req req, *aq;
 	unsigned long flags;
-	int ret;
+
+	req.cmd = cmd;
+	req.data1 = data1 ? *data1 : 0;
+	req.data2 = data2 ? *data2 : 0;
+	req.queued = ktime_get();
 
 	spin_lock_irqsave(&proc_comm_lock, flags);
 
@@ -97,36 +196,282 @@ int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
 	}
 #endif
 
+	/* The worker sleeps while the modem runs its command; finish it
+	 * for the worker rather than waiting for it to come back.
+	 */
+	if (proc_comm_inflight) {
+		proc_comm_reap(proc_comm_inflight);
+		proc_comm_inflight = NULL;
+	}
+
+	/* Commands reach the modem in the order they were submitted: run
+	 * anything still queued ahead of us, leaving the callbacks to
+	 * the worker.
+	 */
+	while (!list_empty(&proc_comm_queue)) {
+		aq = list_first_entry(&proc_comm_queue,
+				      struct msm_proc_comm_req, list);
+		list_move_tail(&aq->list, &proc_comm_reaped);
+		proc_comm_issue(aq);
+		proc_comm_reap(aq);
+		proc_comm_account(aq, 1);
+	}
+
+	proc_comm_issue(&req);
+	proc_comm_reap(&req);
+	proc_comm_account(&req, 0);
+
+	spin_unlock_irqrestore(&proc_comm_lock, flags);
+
+	if (data1)
+		*data1 = req.data1;
+	if (data2)
+		*data2 = req.data2;
+
+	return req.result;
+}
+
+/* Commands whose effect only depends on the last request for a given
+ * data1 (a vreg or clock id), and commands for which an identical
+ * request right behind another is a no-op.
+ */
+static int proc_comm_coalescable(struct msm_proc_comm_req *prev,
+				 struct msm_proc_comm_req *req)
+{
+	if (prev->cmd != req->cmd || prev->data1 != req->data1)
+		return 0;
+
+	switch (req->cmd) {
+	case PCOM_VREG_SET_LEVEL:
+	case PCOM_CLKCTL_RPC_SET_FLAGS:
+	case PCOM_CLKCTL_RPC_SET_RATE:
+	case PCOM_CLKCTL_RPC_MIN_RATE:
+	case PCOM_CLKCTL_RPC_MAX_RATE:
+		return 1;
+	case PCOM_VREG_SWITCH:
+	case PCOM_VREG_PULLDOWN:
+	case PCOM_CLKCTL_RPC_ENABLE:
+	case PCOM_CLKCTL_RPC_DISABLE:
+		return prev->data2 == req->data2;
+	}
+	return 0;
+}
+
+static void proc_comm_complete(struct msm_proc_comm_req *req)
+{
+	struct msm_proc_comm_req *m, *n;
+
+	list_for_each_entry_safe(m, n, &req->merged, list) {
+		list_del(&m->list);
+		m->data1 = req->data1;
+		m->data2 = req->data2;
+		m->result = req->result;
+		if (m->done)
+			m->done(m);
+	}
+	if (req->done)
+		req->done(req);
+}
+
+/* Sleep until the modem is done with @req or a synchronous caller
+ * has finished it for us.
+ */
+static void proc_comm_sleep_for(struct msm_proc_comm_req *req)
+{
+	void __iomem *base = MSM_SHARED_RAM_BASE;
+	unsigned delay_us = PROC_COMM_POLL_MIN_US;
+	ktime_t t;
+
+	while (ACCESS_ONCE(proc_comm_inflight) == req &&
+	       readl(base + APP_COMMAND) != PCOM_CMD_DONE) {
+		if (msm_check_for_modem_crash &&
+		    msm_check_for_modem_crash())
+			break;
+
+		t = ktime_set(0, delay_us * NSEC_PER_USEC);
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		schedule_hrtimeout(&t, HRTIMER_MODE_REL);
+		if (delay_us < PROC_COMM_POLL_MAX_US)
+			delay_us = min(delay_us * 2,
+				       (unsigned)PROC_COMM_POLL_MAX_US);
+	}
+}
+
+static void proc_comm_work_func(struct work_struct *work)
+{
+	struct msm_proc_comm_req *req;
+	unsigned long flags;
+
+	spin_lock_irqsave(&proc_comm_lock, flags);
 	for (;;) {
-		if (proc_comm_wait_for(base + MDM_STATUS, PCOM_READY))
+		if (!list_empty(&proc_comm_reaped)) {
+			req = list_first_entry(&proc_comm_reaped,
+					       struct msm_proc_comm_req, list);
+			list_del(&req->list);
+			spin_unlock_irqrestore(&proc_comm_lock, flags);
+
+			proc_comm_complete(req);
+
+			spin_lock_irqsave(&proc_comm_lock, flags);
 			continue;
+		}
+		if (list_empty(&proc_comm_queue))
+			break;
 
-		writel(cmd, base + APP_COMMAND);
-		writel(data1 ? *data1 : 0, base + APP_DATA1);
-		writel(data2 ? *data2 : 0, base + APP_DATA2);
+		req = list_first_entry(&proc_comm_queue,
+				       struct msm_proc_comm_req, list);
+		list_del(&req->list);
 
-		notify_other_proc_comm();
+		proc_comm_issue(req);
+		proc_comm_inflight = req;
+		spin_unlock_irqrestore(&proc_comm_lock, flags);
 
-		if (proc_comm_wait_for(base + APP_COMMAND, PCOM_CMD_DONE))
-			continue;
+		proc_comm_sleep_for(req);
 
-		if (readl(base + APP_STATUS) != PCOM_CMD_FAIL) {
-			if (data1)
-				*data1 = readl(base + APP_DATA1);
-			if (data2)
-				*data2 = readl(base + APP_DATA2);
-			ret = 0;
-		} else {
-			ret = -EIO;
+		spin_lock_irqsave(&proc_comm_lock, flags);
+		if (proc_comm_inflight == req) {
+			proc_comm_reap(req);
+			proc_comm_inflight = NULL;
 		}
-		break;
+		proc_comm_account(req, 1);
+		list_add_tail(&req->list, &proc_comm_reaped);
 	}
+	spin_unlock_irqrestore(&proc_comm_lock, flags);
+}
 
-	writel(PCOM_CMD_IDLE, base + APP_COMMAND);
+/**
+ * msm_proc_comm_async - queue a proc_comm command
+ * @req: command to run; cmd, data1, data2 and done must be set
+ *
+ * Queue @req and return.  @req->done is called from process context
+ * once the modem has answered, with @req->result and the returned
+ * data1/data2 filled in.  A request that directly follows a pending
+ * one with the same effect is merged into it and completes with it.
+ * May be called from atomic context.  @req must stay valid until
+ * @req->done has been called.  Commands reach the modem in the order
+ * they were submitted, synchronous or not.
+ */
+void msm_proc_comm_async(struct msm_proc_comm_req *req)
+{
+	struct msm_proc_comm_req *prev;
+	unsigned long flags;
+
+	INIT_LIST_HEAD(&req->merged);
+	req->queued = ktime_get();
+
+	if (!proc_comm_wq) {
+		req->result = msm_proc_comm(req->cmd, &req->data1,
+					    &req->data2);
+		if (req->done)
+			req->done(req);
+		return;
+	}
 
+	spin_lock_irqsave(&proc_comm_lock, flags);
+	if (!list_empty(&proc_comm_queue)) {
+		prev = list_entry(proc_comm_queue.prev,
+				  struct msm_proc_comm_req, list);
+		if (proc_comm_coalescable(prev, req)) {
+			/* req takes prev's place in the queue */
+			list_del(&prev->list);
+			list_splice_init(&prev->merged, &req->merged);
+			list_add_tail(&prev->list, &req->merged);
+			req->queued = prev->queued;
+			if (req->cmd < PCOM_NUM_CMDS)
+				proc_comm_stats[req->cmd].coalesced++;
+		}
+	}
+	list_add_tail(&req->list, &proc_comm_queue);
 	spin_unlock_irqrestore(&proc_comm_lock, flags);
 
-	return ret;
+	queue_work(proc_comm_wq, &proc_comm_work);
 }
 
+static void proc_comm_post_done(struct msm_proc_comm_req *req)
+{
+	if (req->result)
+		pr_err("proc_comm: cmd %u (%u, %u) failed: %d\n", req->cmd,
+		       req->data1, req->data2, req->result);
+	kfree(req);
+}
+
+/**
+ * msm_proc_comm_post - issue a proc_comm command without waiting for it
+ *
+ * For callers that neither need the result nor depend on the command
+ * having taken effect when this returns, only on it being ordered
+ * against later commands.  May be called from atomic context.
+ */
+void msm_proc_comm_post(unsigned cmd, unsigned data1, unsigned data2)
+{
+	struct msm_proc_comm_req *req;
+
+	/* Before the workqueue (and possibly the allocator) is up, or
+	 * when memory is short, just wait for it.
+	 */
+	req = proc_comm_wq ? kmalloc(sizeof(*req), GFP_ATOMIC) : NULL;
+	if (!req) {
+		msm_proc_comm(cmd, &data1, &data2);
+		return;
+	}
+	req->cmd = cmd;
+	req->data1 = data1;
+	req->data2 = data2;
+	req->done = proc_comm_post_done;
+	req->context = NULL;
+	msm_proc_comm_async(req);
+}
 
+#if defined(CONFIG_DEBUG_FS)
+static int proc_comm_stats_show(struct seq_file *m, void *unused)
+{
+	struct proc_comm_stats st;
+	unsigned long flags;
+	unsigned cmd;
+
+	seq_printf(m, "cmd    count  async coalesced   avg_us   max_us\n");
+	for (cmd = 0; cmd < PCOM_NUM_CMDS; cmd++) {
+		spin_lock_irqsave(&proc_comm_lock, flags);
+		st = proc_comm_stats[cmd];
+		spin_unlock_irqrestore(&proc_comm_lock, flags);
+
+		if (!st.count && !st.coalesced)
+			continue;
+		seq_printf(m, "%3u %8u %6u %9u %8u %8u\n", cmd, st.count,
+			   st.async, st.coalesced,
+			   st.count ? (unsigned)div_u64(st.total_us, st.count)
+				    : 0,
+			   st.max_us);
+	}
+	return 0;
+}
+
+static int proc_comm_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, proc_comm_stats_show, NULL);
+}
+
+static const struct file_operations proc_comm_stats_fops = {
+	.open = proc_comm_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init proc_comm_debug_init(void)
+{
+	debugfs_create_file("proc_comm", 0444, NULL, NULL,
+			    &proc_comm_stats_fops);
+	return 0;
+}
+late_initcall(proc_comm_debug_init);
+#endif
+
+static int __init proc_comm_async_init(void)
+{
+	proc_comm_wq = create_singlethread_workqueue("proc_comm");
+	if (!proc_comm_wq)
+		return -ENOMEM;
+	return 0;
+}
+core_initcall(proc_comm_async_init);
@@ -16,6 +16,9 @@
 #ifndef _ARCH_ARM_MACH_MSM_PROC_COMM_H_
 #define _ARCH_ARM_MACH_MSM_PROC_COMM_H_
 
+#include <linux/list.h>
+#include <linux/ktime.h>
+
 enum {
 	PCOM_CMD_IDLE = 0x0,
 	PCOM_CMD_DONE,
@@ -254,4 +257,21 @@ enum {
 
 int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2);
 
+struct msm_proc_comm_req {
+	struct list_head list;
+	unsigned cmd;
+	unsigned data1;
+	unsigned data2;
+	int result;
+	void (*done)(struct msm_proc_comm_req *req);
+	void *context;
+
+	/* private to proc_comm.c */
+	struct list_head merged;
+	ktime_t queued;
+};
+
+void msm_proc_comm_async(struct msm_proc_comm_req *req);
+void msm_proc_comm_post(unsigned cmd, unsigned data1, unsigned data2);
+
 #endif
@@ -381,32 +381,35 @@ static int rpc_send_accepted_void_reply(struct msm_rpc_endpoint *client,
 	return rc;
 }
 
-int __msm_adsp_write(struct msm_adsp_module *module, unsigned dsp_queue_addr,
-		   void *cmd_buf, size_t cmd_size)
+/* Called with adsp_cmd_lock held. */
+static int adsp_write_check(struct msm_adsp_module *module)
 {
-	uint32_t ctrl_word;
-	uint32_t dsp_q_addr;
-	uint32_t dsp_addr;
-	uint32_t cmd_id = 0;
-	int cnt = 0;
-	int ret_status = 0;
-	unsigned long flags;
-	struct adsp_info *info = module->info;
-
-	spin_lock_irqsave(&adsp_cmd_lock, flags);
-
 	if (module->state != ADSP_STATE_ENABLED) {
-		spin_unlock_irqrestore(&adsp_cmd_lock, flags);
 		pr_err("adsp: module %s not enabled before write\n",
 		       module->name);
 		return -ENODEV;
 	}
 	if (adsp_validate_module(module->id)) {
-		spin_unlock_irqrestore(&adsp_cmd_lock, flags);
 		pr_info("adsp: module id validation failed %s  %d\n",
 			module->name, module->id);
 		return -ENXIO;
 	}
+	return 0;
+}
+
+/* Hand one command to the DSP.  Called with adsp_cmd_lock held. */
+static int adsp_write_locked(struct msm_adsp_module *module,
+			     unsigned dsp_queue_addr,
+			     void *cmd_buf, size_t cmd_size)
+{
+	uint32_t ctrl_word;
+	uint32_t dsp_q_addr;
+	uint32_t dsp_addr;
+	uint32_t cmd_id = 0;
+	int cnt = 0;
+	int ret_status = 0;
+	struct adsp_info *info = module->info;
+
 	dsp_q_addr = adsp_get_queue_offset(info, dsp_queue_addr);
 	dsp_q_addr &= ADSP_RTOS_WRITE_CTRL_WORD_DSP_ADDR_M;
 
@@ -528,9 +531,23 @@ int __msm_adsp_write(struct msm_adsp_module *module, unsigned dsp_queue_addr,
 	module->num_commands++;
 
 fail:
-	spin_unlock_irqrestore(&adsp_cmd_lock, flags);
 	return ret_status;
 }
+
+int __msm_adsp_write(struct msm_adsp_module *module, unsigned dsp_queue_addr,
+		   void *cmd_buf, size_t cmd_size)
+{
+	unsigned long flags;
+	int rc;
+
+	spin_lock_irqsave(&adsp_cmd_lock, flags);
+	rc = adsp_write_check(module);
+	if (!rc)
+		rc = adsp_write_locked(module, dsp_queue_addr,
+				       cmd_buf, cmd_size);
+	spin_unlock_irqrestore(&adsp_cmd_lock, flags);
+	return rc;
+}
 EXPORT_SYMBOL(msm_adsp_write);
 
 int msm_adsp_write(struct msm_adsp_module *module, unsigned dsp_queue_addr,
@@ -548,6 +565,49 @@ int msm_adsp_write(struct msm_adsp_module *module, unsigned dsp_queue_addr,
 	return rc;
 }
 
+/* Write @count commands back to back.  adsp_cmd_lock is dropped
+ * between commands, so interrupts stay off for no longer than a single
+ * msm_adsp_write(), and while backing off because the DSP has no free
+ * buffer on a queue.  Returns the number of commands written, or a
+ * negative error if the first one could not be written.
+ */
+int msm_adsp_write_batch(struct msm_adsp_module *module,
+			 struct msm_adsp_cmd *cmds, unsigned count)
+{
+	unsigned long flags;
+	unsigned n = 0;
+	int rc, retries = 0;
+
+	spin_lock_irqsave(&adsp_cmd_lock, flags);
+	rc = adsp_write_check(module);
+	while (!rc && n < count) {
+		rc = adsp_write_locked(module, cmds[n].queue,
+				       cmds[n].data, cmds[n].len);
+		if (rc == -EAGAIN && retries++ < 100) {
+			spin_unlock_irqrestore(&adsp_cmd_lock, flags);
+			udelay(10);
+			spin_lock_irqsave(&adsp_cmd_lock, flags);
+			rc = adsp_write_check(module);
+			continue;
+		}
+		if (rc)
+			break;
+		if (retries > 50)
+			pr_warning("adsp: %s command took %d attempts\n",
+				   module->name, retries);
+		retries = 0;
+		if (++n == count)
+			break;
+		spin_unlock_irqrestore(&adsp_cmd_lock, flags);
+		spin_lock_irqsave(&adsp_cmd_lock, flags);
+		rc = adsp_write_check(module);
+	}
+	spin_unlock_irqrestore(&adsp_cmd_lock, flags);
+
+	return n ? n : rc;
+}
+EXPORT_SYMBOL(msm_adsp_write_batch);
+
 #ifdef CONFIG_MSM_ADSP_REPORT_EVENTS
 static void *modem_event_addr;
 #if CONFIG_MSM_AMSS_VERSION >= 6350
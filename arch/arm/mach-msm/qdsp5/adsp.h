@@ -265,6 +265,11 @@ struct rpc_adsp_rtos_modem_to_app_args_t {
 #define ADSP_STATE_INIT_INFO  4
 #endif
 
+struct adsp_pmem_region;
+
+/* verify_cmd cost is kept per log2(number of pmem regions) */
+#define ADSP_VERIFY_BUCKETS 6
+
 struct msm_adsp_module {
 	struct mutex lock;
 	const char *name;
@@ -288,6 +293,21 @@ struct msm_adsp_module {
 
 	struct mutex pmem_regions_lock;
 	struct hlist_head pmem_regions;
+
+	/* pmem_regions sorted by vaddr and by paddr, see adsp_driver.c */
+	struct adsp_pmem_region **pmem_by_vaddr;
+	struct adsp_pmem_region **pmem_by_paddr;
+	struct adsp_pmem_region *pmem_last_vaddr;
+	struct adsp_pmem_region *pmem_last_paddr;
+	unsigned pmem_count;
+	unsigned pmem_alloc;
+	unsigned pmem_lookups;
+	unsigned pmem_cache_hits;
+
+	unsigned verify_count[ADSP_VERIFY_BUCKETS];
+	u64 verify_ns[ADSP_VERIFY_BUCKETS];
+	unsigned verify_max_ns;
+
 	int (*verify_cmd) (struct msm_adsp_module*, unsigned int, void *,
 			   size_t);
 	int (*patch_event) (struct msm_adsp_module*, struct adsp_event *);
@@ -20,6 +20,10 @@
 #include <linux/platform_device.h>
 #include <linux/sched.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
 
 #include "adsp.h"
 
@@ -107,6 +111,75 @@ static int adsp_pmem_check(struct msm_adsp_module *module,
 	return 0;
 }
 
+/* Besides the pmem_regions list, every module keeps its regions in
+ * two arrays sorted by vaddr and by paddr, so that the address lookups
+ * done by the command verifiers are a binary search.  Regions never
+ * overlap in vaddr (adsp_pmem_check() refuses that), and in paddr they
+ * are either disjoint or the same pmem file registered twice.
+ */
+static int adsp_pmem_index_add(struct msm_adsp_module *module,
+			       struct adsp_pmem_region *region)
+{
+	struct adsp_pmem_region **v, **p;
+	unsigned n = module->pmem_count;
+	unsigned i;
+
+	if (n == module->pmem_alloc) {
+		unsigned alloc = n ? n * 2 : 8;
+
+		v = krealloc(module->pmem_by_vaddr, alloc * sizeof(*v),
+			     GFP_KERNEL);
+		if (!v)
+			return -ENOMEM;
+		module->pmem_by_vaddr = v;
+		p = krealloc(module->pmem_by_paddr, alloc * sizeof(*p),
+			     GFP_KERNEL);
+		if (!p)
+			return -ENOMEM;
+		module->pmem_by_paddr = p;
+		module->pmem_alloc = alloc;
+	}
+
+	v = module->pmem_by_vaddr;
+	for (i = n; i > 0 && v[i - 1]->vaddr > region->vaddr; i--)
+		v[i] = v[i - 1];
+	v[i] = region;
+
+	p = module->pmem_by_paddr;
+	for (i = n; i > 0 && p[i - 1]->paddr > region->paddr; i--)
+		p[i] = p[i - 1];
+	p[i] = region;
+
+	module->pmem_count++;
+	return 0;
+}
+
+static void adsp_pmem_index_reset(struct msm_adsp_module *module)
+{
+	kfree(module->pmem_by_vaddr);
+	kfree(module->pmem_by_paddr);
+	module->pmem_by_vaddr = NULL;
+	module->pmem_by_paddr = NULL;
+	module->pmem_last_vaddr = NULL;
+	module->pmem_last_paddr = NULL;
+	module->pmem_count = 0;
+	module->pmem_alloc = 0;
+}
+
+/* the last region in @tbl whose start is at or below @addr */
+#define ADSP_PMEM_BSEARCH(module, tbl, field, addr) ({		\
+	struct adsp_pmem_region **__t = (module)->tbl;			\
+	unsigned __lo = 0, __hi = (module)->pmem_count, __mid;		\
+	while (__lo < __hi) {						\
+		__mid = (__lo + __hi) / 2;				\
+		if (__t[__mid]->field <= (addr))			\
+			__lo = __mid + 1;				\
+		else							\
+			__hi = __mid;					\
+	}								\
+	__lo ? __t[__lo - 1] : NULL;					\
+})
+
 static int adsp_pmem_add(struct msm_adsp_module *module,
 			 struct adsp_pmem_info *info)
 {
@@ -140,6 +213,12 @@ static int adsp_pmem_add(struct msm_adsp_module *module,
 	region->len = len;
 	region->file = file;
 
+	rc = adsp_pmem_index_add(module, region);
+	if (rc < 0) {
+		put_pmem_file(file);
+		kfree(region);
+		goto end;
+	}
 	hlist_add_head(&region->list, &module->pmem_regions);
 end:
 	mutex_unlock(&module->pmem_regions_lock);
@@ -149,46 +228,32 @@ end:
 static int adsp_pmem_lookup_vaddr(struct msm_adsp_module *module, void **addr,
 		     unsigned long len, struct adsp_pmem_region **region)
 {
-	struct hlist_node *node;
 	void *vaddr = *addr;
 	struct adsp_pmem_region *region_elt;
 
-	int match_count = 0;
-
 	*region = NULL;
+	module->pmem_lookups++;
 
-	/* returns physical address or zero */
-	hlist_for_each_entry(region_elt, node, &module->pmem_regions, list) {
-		if (vaddr >= region_elt->vaddr &&
-		    vaddr < region_elt->vaddr + region_elt->len &&
-		    vaddr + len <= region_elt->vaddr + region_elt->len) {
-			/* offset since we could pass vaddr inside a registerd
-			 * pmem buffer
-			 */
-
-			match_count++;
-			if (!*region)
-				*region = region_elt;
-		}
+	/* commands tend to carry several addresses in the same buffer */
+	region_elt = module->pmem_last_vaddr;
+	if (region_elt && IN_RANGE(region_elt, vaddr)) {
+		module->pmem_cache_hits++;
+	} else {
+		region_elt = ADSP_PMEM_BSEARCH(module, pmem_by_vaddr,
+					       vaddr, vaddr);
+		if (!region_elt || !IN_RANGE(region_elt, vaddr))
+			return -1;
+		module->pmem_last_vaddr = region_elt;
 	}
 
-	if (match_count > 1) {
-		printk(KERN_ERR "adsp: module %s: "
-			"multiple hits for vaddr %p, len %ld\n",
-			module->name, vaddr, len);
-		hlist_for_each_entry(region_elt, node,
-				&module->pmem_regions, list) {
-			if (vaddr >= region_elt->vaddr &&
-			    vaddr < region_elt->vaddr + region_elt->len &&
-			    vaddr + len <= region_elt->vaddr + region_elt->len)
-				printk(KERN_ERR "\t%p, %ld --> %p\n",
-					region_elt->vaddr,
-					region_elt->len,
-					(void *)region_elt->paddr);
-		}
-	}
+	/* offset since we could pass vaddr inside a registerd
+	 * pmem buffer
+	 */
+	if (vaddr + len > region_elt->vaddr + region_elt->len)
+		return -1;
 
-	return *region ? 0 : -1;
+	*region = region_elt;
+	return 0;
 }
 
 int adsp_pmem_fixup_kvaddr(struct msm_adsp_module *module, void **addr,
@@ -244,11 +309,24 @@ static int adsp_verify_cmd(struct msm_adsp_module *module,
 	return 0;
 }
 
+/* Called with pmem_regions_lock held. */
+static void adsp_verify_account(struct msm_adsp_module *module, ktime_t t)
+{
+	unsigned b = min(fls(module->pmem_count), ADSP_VERIFY_BUCKETS - 1);
+	unsigned ns = ktime_to_ns(t);
+
+	module->verify_count[b]++;
+	module->verify_ns[b] += ns;
+	if (ns > module->verify_max_ns)
+		module->verify_max_ns = ns;
+}
+
 static long adsp_write_cmd(struct adsp_device *adev, void __user *arg)
 {
 	struct adsp_command_t cmd;
 	unsigned char buf[256];
 	void *cmd_data;
+	ktime_t start;
 	long rc;
 
 	if (copy_from_user(&cmd, (void __user *)arg, sizeof(cmd)))
@@ -268,7 +346,10 @@ static long adsp_write_cmd(struct adsp_device *adev, void __user *arg)
 	}
 
 	mutex_lock(&adev->module->pmem_regions_lock);
-	if (adsp_verify_cmd(adev->module, cmd.queue, cmd_data, cmd.len)) {
+	start = ktime_get();
+	rc = adsp_verify_cmd(adev->module, cmd.queue, cmd_data, cmd.len);
+	adsp_verify_account(adev->module, ktime_sub(ktime_get(), start));
+	if (rc) {
 		printk(KERN_ERR "module %s: verify failed.\n",
 			adev->module->name);
 		rc = -EINVAL;
@@ -284,6 +365,78 @@ end:
 	return rc;
 }
 
+static long adsp_write_cmds(struct adsp_device *adev, void __user *arg)
+{
+	struct msm_adsp_module *module = adev->module;
+	struct adsp_command_list_t list;
+	struct adsp_command_t cmds[ADSP_MAX_COMMANDS];
+	struct msm_adsp_cmd batch[ADSP_MAX_COMMANDS];
+	unsigned char *cmd_data, *p;
+	size_t total = 0;
+	ktime_t start;
+	unsigned i;
+	long rc;
+
+	if (copy_from_user(&list, arg, sizeof(list)))
+		return -EFAULT;
+	if (!list.count || list.count > ADSP_MAX_COMMANDS)
+		return -EINVAL;
+	if (copy_from_user(cmds, (void __user *)list.cmds,
+			   list.count * sizeof(cmds[0])))
+		return -EFAULT;
+
+	for (i = 0; i < list.count; i++) {
+		if (cmds[i].len > ADSP_MAX_COMMANDS_LEN - total)
+			return -EINVAL;
+		/* keep every command word aligned for the verifiers */
+		total += ALIGN(cmds[i].len, 4);
+	}
+	if (total > ADSP_MAX_COMMANDS_LEN)
+		return -EINVAL;
+
+	cmd_data = kmalloc(total, GFP_USER);
+	if (!cmd_data)
+		return -ENOMEM;
+
+	for (i = 0, p = cmd_data; i < list.count; i++) {
+		if (copy_from_user(p, (void __user *)cmds[i].data,
+				   cmds[i].len)) {
+			rc = -EFAULT;
+			goto free;
+		}
+		batch[i].queue = cmds[i].queue;
+		batch[i].data = p;
+		batch[i].len = cmds[i].len;
+		p += ALIGN(cmds[i].len, 4);
+	}
+
+	mutex_lock(&module->pmem_regions_lock);
+	for (i = 0; i < list.count; i++) {
+		start = ktime_get();
+		rc = adsp_verify_cmd(module, batch[i].queue,
+				     batch[i].data, batch[i].len);
+		adsp_verify_account(module, ktime_sub(ktime_get(), start));
+		if (rc) {
+			printk(KERN_ERR "module %s: verify of command %d "
+			       "failed.\n", module->name, i);
+			rc = -EINVAL;
+			goto unlock;
+		}
+	}
+	rc = msm_adsp_write_batch(module, batch, list.count);
+unlock:
+	mutex_unlock(&module->pmem_regions_lock);
+
+	list.written = rc > 0 ? rc : 0;
+	if (copy_to_user(arg, &list, sizeof(list)) && rc >= 0)
+		rc = -EFAULT;
+	else if (rc > 0)
+		rc = rc == list.count ? 0 : -EIO;
+free:
+	kfree(cmd_data);
+	return rc;
+}
+
 static int adsp_events_pending(struct adsp_device *adev)
 {
 	unsigned long flags;
@@ -297,16 +450,24 @@ static int adsp_events_pending(struct adsp_device *adev)
 static int adsp_pmem_lookup_paddr(struct msm_adsp_module *module, void **addr,
 		     struct adsp_pmem_region **region)
 {
-	struct hlist_node *node;
 	unsigned long paddr = (unsigned long)(*addr);
 	struct adsp_pmem_region *region_elt;
 
-	hlist_for_each_entry(region_elt, node, &module->pmem_regions, list) {
-		if (paddr >= region_elt->paddr &&
-		    paddr < region_elt->paddr + region_elt->len) {
-			*region = region_elt;
-			return 0;
-		}
+	module->pmem_lookups++;
+
+	region_elt = module->pmem_last_paddr;
+	if (region_elt && paddr >= region_elt->paddr &&
+	    paddr < region_elt->paddr + region_elt->len) {
+		module->pmem_cache_hits++;
+		*region = region_elt;
+		return 0;
+	}
+
+	region_elt = ADSP_PMEM_BSEARCH(module, pmem_by_paddr, paddr, paddr);
+	if (region_elt && paddr < region_elt->paddr + region_elt->len) {
+		module->pmem_last_paddr = region_elt;
+		*region = region_elt;
+		return 0;
 	}
 	return -1;
 }
@@ -379,8 +540,11 @@ static long adsp_get_event(struct adsp_device *adev, void __user *arg)
 		return -EAGAIN;
 
 	/* DSP messages are type 0; they may contain physical addresses */
-	if (data->type == 0)
+	if (data->type == 0) {
+		mutex_lock(&adev->module->pmem_regions_lock);
 		adsp_patch_event(adev->module, data);
+		mutex_unlock(&adev->module->pmem_regions_lock);
+	}
 
 	/* map adsp_event --> adsp_event_t */
 	if (evt.len < data->size) {
@@ -433,6 +597,9 @@ static long adsp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	case ADSP_IOCTL_WRITE_COMMAND:
 		return adsp_write_cmd(adev, (void __user *) arg);
 
+	case ADSP_IOCTL_WRITE_COMMANDS:
+		return adsp_write_cmds(adev, (void __user *) arg);
+
 	case ADSP_IOCTL_GET_EVENT:
 		return adsp_get_event(adev, (void __user *) arg);
 
@@ -482,6 +649,7 @@ static int adsp_release(struct inode *inode, struct file *filp)
 		put_pmem_file(region->file);
 		kfree(region);
 	}
+	adsp_pmem_index_reset(module);
 	mutex_unlock(&module->pmem_regions_lock);
 	BUG_ON(!hlist_empty(&module->pmem_regions));
 
@@ -609,6 +777,62 @@ static void adsp_create(struct adsp_device *adev, const char *name,
 	}
 }
 
+#if defined(CONFIG_DEBUG_FS)
+static struct msm_adsp_module *adsp_stats_modules;
+static unsigned adsp_stats_count;
+
+static int adsp_verify_stats_show(struct seq_file *m, void *unused)
+{
+	static const char *bucket_name[ADSP_VERIFY_BUCKETS] = {
+		"0", "1", "2-3", "4-7", "8-15", "16+"
+	};
+	struct msm_adsp_module *module;
+	unsigned i, b;
+
+	for (i = 0; i < adsp_stats_count; i++) {
+		module = adsp_stats_modules + i;
+		if (!module->pmem_lookups && !module->verify_max_ns)
+			continue;
+		seq_printf(m, "%s: regions %u lookups %u cache_hits %u "
+			   "max_ns %u\n", module->name, module->pmem_count,
+			   module->pmem_lookups, module->pmem_cache_hits,
+			   module->verify_max_ns);
+		for (b = 0; b < ADSP_VERIFY_BUCKETS; b++) {
+			if (!module->verify_count[b])
+				continue;
+			seq_printf(m, "  regions %-4s cmds %8u avg_ns %8llu\n",
+				   bucket_name[b], module->verify_count[b],
+				   div_u64(module->verify_ns[b],
+					   module->verify_count[b]));
+		}
+	}
+	return 0;
+}
+
+static int adsp_verify_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, adsp_verify_stats_show, NULL);
+}
+
+static const struct file_operations adsp_verify_stats_fops = {
+	.open = adsp_verify_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void adsp_debugfs_init(struct msm_adsp_module *modules, unsigned n)
+{
+	adsp_stats_modules = modules;
+	adsp_stats_count = n;
+	debugfs_create_file("adsp_verify", 0444, NULL, NULL,
+			    &adsp_verify_stats_fops);
+}
+#else
+static inline void adsp_debugfs_init(struct msm_adsp_module *modules,
+				     unsigned n) {}
+#endif
+
 void msm_adsp_publish_cdevs(struct msm_adsp_module *modules, unsigned n)
 {
 	int rc;
@@ -632,6 +856,7 @@ void msm_adsp_publish_cdevs(struct msm_adsp_module *modules, unsigned n)
 			    MKDEV(MAJOR(adsp_devno), n));
 	}
 
+	adsp_debugfs_init(modules, adsp_device_count);
 	return;
 
 fail_alloc_region:
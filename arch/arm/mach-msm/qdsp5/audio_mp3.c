@@ -23,6 +23,9 @@
 #include <linux/kthread.h>
 #include <linux/wait.h>
 #include <linux/dma-mapping.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
 
 #include <linux/delay.h>
 
@@ -55,6 +58,9 @@ printk(KERN_DEBUG format, ## arg)
 #define DMASZ_MAX (BUFSZ_MAX * 2)
 #define DMASZ_MIN (BUFSZ_MIN * 2)
 
+/* The input DMA area is split into 2..OUT_MAX_COUNT buffers */
+#define OUT_MAX_COUNT 8
+
 #define AUDPLAY_INVALID_READ_PTR_OFFSET	0xFFFF
 #define AUDDEC_DEC_MP3 2
 
@@ -77,15 +83,23 @@ struct buffer {
 };
 
 struct audio {
-	struct buffer out[2];
+	struct buffer out[OUT_MAX_COUNT];
 
 	spinlock_t dsp_lock;
 
 	uint8_t out_head;
 	uint8_t out_tail;
 	uint8_t out_needed; /* number of buffers the dsp is waiting for */
+	uint8_t out_count; /* number of input buffers in use */
+	uint8_t out_inflight; /* buffers handed to the dsp at out_tail */
 	unsigned out_dma_sz;
 
+	/* statistics */
+	unsigned dsp_requests; /* DEC_NEEDS_DATA events */
+	unsigned batches; /* DATA_AVAIL commands sent */
+	unsigned buffers_sent;
+	unsigned write_wakeups; /* times a writer slept for a buffer */
+
 	atomic_t out_bytes;
 
 	struct mutex lock;
@@ -153,6 +167,7 @@ static int audio_enable(struct audio *audio)
 		return 0;
 
 	audio->out_tail = 0;
+	audio->out_inflight = 0;
 	audio->out_needed = 0;
 
 	cfg.tx_rate = RPC_AUD_DEF_SAMPLE_RATE_NONE;
@@ -213,7 +228,7 @@ static void audio_update_pcm_buf_entry(struct audio *audio, uint32_t *payload)
 	for (index = 0; index < payload[1]; index++) {
 		if (audio->in[audio->fill_next].addr ==
 		    payload[2 + index * 2]) {
-			pr_info("audio_update_pcm_buf_entry: in[%d] ready\n",
+			dprintk("audio_update_pcm_buf_entry: in[%d] ready\n",
 				audio->fill_next);
 			audio->in[audio->fill_next].used =
 			  payload[3 + index * 2];
@@ -411,7 +426,7 @@ static void audplay_buffer_refresh(struct audio *audio)
 	refresh_cmd.buf0_length = audio->in[audio->fill_next].size -
 	  (audio->in[audio->fill_next].size % 576);	/* Mp3 frame size */
 	refresh_cmd.buf_read_count = 0;
-	pr_info("audplay_buffer_fresh: buf0_addr=%x buf0_len=%d\n",
+	dprintk("audplay_buffer_fresh: buf0_addr=%x buf0_len=%d\n",
 		refresh_cmd.buf0_address, refresh_cmd.buf0_length);
 	(void)audplay_send_queue0(audio, &refresh_cmd, sizeof(refresh_cmd));
 }
@@ -448,36 +463,50 @@ static void audplay_send_data(struct audio *audio, unsigned needed)
 	if (needed && !audio->wflush) {
 		/* We were called from the callback because the DSP
 		 * requested more data.  Note that the DSP does want
-		 * more data, and if a buffer was in-flight, mark it
+		 * more data, and if buffers were in-flight, mark them
 		 * as available (since the DSP must now be done with
-		 * it).
+		 * them).
 		 */
 		audio->out_needed = 1;
-		frame = audio->out + audio->out_tail;
-		if (frame->used == 0xffffffff) {
-		  dprintk("frame %d free\n", audio->out_tail);
-		  frame->used = 0;
-		  audio->out_tail ^= 1;
-		  wake_up(&audio->write_wait);
+		audio->dsp_requests++;
+		if (audio->out_inflight) {
+			dprintk("frames %d+%d free\n", audio->out_tail,
+				audio->out_inflight);
+			for (; audio->out_inflight; audio->out_inflight--) {
+				audio->out[audio->out_tail].used = 0;
+				if (++audio->out_tail == audio->out_count)
+					audio->out_tail = 0;
+			}
+			wake_up(&audio->write_wait);
 		}
 	}
 
 	if (audio->out_needed) {
-		/* If the DSP currently wants data and we have a
-		 * buffer available, we will send it and reset
-		 * the needed flag.  We'll mark the buffer as in-flight
-		 * so that it won't be recycled until the next buffer
-		 * is requested
+		/* If the DSP currently wants data and we have buffers
+		 * available, send them and reset the needed flag.  The
+		 * buffers are adjacent in memory, so every full buffer
+		 * from out_tail up to the end of the ring, plus a partial
+		 * one after them, is handed over in one DATA_AVAIL.  They
+		 * stay in-flight until the DSP asks for more.
 		 */
-			
-		frame = audio->out + audio->out_tail;
-		if (frame->used) {
-		  BUG_ON(frame->used == 0xffffffff);
-		  dprintk("frame %d busy\n", audio->out_tail);
-		  audplay_dsp_send_data_avail(audio, audio->out_tail,
-					      frame->used);
-		  frame->used = 0xffffffff;
-		  audio->out_needed = 0;
+		unsigned idx = audio->out_tail;
+		unsigned len = 0;
+
+		while (idx < audio->out_count && audio->out[idx].used) {
+			frame = audio->out + idx++;
+			len += frame->used;
+			if (frame->used != frame->size)
+				break;
+		}
+		if (len) {
+			dprintk("frames %d-%d busy\n",
+				audio->out_tail, idx - 1);
+			audplay_dsp_send_data_avail(audio, audio->out_tail,
+						    len);
+			audio->out_inflight = idx - audio->out_tail;
+			audio->out_needed = 0;
+			audio->batches++;
+			audio->buffers_sent += audio->out_inflight;
 		}
 	}
 done:
@@ -488,10 +517,13 @@ done:
 
 static void audio_flush(struct audio *audio)
 {
-	audio->out[0].used = 0;
-	audio->out[1].used = 0;
+	uint8_t index;
+
+	for (index = 0; index < audio->out_count; index++)
+		audio->out[index].used = 0;
 	audio->out_head = 0;
 	audio->out_tail = 0;
+	audio->out_inflight = 0;
 	audio->reserved = 0;
 	atomic_set(&audio->out_bytes, 0);
 }
@@ -507,6 +539,23 @@ static void audio_flush_pcm_buf(struct audio *audio)
 	audio->fill_next = 0;
 }
 
+/* Split the input DMA area into @count adjacent buffers.  Must be
+ * called with write_lock held and the decoder disabled.
+ */
+static void audio_setup_out(struct audio *audio, unsigned count)
+{
+	unsigned size = (audio->out_dma_sz / count) & ~3;
+	uint8_t index;
+
+	for (index = 0; index < count; index++) {
+		audio->out[index].data = audio->data + index * size;
+		audio->out[index].addr = audio->phys + index * size;
+		audio->out[index].size = size;
+	}
+	audio->out_count = count;
+	audio_flush(audio);
+}
+
 static void audio_ioport_reset(struct audio *audio)
 {
 	/* Make sure read/write thread are free from
@@ -586,6 +635,21 @@ static long audio_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			rc = -EINVAL;
 			break;
 		}
+		if (config.buffer_count &&
+		    config.buffer_count != audio->out_count) {
+			if (config.buffer_count < 2 ||
+			    config.buffer_count > OUT_MAX_COUNT) {
+				rc = -EINVAL;
+				break;
+			}
+			if (audio->enabled) {
+				rc = -EBUSY;
+				break;
+			}
+			mutex_lock(&audio->write_lock);
+			audio_setup_out(audio, config.buffer_count);
+			mutex_unlock(&audio->write_lock);
+		}
 		audio->out_sample_rate = config.sample_rate;
 		audio->out_channel_mode = config.channel_count;
 		rc = 0;
@@ -593,8 +657,8 @@ static long audio_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	}
 	case AUDIO_GET_CONFIG: {
 		struct msm_audio_config config;
-		config.buffer_size = (audio->out_dma_sz >> 1);
-		config.buffer_count = 2;
+		config.buffer_size = audio->out[0].size;
+		config.buffer_count = audio->out_count;
 		config.sample_rate = audio->out_sample_rate;
 		if (audio->out_channel_mode == AUDPP_CMD_PCM_INTF_MONO_V) {
 			config.channel_count = 1;
@@ -703,7 +767,7 @@ static ssize_t audio_read(struct file *file, char __user *buf, size_t count,
 		return 0; /* PCM feedback disabled. Nothing to read */
 
 	mutex_lock(&audio->read_lock);
-	pr_info("audio_read() %d \n", count);
+	dprintk("audio_read() %d \n", count);
 	while (count > 0) {
 		rc = wait_event_interruptible(audio->read_wait,
 					      (audio->in[audio->read_next].
@@ -727,7 +791,7 @@ static ssize_t audio_read(struct file *file, char __user *buf, size_t count,
 			pr_info("audio_read: no partial frame done reading\n");
 			break;
 		} else {
-			pr_info("audio_read: read from in[%d]\n",
+			dprintk("audio_read: read from in[%d]\n",
 				audio->read_next);
 			if (copy_to_user
 			    (buf, audio->in[audio->read_next].data,
@@ -765,7 +829,7 @@ static ssize_t audio_read(struct file *file, char __user *buf, size_t count,
 	if (buf > start)
 		rc = buf - start;
 
-	pr_info("audio_read: read %d bytes\n", rc);
+	dprintk("audio_read: read %d bytes\n", rc);
 	return rc;
 }
 
@@ -785,6 +849,8 @@ static ssize_t audio_write(struct file *file, const char __user *buf,
 		frame = audio->out + audio->out_head;
 		cpy_ptr = frame->data;
 		dsize = 0;
+		if (frame->used)
+			audio->write_wakeups++;
 		rc = wait_event_interruptible(audio->write_wait,
 					      (frame->used == 0)
 					      || (audio->stopped)
@@ -825,7 +891,8 @@ static ssize_t audio_write(struct file *file, const char __user *buf,
 		buf += xfer;
 
 		if (dsize > 0) {
-			audio->out_head ^= 1;
+			if (++audio->out_head == audio->out_count)
+				audio->out_head = 0;
 			frame->used = dsize;
 			audplay_send_data(audio, 0);
 		}
@@ -914,23 +981,19 @@ static int audio_open(struct inode *inode, struct file *file)
 	}
 
 	audio->out_dma_sz = pmem_sz;
-	pmem_sz >>= 1; /* Shift by 1 to get size of ping pong buffer */
 
 	audio->out_sample_rate = 44100;
 	audio->out_channel_mode = AUDPP_CMD_PCM_INTF_STEREO_V;
 	audio->dec_id = 0;
 
-	audio->out[0].data = audio->data + 0;
-	audio->out[0].addr = audio->phys + 0;
-	audio->out[0].size = pmem_sz;
-
-	audio->out[1].data = audio->data + pmem_sz;
-	audio->out[1].addr = audio->phys + pmem_sz;
-	audio->out[1].size = pmem_sz;
+	audio_setup_out(audio, 2);
 
 	audio->volume = 0x2000;	/* equal to Q13 number 1.0 Unit Gain */
 
-	audio_flush(audio);
+	audio->dsp_requests = 0;
+	audio->batches = 0;
+	audio->buffers_sent = 0;
+	audio->write_wakeups = 0;
 
 	file->private_data = audio;
 	audio->opened = 1;
@@ -955,6 +1018,46 @@ struct miscdevice audio_mp3_misc = {
 	.fops	= &audio_mp3_fops,
 };
 
+#if defined(CONFIG_DEBUG_FS)
+static int audio_stats_show(struct seq_file *m, void *unused)
+{
+	struct audio *audio = &the_mp3_audio;
+	unsigned samples = 0;
+	u64 scale = 0;
+
+	/* events per minute of decoded audio */
+	if (audio->running)
+		samples = audpp_avsync_sample_count(audio->dec_id);
+	if (samples)
+		scale = 60ULL * audio->out_sample_rate;
+
+	seq_printf(m, "buffers:       %u x %u bytes\n",
+		   audio->out_count, audio->out[0].size);
+	seq_printf(m, "dsp_requests:  %u\n", audio->dsp_requests);
+	seq_printf(m, "batches:       %u\n", audio->batches);
+	seq_printf(m, "buffers_sent:  %u\n", audio->buffers_sent);
+	seq_printf(m, "write_wakeups: %u\n", audio->write_wakeups);
+	if (scale)
+		seq_printf(m, "per minute:    %llu dsp_requests, "
+			   "%llu write_wakeups\n",
+			   div64_u64(scale * audio->dsp_requests, samples),
+			   div64_u64(scale * audio->write_wakeups, samples));
+	return 0;
+}
+
+static int audio_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, audio_stats_show, NULL);
+}
+
+static const struct file_operations audio_stats_fops = {
+	.open = audio_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+#endif
+
 static int __init audio_init(void)
 {
 	mutex_init(&the_mp3_audio.lock);
@@ -964,6 +1067,9 @@ static int __init audio_init(void)
 	init_waitqueue_head(&the_mp3_audio.write_wait);
 	init_waitqueue_head(&the_mp3_audio.read_wait);
 	the_mp3_audio.read_data = NULL;
+#if defined(CONFIG_DEBUG_FS)
+	debugfs_create_file("msm_mp3", 0444, NULL, NULL, &audio_stats_fops);
+#endif
 	return misc_register(&audio_mp3_misc);
 }
 
@@ -26,6 +26,11 @@
 #include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/wakelock.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #include <linux/msm_audio.h>
 
@@ -94,6 +99,12 @@ module_init(_pcm_log_init);
 #define BUFSZ (960 * 5)
 #define DMASZ (BUFSZ * 2)
 
+/* The host pcm interface has exactly two DSP buffers, so only the
+ * period size can be tuned.  MIN_BUFSZ is 2ms of 48kHz stereo.
+ */
+#define MIN_BUFSZ 384
+#define BUFSZ_ALIGN 32
+
 #define AUDPP_CMD_CFG_OBJ_UPDATE 0x8000
 #define AUDPP_CMD_EQ_FLAG_DIS	0x0000
 #define AUDPP_CMD_EQ_FLAG_ENA	-1
@@ -148,6 +159,7 @@ struct buffer {
 	unsigned size;
 	unsigned used;
 	unsigned addr;
+	ktime_t queued;
 };
 
 struct audio {
@@ -194,6 +206,13 @@ struct audio {
 
 	int rx_iir_enable;
 	struct rx_iir_filter iir;
+
+	/* statistics, protected by dsp_lock */
+	unsigned underruns;
+	unsigned dma_missed;
+	unsigned periods;
+	unsigned latency_max_us;
+	u64 latency_total_us;
 };
 
 static void audio_prevent_sleep(struct audio *audio)
@@ -307,6 +326,15 @@ static void audio_dsp_event(void *private, unsigned id, uint16_t *msg)
 
 		spin_lock_irqsave(&audio->dsp_lock, flags);
 		if (audio->running) {
+			unsigned us = ktime_to_us(ktime_sub(ktime_get(),
+						audio->out[idx].queued));
+
+			/* from handing the period to the kernel to playback */
+			audio->periods++;
+			audio->latency_total_us += us;
+			if (us > audio->latency_max_us)
+				audio->latency_max_us = us;
+
 			atomic_add(audio->out[idx].used, &audio->out_bytes);
 			audio->out[idx].used = 0;
 
@@ -317,6 +345,8 @@ static void audio_dsp_event(void *private, unsigned id, uint16_t *msg)
 				audio->out_tail ^= 1;
 			} else {
 				audio->out_needed++;
+				if (!audio->stopped)
+					audio->underruns++;
 			}
 			wake_up(&audio->wait);
 		}
@@ -325,6 +355,7 @@ static void audio_dsp_event(void *private, unsigned id, uint16_t *msg)
 	}
 	case AUDPP_MSG_PCMDMAMISSED:
 		pr_info("audio_dsp_event: PCMDMAMISSED %d\n", msg[0]);
+		audio->dma_missed++;
 		break;
 	case AUDPP_MSG_CFG_MSG:
 		if (msg[0] == AUDPP_MSG_ENA_ENA) {
@@ -489,6 +520,69 @@ static int audio_enable_rx_iir(struct audio *audio, int enable)
 	return 0;
 }
 
+/* Lay the two periods out back to back so that the mmap()ed buffer
+ * reads as a ring.  Must be called with audio->lock held and the dsp
+ * disabled.
+ */
+static int audio_set_period(struct audio *audio, unsigned size)
+{
+	if (size < MIN_BUFSZ || size > BUFSZ || (size & (BUFSZ_ALIGN - 1)))
+		return -EINVAL;
+
+	audio->out_buffer_size = size;
+
+	audio->out[0].data = audio->data + 0;
+	audio->out[0].addr = audio->phys + 0;
+	audio->out[0].size = size;
+
+	audio->out[1].data = audio->data + size;
+	audio->out[1].addr = audio->phys + size;
+	audio->out[1].size = size;
+	return 0;
+}
+
+/* Queue the head buffer, filled with @len bytes, and send it right
+ * away if the dsp is waiting.  Must be called with write_lock held.
+ */
+static void audio_commit_frame(struct audio *audio, unsigned len)
+{
+	struct buffer *frame = audio->out + audio->out_head;
+	unsigned long flags;
+
+	frame->queued = ktime_get();
+	frame->used = len;
+	audio->out_head ^= 1;
+
+	spin_lock_irqsave(&audio->dsp_lock, flags);
+	LOG(EV_FILL_BUFFER, audio->out_head ^ 1);
+	frame = audio->out + audio->out_tail;
+	if (frame->used && audio->out_needed) {
+		audio_dsp_send_buffer(audio, audio->out_tail, frame->used);
+		audio->out_tail ^= 1;
+		audio->out_needed--;
+	}
+	spin_unlock_irqrestore(&audio->dsp_lock, flags);
+}
+
+static int audio_mmap_ack(struct audio *audio, unsigned len)
+{
+	struct buffer *frame;
+	int rc = 0;
+
+	mutex_lock(&audio->write_lock);
+	frame = audio->out + audio->out_head;
+	if (audio->stopped)
+		rc = -EBUSY;
+	else if (frame->used)
+		rc = -EAGAIN;
+	else if (!len || len > frame->size)
+		rc = -EINVAL;
+	else
+		audio_commit_frame(audio, len);
+	mutex_unlock(&audio->write_lock);
+	return rc;
+}
+
 static void audio_flush(struct audio *audio)
 {
 	audio->out[0].used = 0;
@@ -510,6 +604,18 @@ static long audio_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			return -EFAULT;
 		return 0;
 	}
+	if (cmd == AUDIO_GET_MMAP_POS) {
+		struct msm_audio_mmap_pos pos;
+		pos.period = audio->out_head;
+		pos.avail = !audio->out[audio->out_head].used;
+		pos.hw_bytes = atomic_read(&audio->out_bytes);
+		pos.underruns = audio->underruns;
+		if (copy_to_user((void *) arg, &pos, sizeof(pos)))
+			return -EFAULT;
+		return 0;
+	}
+	if (cmd == AUDIO_MMAP_ACK)
+		return audio_mmap_ack(audio, arg);
 	if (cmd == AUDIO_SET_VOLUME) {
 		unsigned long flags;
 		spin_lock_irqsave(&audio->dsp_lock, flags);
@@ -541,6 +647,8 @@ static long audio_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			audio_flush(audio);
 			mutex_unlock(&audio->write_lock);
 		}
+		rc = 0;
+		break;
 	case AUDIO_SET_CONFIG: {
 		struct msm_audio_config config;
 		if (copy_from_user(&config, (void*) arg, sizeof(config))) {
@@ -555,6 +663,23 @@ static long audio_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			rc = -EINVAL;
 			break;
 		}
+		if (config.buffer_count && config.buffer_count != 2) {
+			rc = -EINVAL;
+			break;
+		}
+		if (config.buffer_size &&
+		    config.buffer_size != audio->out_buffer_size) {
+			if (audio->enabled) {
+				rc = -EBUSY;
+				break;
+			}
+			mutex_lock(&audio->write_lock);
+			rc = audio_set_period(audio, config.buffer_size);
+			audio_flush(audio);
+			mutex_unlock(&audio->write_lock);
+			if (rc)
+				break;
+		}
 		audio->out_sample_rate = config.sample_rate;
 		audio->out_channel_mode = config.channel_count;
 		rc = 0;
@@ -562,7 +687,7 @@ static long audio_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	}
 	case AUDIO_GET_CONFIG: {
 		struct msm_audio_config config;
-		config.buffer_size = BUFSZ;
+		config.buffer_size = audio->out_buffer_size;
 		config.buffer_count = 2;
 		config.sample_rate = audio->out_sample_rate;
 		if (audio->out_channel_mode == AUDPP_CMD_PCM_INTF_MONO_V) {
@@ -609,7 +734,6 @@ static ssize_t audio_write(struct file *file, const char __user *buf,
 {
 	struct sched_param s = { .sched_priority = 1 };
 	struct audio *audio = file->private_data;
-	unsigned long flags;
 	const char __user *start = buf;
 	struct buffer *frame;
 	size_t xfer;
@@ -648,20 +772,10 @@ static ssize_t audio_write(struct file *file, const char __user *buf,
 			rc = -EFAULT;
 			break;
 		}
-		frame->used = xfer;
-		audio->out_head ^= 1;
 		count -= xfer;
 		buf += xfer;
 
-		spin_lock_irqsave(&audio->dsp_lock, flags);
-		LOG(EV_FILL_BUFFER, audio->out_head ^ 1);
-		frame = audio->out + audio->out_tail;
-		if (frame->used && audio->out_needed) {
-			audio_dsp_send_buffer(audio, audio->out_tail, frame->used);
-			audio->out_tail ^= 1;
-			audio->out_needed--;
-		}
-		spin_unlock_irqrestore(&audio->dsp_lock, flags);
+		audio_commit_frame(audio, xfer);
 	}
 
 	mutex_unlock(&audio->write_lock);
@@ -684,6 +798,28 @@ static ssize_t audio_write(struct file *file, const char __user *buf,
 	return rc;	
 }
 
+static unsigned int audio_poll(struct file *file,
+			       struct poll_table_struct *wait)
+{
+	struct audio *audio = file->private_data;
+
+	poll_wait(file, &audio->wait, wait);
+	if (audio->stopped || !audio->out[audio->out_head].used)
+		return POLLOUT | POLLWRNORM;
+	return 0;
+}
+
+static int audio_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct audio *audio = file->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (vma->vm_pgoff || size > PAGE_ALIGN(DMASZ))
+		return -EINVAL;
+
+	return dma_mmap_coherent(NULL, vma, audio->data, audio->phys, size);
+}
+
 static int audio_release(struct inode *inode, struct file *file)
 {
 	struct audio *audio = file->private_data;
@@ -727,18 +863,17 @@ static int audio_open(struct inode *inode, struct file *file)
 	if (rc)
 		goto done;
 
-	audio->out_buffer_size = BUFSZ;
 	audio->out_sample_rate = 44100;
 	audio->out_channel_mode = AUDPP_CMD_PCM_INTF_STEREO_V;
 	audio->out_weight = 100;
 
-	audio->out[0].data = audio->data + 0;
-	audio->out[0].addr = audio->phys + 0;
-	audio->out[0].size = BUFSZ;
-	
-	audio->out[1].data = audio->data + BUFSZ;
-	audio->out[1].addr = audio->phys + BUFSZ;
-	audio->out[1].size = BUFSZ;
+	audio_set_period(audio, BUFSZ);
+
+	audio->underruns = 0;
+	audio->dma_missed = 0;
+	audio->periods = 0;
+	audio->latency_max_us = 0;
+	audio->latency_total_us = 0;
 
 	audio->volume = 0x2000;
 
@@ -816,6 +951,8 @@ static struct file_operations audio_fops = {
 	.read		= audio_read,
 	.write		= audio_write,
 	.unlocked_ioctl	= audio_ioctl,
+	.poll		= audio_poll,
+	.mmap		= audio_mmap,
 };
 
 static struct file_operations audpp_fops = {
@@ -836,6 +973,38 @@ struct miscdevice audpp_misc = {
 	.fops	= &audpp_fops,
 };
 
+#if defined(CONFIG_DEBUG_FS)
+static int audio_stats_show(struct seq_file *m, void *unused)
+{
+	struct audio *audio = &the_audio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&audio->dsp_lock, flags);
+	seq_printf(m, "period_bytes:   %u\n", audio->out_buffer_size);
+	seq_printf(m, "periods:        %u\n", audio->periods);
+	seq_printf(m, "underruns:      %u\n", audio->underruns);
+	seq_printf(m, "dma_missed:     %u\n", audio->dma_missed);
+	seq_printf(m, "latency_avg_us: %u\n", audio->periods ?
+		   (unsigned)div_u64(audio->latency_total_us,
+				     audio->periods) : 0);
+	seq_printf(m, "latency_max_us: %u\n", audio->latency_max_us);
+	spin_unlock_irqrestore(&audio->dsp_lock, flags);
+	return 0;
+}
+
+static int audio_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, audio_stats_show, NULL);
+}
+
+static const struct file_operations audio_stats_fops = {
+	.open = audio_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+#endif
+
 static int __init audio_init(void)
 {
 	mutex_init(&the_audio.lock);
@@ -844,6 +1013,10 @@ static int __init audio_init(void)
 	init_waitqueue_head(&the_audio.wait);
 	wake_lock_init(&the_audio.wakelock, WAKE_LOCK_SUSPEND, "audio_pcm");
 	wake_lock_init(&the_audio.idlelock, WAKE_LOCK_IDLE, "audio_pcm_idle");
+#if defined(CONFIG_DEBUG_FS)
+	debugfs_create_file("msm_pcm_out", 0444, NULL, NULL,
+			    &audio_stats_fops);
+#endif
 	return (misc_register(&audio_misc) || misc_register(&audpp_misc));
 }
 
@@ -69,6 +69,11 @@
 #include <linux/debugfs.h>
 #include <linux/io.h>
 #include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #include <mach/msm_iomap.h>
 #include <mach/smem_log.h>
@@ -951,6 +956,8 @@ static inline unsigned int read_timestamp(void)
 	return tick;
 }
 
+static void smem_log_flush_all(void);
+
 static void smem_log_event_from_user(struct smem_log_inst *inst,
 				     const char __user *buf, int size, int num)
 {
@@ -962,6 +969,9 @@ static void smem_log_event_from_user(struct smem_log_inst *inst,
 	int first = 1;
 	int ret;
 
+	if (inst->which_log == GEN)
+		smem_log_flush_all();
+
 	remote_spin_lock_irqsave(inst->remote_spinlock, flags);
 
 	while (num--) {
@@ -1083,6 +1093,161 @@ static void _smem_log_event6(
 	remote_spin_unlock_irqrestore(lock, flags);
 }
 
+#if defined(CONFIG_MSM_SMEM_LOG_STAGING)
+/*
+ * Events for the general log are staged in a small per-cpu buffer and
+ * copied to shared memory in batches, so the remote spinlock is taken
+ * once per batch instead of once per event.  Each record keeps the
+ * timetick read when the event was logged.  A batch is flushed when the
+ * buffer fills, shortly after its first event, and before any reader
+ * looks at the shared log.
+ */
+#define SMEM_LOG_STAGE_RECORDS 16
+#define SMEM_LOG_STAGE_DELAY (HZ / 10)
+
+struct smem_log_stage_rec {
+	struct smem_log_item item[2];
+	int count;
+};
+
+struct smem_log_stage {
+	struct smem_log_stage_rec rec[SMEM_LOG_STAGE_RECORDS];
+	int num;
+
+	unsigned long staged;
+	unsigned long flushes;
+	unsigned long flushed;
+};
+
+static DEFINE_PER_CPU(struct smem_log_stage, smem_log_stage);
+
+static void smem_log_flush_work_func(struct work_struct *work);
+static DECLARE_DELAYED_WORK(smem_log_flush_work, smem_log_flush_work_func);
+
+/* must be called with interrupts disabled on the owning cpu */
+static void _smem_log_flush_stage(struct smem_log_stage *stage)
+{
+	struct smem_log_inst *log = &inst[GEN];
+	struct smem_log_stage_rec *rec;
+	uint32_t idx;
+	uint32_t next_idx;
+	int n;
+
+	if (!stage->num)
+		return;
+
+	if (!log->events || !log->idx) {
+		stage->num = 0;
+		return;
+	}
+
+	remote_spin_lock(log->remote_spinlock);
+
+	idx = *log->idx;
+	for (n = 0; n < stage->num; n++) {
+		rec = &stage->rec[n];
+
+		if (idx + rec->count <= log->num)
+			memcpy(&log->events[idx], rec->item,
+			       rec->count * sizeof(struct smem_log_item));
+
+		next_idx = idx + rec->count;
+		if (next_idx >= log->num)
+			next_idx = 0;
+		idx = next_idx;
+	}
+	*log->idx = idx;
+
+	remote_spin_unlock(log->remote_spinlock);
+
+	stage->flushes++;
+	stage->flushed += stage->num;
+	stage->num = 0;
+}
+
+static void smem_log_flush_local(void *unused)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	_smem_log_flush_stage(&__get_cpu_var(smem_log_stage));
+	local_irq_restore(flags);
+}
+
+static void smem_log_flush_work_func(struct work_struct *work)
+{
+	on_each_cpu(smem_log_flush_local, NULL, 1);
+}
+
+/* must be called from process context */
+static void smem_log_flush_all(void)
+{
+	on_each_cpu(smem_log_flush_local, NULL, 1);
+}
+
+static void smem_log_stage_event(struct smem_log_item *item, int count)
+{
+	struct smem_log_stage *stage;
+	struct smem_log_stage_rec *rec;
+	unsigned long flags;
+	int first;
+
+	local_irq_save(flags);
+
+	stage = &__get_cpu_var(smem_log_stage);
+
+	rec = &stage->rec[stage->num++];
+	memcpy(rec->item, item, count * sizeof(struct smem_log_item));
+	rec->count = count;
+	stage->staged++;
+
+	first = (stage->num == 1);
+	if (stage->num == SMEM_LOG_STAGE_RECORDS)
+		_smem_log_flush_stage(stage);
+
+	local_irq_restore(flags);
+
+	if (first)
+		schedule_delayed_work(&smem_log_flush_work,
+				      SMEM_LOG_STAGE_DELAY);
+}
+
+void smem_log_event(uint32_t id, uint32_t data1, uint32_t data2,
+		    uint32_t data3)
+{
+	struct smem_log_item item;
+
+	item.timetick = read_timestamp();
+	item.identifier = id;
+	item.data1 = data1;
+	item.data2 = data2;
+	item.data3 = data3;
+
+	smem_log_stage_event(&item, 1);
+}
+
+void smem_log_event6(uint32_t id, uint32_t data1, uint32_t data2,
+		     uint32_t data3, uint32_t data4, uint32_t data5,
+		     uint32_t data6)
+{
+	struct smem_log_item item[2];
+
+	item[0].timetick = read_timestamp();
+	item[0].identifier = id;
+	item[0].data1 = data1;
+	item[0].data2 = data2;
+	item[0].data3 = data3;
+	item[1].identifier = item[0].identifier;
+	item[1].timetick = item[0].timetick;
+	item[1].data1 = data4;
+	item[1].data2 = data5;
+	item[1].data3 = data6;
+
+	smem_log_stage_event(item, 2);
+}
+#else
+static inline void smem_log_flush_all(void) {}
+
 void smem_log_event(uint32_t id, uint32_t data1, uint32_t data2,
 		    uint32_t data3)
 {
@@ -1099,6 +1264,7 @@ void smem_log_event6(uint32_t id, uint32_t data1, uint32_t data2,
 			 inst[GEN].remote_spinlock, SMEM_LOG_NUM_ENTRIES,
 			 id, data1, data2, data3, data4, data5, data6);
 }
+#endif
 
 void smem_log_event_to_static(uint32_t id, uint32_t data1, uint32_t data2,
 		    uint32_t data3)
@@ -1188,6 +1354,9 @@ static ssize_t smem_log_read_bin(struct file *fp, char __user *buf,
 
 	inst = fp->private_data;
 
+	if (inst->which_log == GEN)
+		smem_log_flush_all();
+
 	remote_spin_lock_irqsave(inst->remote_spinlock, flags);
 
 	orig_idx = *inst->idx;
@@ -1238,6 +1407,9 @@ static ssize_t smem_log_read(struct file *fp, char __user *buf,
 
 	inst = fp->private_data;
 
+	if (inst->which_log == GEN)
+		smem_log_flush_all();
+
 	remote_spin_lock_irqsave(inst->remote_spinlock, flags);
 
 	orig_idx = *inst->idx;
@@ -1391,6 +1563,27 @@ static int smem_log_release(struct inode *ip, struct file *fp)
 static int smem_log_ioctl(struct inode *ip, struct file *fp,
 			  unsigned int cmd, unsigned long arg);
 
+static int smem_log_mmap(struct file *fp, struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff || size > MSM_SHARED_RAM_SIZE)
+		return -EINVAL;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_IO | VM_RESERVED;
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+
+	if (remap_pfn_range(vma, vma->vm_start,
+			    MSM_SHARED_RAM_PHYS >> PAGE_SHIFT,
+			    size, vma->vm_page_prot))
+		return -EAGAIN;
+
+	return 0;
+}
+
 static const struct file_operations smem_log_fops = {
 	.owner = THIS_MODULE,
 	.read = smem_log_read,
@@ -1404,6 +1597,7 @@ static const struct file_operations smem_log_bin_fops = {
 	.owner = THIS_MODULE,
 	.read = smem_log_read_bin,
 	.write = smem_log_write_bin,
+	.mmap = smem_log_mmap,
 	.open = smem_log_open,
 	.release = smem_log_release,
 	.ioctl = smem_log_ioctl,
@@ -1413,6 +1607,7 @@ static int smem_log_ioctl(struct inode *ip, struct file *fp,
 			  unsigned int cmd, unsigned long arg)
 {
 	struct smem_log_inst *inst;
+	struct smem_log_info info;
 
 	inst = fp->private_data;
 
@@ -1439,6 +1634,23 @@ static int smem_log_ioctl(struct inode *ip, struct file *fp,
 		else
 			return -EINVAL;
 		break;
+	case SMIOC_GETINFO:
+		if (!inst->events || !inst->idx)
+			return -ENODEV;
+		info.events_offset = (void *)inst->events -
+			(void *)MSM_SHARED_RAM_BASE;
+		info.idx_offset = (void *)inst->idx -
+			(void *)MSM_SHARED_RAM_BASE;
+		info.num_entries = inst->num;
+		info.item_size = sizeof(struct smem_log_item);
+		info.map_size = MSM_SHARED_RAM_SIZE;
+		if (copy_to_user((void __user *)arg, &info, sizeof(info)))
+			return -EFAULT;
+		break;
+	case SMIOC_FLUSH:
+		if (inst->which_log == GEN)
+			smem_log_flush_all();
+		break;
 	}
 
 	return 0;
@@ -1462,6 +1674,9 @@ static int _debug_dump(int log, char *buf, int max)
 	if (!inst[log].events)
 		return 0;
 
+	if (log == GEN)
+		smem_log_flush_all();
+
 	remote_spin_lock_irqsave(inst[log].remote_spinlock, flags);
 
 	orig_idx = *inst[log].idx;
@@ -1520,6 +1735,9 @@ static int _debug_dump_sym(int log, char *buf, int max)
 	if (!inst[log].events)
 		return 0;
 
+	if (log == GEN)
+		smem_log_flush_all();
+
 	find_voters(); /* need to call each time in case voters come and go */
 
 	i += scnprintf(buf + i, max - i, "Voters:\n");
@@ -1957,6 +2175,78 @@ static int debug_dump_power_sym(char *buf, int max)
 	return _debug_dump_sym(POW, buf, max);
 }
 
+#define SMEM_LOG_BENCH_MAX 100000
+
+static unsigned long bench_events;
+static u64 bench_ns;
+
+static int debug_stats(char *buf, int max)
+{
+	int i = 0;
+#if defined(CONFIG_MSM_SMEM_LOG_STAGING)
+	struct smem_log_stage *stage;
+	unsigned long staged = 0;
+	unsigned long flushes = 0;
+	unsigned long flushed = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stage = &per_cpu(smem_log_stage, cpu);
+		staged += stage->staged;
+		flushes += stage->flushes;
+		flushed += stage->flushed;
+	}
+
+	i += scnprintf(buf + i, max - i, "staged: %lu\n", staged);
+	i += scnprintf(buf + i, max - i, "flushes: %lu\n", flushes);
+	i += scnprintf(buf + i, max - i, "flushed: %lu\n", flushed);
+	if (flushes)
+		i += scnprintf(buf + i, max - i, "avg_batch: %lu\n",
+			       flushed / flushes);
+#endif
+	i += scnprintf(buf + i, max - i, "bench_events: %lu\n", bench_events);
+	i += scnprintf(buf + i, max - i, "bench_ns: %llu\n", bench_ns);
+	if (bench_events)
+		i += scnprintf(buf + i, max - i, "bench_ns_per_event: %llu\n",
+			       div_u64(bench_ns, bench_events));
+
+	return i;
+}
+
+/* Log N debug events back to back and record how long it took. */
+static ssize_t debug_bench_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	char locbuf[16];
+	unsigned long n;
+	unsigned long k;
+	ktime_t start;
+
+	if (count >= sizeof(locbuf))
+		return -EINVAL;
+	if (copy_from_user(locbuf, buf, count))
+		return -EFAULT;
+	locbuf[count] = '\0';
+
+	if (strict_strtoul(strstrip(locbuf), 0, &n) ||
+	    !n || n > SMEM_LOG_BENCH_MAX)
+		return -EINVAL;
+
+	start = ktime_get();
+	for (k = 0; k < n; k++)
+		smem_log_event(SMEM_LOG_PROC_ID_APPS |
+			       SMEM_LOG_DEBUG_EVENT_BASE, k, 0, 0);
+	smem_log_flush_all();
+	bench_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	bench_events = n;
+
+	return count;
+}
+
+static const struct file_operations debug_bench_ops = {
+	.write = debug_bench_write,
+};
+
 #define SMEM_LOG_ITEM_PRINT_SIZE 160
 
 #define EVENTS_PRINT_SIZE \
@@ -2005,6 +2295,8 @@ static void smem_log_debugfs_init(void)
 	debug_create("dump_static_sym", 0444, dent, debug_dump_static_sym);
 	debug_create("dump_power", 0444, dent, debug_dump_power);
 	debug_create("dump_power_sym", 0444, dent, debug_dump_power_sym);
+	debug_create("stats", 0444, dent, debug_stats);
+	debugfs_create_file("bench", 0200, dent, NULL, &debug_bench_ops);
 }
 #else
 static void smem_log_debugfs_init(void) {}
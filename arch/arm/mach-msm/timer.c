@@ -21,6 +21,7 @@
 #include <linux/clockchips.h>
 #include <linux/delay.h>
 #include <linux/io.h>
+#include <linux/suspend_profile.h>
 
 #include <asm/mach/time.h>
 #include <mach/msm_iomap.h>
@@ -533,6 +534,35 @@ unsigned long long sched_clock(void)
 	return result; 
 }
 
+#ifdef CONFIG_SUSPEND_PROFILE
+/* 32 kHz sleep clock tick count shared with the modem (smem_log stamps
+ * its entries with it).  Unlike the GPT and DGT it keeps counting while
+ * the clock event devices are shut down and through power collapse.
+ */
+#define MSM_TIMETICK (MSM_CSR_BASE + 0x04)
+
+u64 suspend_profile_clock(void)
+{
+	static uint32_t last;
+	static u64 wraps;
+	uint32_t tick;
+	u64 ticks;
+
+	do {
+		tick = readl(MSM_TIMETICK);
+	} while (tick != readl(MSM_TIMETICK));
+
+	/* called with interrupts off, under the profiler's lock */
+	if (tick < last)
+		wraps += 1ULL << 32;
+	last = tick;
+	ticks = wraps + tick;
+
+	return (ticks >> 15) * NSEC_PER_SEC +
+		(((ticks & 0x7fff) * NSEC_PER_SEC) >> 15);
+}
+#endif
+
 #ifdef CONFIG_MSM7X00A_USE_GP_TIMER
 	#define DG_TIMER_RATING 100
 #else
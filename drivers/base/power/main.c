@@ -23,6 +23,7 @@
 #include <linux/pm.h>
 #include <linux/resume-trace.h>
 #include <linux/rwsem.h>
+#include <linux/suspend_profile.h>
 #include <linux/timer.h>
 
 #include "../base.h"
@@ -319,8 +320,12 @@ static void dpm_power_up(pm_message_t state)
 		if (dev->power.status > DPM_OFF) {
 			int error;
 
+			ktime_t start = suspend_profile_now();
+
 			dev->power.status = DPM_OFF;
 			error = resume_device_noirq(dev, state);
+			suspend_profile_device(dev,
+					SUSPEND_PROFILE_RESUME_EARLY, start);
 			if (error)
 				pm_dev_err(dev, state, " early", error);
 		}
@@ -453,12 +458,16 @@ static void dpm_resume(pm_message_t state)
 
 		get_device(dev);
 		if (dev->power.status >= DPM_OFF) {
+			ktime_t start;
 			int error;
 
 			dev->power.status = DPM_RESUMING;
 			mutex_unlock(&dpm_list_mtx);
 
+			start = suspend_profile_now();
 			error = resume_device(dev, state);
+			suspend_profile_device(dev, SUSPEND_PROFILE_RESUME,
+					       start);
 
 			mutex_lock(&dpm_list_mtx);
 			if (error)
@@ -612,7 +621,11 @@ int device_power_down(pm_message_t state)
 	int error = 0;
 
 	list_for_each_entry_reverse(dev, &dpm_list, power.entry) {
+		ktime_t start = suspend_profile_now();
+
 		error = suspend_device_noirq(dev, state);
+		suspend_profile_device(dev, SUSPEND_PROFILE_SUSPEND_LATE,
+				       start);
 		if (error) {
 			pm_dev_err(dev, state, " late", error);
 			break;
@@ -693,12 +706,15 @@ static int dpm_suspend(pm_message_t state)
 	mutex_lock(&dpm_list_mtx);
 	while (!list_empty(&dpm_list)) {
 		struct device *dev = to_device(dpm_list.prev);
+		ktime_t start;
 
 		get_device(dev);
 		mutex_unlock(&dpm_list_mtx);
 
 		dpm_drv_wdset(dev);
+		start = suspend_profile_now();
 		error = suspend_device(dev, state);
+		suspend_profile_device(dev, SUSPEND_PROFILE_SUSPEND, start);
 		dpm_drv_wdclr(dev);
 
 		mutex_lock(&dpm_list_mtx);
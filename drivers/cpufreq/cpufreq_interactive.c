@@ -0,0 +1,554 @@
+/* drivers/cpufreq/cpufreq_interactive.c
+ *
+ * 'interactive' cpufreq governor.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Instead of polling on a fixed period like ondemand, the load is
+ * sampled a short while after the CPU comes out of idle.  A CPU that
+ * stays busy for that long is taken straight to hispeed_freq, and from
+ * there to the top speed if it stays loaded; speed is only lowered once
+ * the current one has been held for min_sample_time.  perf_lock levels
+ * act as soft floors: they are honoured while the CPU is doing any real
+ * work but do not keep an idle CPU clocked up.
+ *
+ * "replay" runs the same decision code over a synthetic load trace and
+ * reports how long it took to reach the top speed and a rough energy
+ * figure, so the tunables can be compared without a device in hand.
+ */
+
+#include <linux/cpu.h>
+#include <linux/cpufreq.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/pm.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/tick.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+
+#include <mach/system.h>
+#ifdef CONFIG_PERFLOCK
+#include <mach/perflock.h>
+#else
+static inline unsigned int perflock_get_floor(void) { return 0; }
+static inline void perflock_set_soft_floor(int soft) { }
+#endif
+
+/* load at which the CPU is taken straight to hispeed_freq */
+#define DEFAULT_GO_HISPEED_LOAD		85
+/* time the current speed must be held before it may be lowered (us) */
+#define DEFAULT_MIN_SAMPLE_TIME		(80 * USEC_PER_MSEC)
+/* sampling period once the CPU has left idle (us) */
+#define DEFAULT_TIMER_RATE		(20 * USEC_PER_MSEC)
+/* below this load a perf_lock floor is not applied */
+#define DEFAULT_FLOOR_LOAD		10
+
+#define REPLAY_MAX_SEGS			64
+
+struct cpufreq_interactive_cpuinfo {
+	struct timer_list cpu_timer;
+	int timer_idlecancel;
+	u64 time_in_idle;
+	u64 idle_exit_time;
+	u64 timer_run_time;
+	u64 freq_change_time;
+	unsigned int target_freq;
+	struct cpufreq_policy *policy;
+	struct cpufreq_frequency_table *freq_table;
+	int governor_enabled;
+};
+
+static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
+
+static void (*pm_idle_old)(void);
+static atomic_t active_count = ATOMIC_INIT(0);
+
+/* speed changes are made from here; ramping up uses an RT queue.  Each
+ * queue has its own work item so a pending ramp down never holds up a
+ * ramp up. */
+static struct workqueue_struct *up_wq;
+static struct workqueue_struct *down_wq;
+static struct work_struct freq_up_work;
+static struct work_struct freq_down_work;
+static DEFINE_MUTEX(set_speed_lock);
+
+static unsigned int go_hispeed_load = DEFAULT_GO_HISPEED_LOAD;
+static unsigned int hispeed_freq;
+static unsigned int min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+static unsigned int timer_rate = DEFAULT_TIMER_RATE;
+static unsigned int floor_load = DEFAULT_FLOOR_LOAD;
+
+struct replay_seg {
+	unsigned int load;
+	unsigned int ms;
+};
+
+static struct {
+	int nsegs;
+	unsigned int total_ms;
+	int time_to_max_ms;
+	unsigned int switches;
+	u64 energy;
+} replay_result;
+
+/* idle, a touch burst, some scrolling, then idle again */
+static const struct replay_seg replay_default[] = {
+	{ 0, 200 }, { 95, 150 }, { 40, 300 }, { 70, 100 }, { 5, 400 },
+};
+
+static inline u64 now_us(void)
+{
+	return ktime_to_us(ktime_get());
+}
+
+/*
+ * Pick the next speed for a sample with the given load (percent of the
+ * current speed).  Shared by the sampling timer and the trace replay so
+ * both follow exactly the same rules.
+ */
+static unsigned int interactive_choose_freq(struct cpufreq_policy *policy,
+		struct cpufreq_frequency_table *table, unsigned int cur,
+		unsigned int load, unsigned int floor, u64 held_us)
+{
+	unsigned int hispeed = hispeed_freq;
+	unsigned int new_freq;
+	int index;
+
+	if (!hispeed || hispeed > policy->max)
+		hispeed = policy->max;
+
+	if (load >= go_hispeed_load)
+		new_freq = cur < hispeed ? hispeed : policy->max;
+	else
+		new_freq = cur * load / 100;
+
+	if (floor && load >= floor_load && new_freq < floor)
+		new_freq = floor;
+
+	if (cpufreq_frequency_table_target(policy, table, new_freq,
+					   CPUFREQ_RELATION_L, &index))
+		return cur;
+	new_freq = table[index].frequency;
+
+	/* only come down once the current speed has been held long enough */
+	if (new_freq < cur && held_us < min_sample_time)
+		return cur;
+
+	return new_freq;
+}
+
+static void cpufreq_interactive_timer(unsigned long data)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, data);
+	u64 now, now_idle, delta_idle, delta_time;
+	unsigned int load, new_freq;
+
+	if (!pcpu->governor_enabled)
+		return;
+
+	now_idle = get_cpu_idle_time_us(data, &now);
+	delta_idle = now_idle - pcpu->time_in_idle;
+	delta_time = now - pcpu->idle_exit_time;
+	pcpu->timer_run_time = now;
+
+	/* armed from an idle exit that has since been cancelled */
+	if (!pcpu->idle_exit_time) {
+		if (idle_cpu(data))
+			return;
+		goto rearm;
+	}
+
+	if (!delta_time || delta_idle > delta_time)
+		load = 0;
+	else
+		load = div64_u64(100 * (delta_time - delta_idle),
+				 delta_time);
+
+	new_freq = interactive_choose_freq(pcpu->policy, pcpu->freq_table,
+			pcpu->policy->cur, load, perflock_get_floor(),
+			now - pcpu->freq_change_time);
+
+	if (new_freq != pcpu->target_freq) {
+		pcpu->target_freq = new_freq;
+		if (new_freq > pcpu->policy->cur)
+			queue_work(up_wq, &freq_up_work);
+		else
+			queue_work(down_wq, &freq_down_work);
+	}
+
+rearm:
+	if (!timer_pending(&pcpu->cpu_timer)) {
+		/*
+		 * At min speed an idle CPU is left alone until its next
+		 * idle exit, and a busy one is watched by a timer that
+		 * going idle may cancel.  Above min, keep sampling so an
+		 * idle CPU is not left at a high speed.
+		 */
+		if (pcpu->target_freq == pcpu->policy->min) {
+			if (idle_cpu(data))
+				return;
+			pcpu->timer_idlecancel = 1;
+		} else
+			pcpu->timer_idlecancel = 0;
+
+		pcpu->time_in_idle = get_cpu_idle_time_us(data,
+						&pcpu->idle_exit_time);
+		mod_timer(&pcpu->cpu_timer,
+			  jiffies + usecs_to_jiffies(timer_rate));
+	}
+}
+
+static void cpufreq_interactive_idle(void)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, smp_processor_id());
+	int pending = timer_pending(&pcpu->cpu_timer);
+
+	if (pcpu->governor_enabled && pending && pcpu->timer_idlecancel &&
+	    pcpu->target_freq == pcpu->policy->min) {
+		/* at min speed and the last sample saw no load */
+		del_timer(&pcpu->cpu_timer);
+		pcpu->idle_exit_time = 0;
+	}
+
+	if (pm_idle_old)
+		pm_idle_old();
+	else {
+		local_irq_disable();
+		if (!need_resched())
+			arch_idle();
+		local_irq_enable();
+	}
+
+	/*
+	 * Sample the load a timer period after leaving idle, unless the
+	 * timer has yet to account for the previous period.
+	 */
+	if (pcpu->governor_enabled && !timer_pending(&pcpu->cpu_timer) &&
+	    pcpu->timer_run_time >= pcpu->idle_exit_time) {
+		pcpu->time_in_idle = get_cpu_idle_time_us(smp_processor_id(),
+						&pcpu->idle_exit_time);
+		pcpu->timer_idlecancel = 0;
+		mod_timer(&pcpu->cpu_timer,
+			  jiffies + usecs_to_jiffies(timer_rate));
+	}
+}
+
+static void cpufreq_interactive_freq_change(struct work_struct *work)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int cpu;
+
+	mutex_lock(&set_speed_lock);
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		if (!pcpu->governor_enabled)
+			continue;
+		if (pcpu->target_freq == pcpu->policy->cur)
+			continue;
+
+		__cpufreq_driver_target(pcpu->policy, pcpu->target_freq,
+					CPUFREQ_RELATION_H);
+		pcpu->freq_change_time = now_us();
+	}
+	mutex_unlock(&set_speed_lock);
+}
+
+/*
+ * Step the decision code through a trace of (load, ms) segments.  The
+ * load of a segment is the share of the top speed the work needs, so
+ * at a lower speed the CPU looks busier.  The energy figure is the sum
+ * of f^2 over busy time: on this part voltage goes up with frequency,
+ * so active power grows roughly with f^2 while idle power is ignored.
+ */
+static void interactive_replay(struct cpufreq_policy *policy,
+			       const struct replay_seg *seg, int nsegs)
+{
+	struct cpufreq_frequency_table *table =
+		cpufreq_frequency_get_table(policy->cpu);
+	unsigned int step = timer_rate;
+	unsigned int cur = policy->min;
+	unsigned int floor = perflock_get_floor();
+	unsigned int load, next, busy_us;
+	u64 t = 0, held = 0, el;
+	s64 first_busy = -1;
+	int i;
+
+	memset(&replay_result, 0, sizeof(replay_result));
+	replay_result.nsegs = nsegs;
+	replay_result.time_to_max_ms = -1;
+
+	for (i = 0; i < nsegs; i++) {
+		for (el = 0; el < (u64) seg[i].ms * USEC_PER_MSEC; el += step) {
+			load = min_t(unsigned int, 100,
+				     seg[i].load * policy->max / cur);
+			busy_us = step * load / 100;
+			replay_result.energy +=
+				(u64) (cur / 1000) * (cur / 1000) * busy_us;
+
+			if (first_busy < 0 && seg[i].load >= go_hispeed_load)
+				first_busy = t;
+
+			next = interactive_choose_freq(policy, table, cur,
+						       load, floor, held);
+			t += step;
+			held += step;
+			if (next != cur) {
+				cur = next;
+				held = 0;
+				replay_result.switches++;
+			}
+
+			if (replay_result.time_to_max_ms < 0 &&
+			    first_busy >= 0 && cur == policy->max)
+				replay_result.time_to_max_ms =
+					div_u64(t - first_busy, USEC_PER_MSEC);
+		}
+		replay_result.total_ms += seg[i].ms;
+	}
+	/* report in MHz^2 * ms */
+	replay_result.energy = div_u64(replay_result.energy, USEC_PER_MSEC);
+}
+
+/************************** sysfs interface ************************/
+
+#define show_one(name)							\
+static ssize_t show_##name(struct cpufreq_policy *unused, char *buf)	\
+{									\
+	return sprintf(buf, "%u\n", name);				\
+}
+
+#define store_one(name, lo, hi)						\
+static ssize_t store_##name(struct cpufreq_policy *unused,		\
+		const char *buf, size_t count)				\
+{									\
+	unsigned int input;						\
+									\
+	if (sscanf(buf, "%u", &input) != 1 || input < (lo) || input > (hi)) \
+		return -EINVAL;						\
+	name = input;							\
+	return count;							\
+}
+
+show_one(go_hispeed_load);
+store_one(go_hispeed_load, 1, 100);
+show_one(hispeed_freq);
+show_one(min_sample_time);
+store_one(min_sample_time, 0, 10 * USEC_PER_SEC);
+show_one(timer_rate);
+store_one(timer_rate, 1000, USEC_PER_SEC);
+show_one(floor_load);
+store_one(floor_load, 0, 100);
+
+/* 0 means the top speed of the policy */
+static ssize_t store_hispeed_freq(struct cpufreq_policy *unused,
+		const char *buf, size_t count)
+{
+	unsigned int input;
+
+	if (sscanf(buf, "%u", &input) != 1)
+		return -EINVAL;
+	hispeed_freq = input;
+	return count;
+}
+
+static ssize_t show_replay(struct cpufreq_policy *unused, char *buf)
+{
+	return sprintf(buf, "segments %d total_ms %u time_to_max_ms %d "
+		       "switches %u energy %llu\n",
+		       replay_result.nsegs, replay_result.total_ms,
+		       replay_result.time_to_max_ms, replay_result.switches,
+		       replay_result.energy);
+}
+
+/* "load:ms load:ms ...", or anything else for the built-in trace */
+static ssize_t store_replay(struct cpufreq_policy *policy,
+		const char *buf, size_t count)
+{
+	struct replay_seg *seg;
+	const char *p = buf;
+	int nsegs = 0, n;
+
+	seg = kmalloc(sizeof(*seg) * REPLAY_MAX_SEGS, GFP_KERNEL);
+	if (!seg)
+		return -ENOMEM;
+
+	while (nsegs < REPLAY_MAX_SEGS &&
+	       sscanf(p, " %u:%u%n", &seg[nsegs].load, &seg[nsegs].ms,
+		      &n) == 2) {
+		if (seg[nsegs].load > 100) {
+			kfree(seg);
+			return -EINVAL;
+		}
+		nsegs++;
+		p += n;
+	}
+
+	mutex_lock(&set_speed_lock);
+	if (nsegs)
+		interactive_replay(policy, seg, nsegs);
+	else
+		interactive_replay(policy, replay_default,
+				   ARRAY_SIZE(replay_default));
+	mutex_unlock(&set_speed_lock);
+
+	kfree(seg);
+	return count;
+}
+
+#define define_one_rw(_name) \
+static struct freq_attr _name = \
+__ATTR(_name, 0644, show_##_name, store_##_name)
+
+define_one_rw(go_hispeed_load);
+define_one_rw(hispeed_freq);
+define_one_rw(min_sample_time);
+define_one_rw(timer_rate);
+define_one_rw(floor_load);
+define_one_rw(replay);
+
+static struct attribute *interactive_attributes[] = {
+	&go_hispeed_load.attr,
+	&hispeed_freq.attr,
+	&min_sample_time.attr,
+	&timer_rate.attr,
+	&floor_load.attr,
+	&replay.attr,
+	NULL,
+};
+
+static struct attribute_group interactive_attr_group = {
+	.attrs = interactive_attributes,
+	.name = "interactive",
+};
+
+/************************** sysfs end ************************/
+
+static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
+		unsigned int event)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int j;
+	int rc;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu) || !policy->cur)
+			return -EINVAL;
+
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->policy = policy;
+			pcpu->target_freq = policy->cur;
+			pcpu->freq_table = cpufreq_frequency_get_table(j);
+			pcpu->freq_change_time = now_us();
+			pcpu->idle_exit_time = 0;
+			pcpu->timer_run_time = 0;
+			pcpu->governor_enabled = 1;
+		}
+
+		/* tunables are shared, only set them up for the first user */
+		if (atomic_inc_return(&active_count) > 1)
+			return 0;
+
+		rc = sysfs_create_group(&policy->kobj, &interactive_attr_group);
+		if (rc) {
+			atomic_dec(&active_count);
+			return rc;
+		}
+
+		perflock_set_soft_floor(1);
+		pm_idle_old = pm_idle;
+		pm_idle = cpufreq_interactive_idle;
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->governor_enabled = 0;
+			del_timer_sync(&pcpu->cpu_timer);
+		}
+
+		flush_work(&freq_up_work);
+		flush_work(&freq_down_work);
+
+		if (atomic_dec_return(&active_count) > 0)
+			return 0;
+
+		pm_idle = pm_idle_old;
+		perflock_set_soft_floor(0);
+		sysfs_remove_group(&policy->kobj, &interactive_attr_group);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		mutex_lock(&set_speed_lock);
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy, policy->max,
+						CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy, policy->min,
+						CPUFREQ_RELATION_L);
+		for_each_cpu(j, policy->cpus)
+			per_cpu(cpuinfo, j).target_freq = policy->cur;
+		mutex_unlock(&set_speed_lock);
+		break;
+	}
+	return 0;
+}
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
+static
+#endif
+struct cpufreq_governor cpufreq_gov_interactive = {
+	.name			= "interactive",
+	.governor		= cpufreq_governor_interactive,
+	.max_transition_latency = 10000000,
+	.owner			= THIS_MODULE,
+};
+
+static int __init cpufreq_interactive_init(void)
+{
+	unsigned int i;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+
+	for_each_possible_cpu(i) {
+		pcpu = &per_cpu(cpuinfo, i);
+		init_timer(&pcpu->cpu_timer);
+		pcpu->cpu_timer.function = cpufreq_interactive_timer;
+		pcpu->cpu_timer.data = i;
+	}
+
+	up_wq = create_rt_workqueue("kinteractive_up");
+	if (!up_wq)
+		return -ENOMEM;
+	down_wq = create_singlethread_workqueue("kinteractive_down");
+	if (!down_wq) {
+		destroy_workqueue(up_wq);
+		return -ENOMEM;
+	}
+	INIT_WORK(&freq_up_work, cpufreq_interactive_freq_change);
+	INIT_WORK(&freq_down_work, cpufreq_interactive_freq_change);
+
+	return cpufreq_register_governor(&cpufreq_gov_interactive);
+}
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
+fs_initcall(cpufreq_interactive_init);
+#else
+module_init(cpufreq_interactive_init);
+#endif
@@ -28,6 +28,10 @@
 #include <linux/uaccess.h>
 #include <linux/android_pmem.h>
 #include <linux/poll.h>
+#include <linux/hash.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
 #include <media/msm_camera.h>
 #include <mach/camera.h>
 #include <asm/cacheflush.h>
@@ -76,13 +80,148 @@ static LIST_HEAD(msm_sensors);
 	res;							\
 })
 
+static void msm_qcmd_release(struct msm_queue_cmd *qcmd)
+{
+	struct msm_qcmd_pool *pool = qcmd->pool;
+	unsigned long flags;
+
+	if (!pool) {
+		kfree(qcmd);
+		return;
+	}
+
+	spin_lock_irqsave(&pool->lock, flags);
+	pool->free[pool->nfree++] = qcmd;
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
 static inline void free_qcmd(struct msm_queue_cmd *qcmd)
 {
+	unsigned long flags;
+	int on_heap;
+
 	if (!qcmd || !qcmd->on_heap)
 		return;
 	CDBG("%s qcmd->on_heap:%d\n",__func__,qcmd->on_heap);
-	if (!--qcmd->on_heap)
-		kfree(qcmd);
+	/* the VFE callback drops frames from interrupt context */
+	local_irq_save(flags);
+	on_heap = --qcmd->on_heap;
+	local_irq_restore(flags);
+	if (!on_heap)
+		msm_qcmd_release(qcmd);
+}
+
+static void msm_qcmd_pool_init(struct msm_qcmd_pool *pool)
+{
+	const size_t slot = sizeof(struct msm_queue_cmd) + MSM_QCMD_POOL_DATA;
+	int i;
+
+	spin_lock_init(&pool->lock);
+	pool->nfree = 0;
+	pool->misses = 0;
+	pool->mem = kmalloc(MSM_QCMD_POOL_COUNT * slot, GFP_KERNEL);
+	if (!pool->mem) {
+		pr_err("%s: no memory, VFE responses will use the heap\n",
+			__func__);
+		return;
+	}
+	for (i = 0; i < MSM_QCMD_POOL_COUNT; i++)
+		pool->free[pool->nfree++] = pool->mem + i * slot;
+}
+
+static void msm_frame_ring_init(struct msm_frame_ring *ring)
+{
+	spin_lock_init(&ring->lock);
+	init_waitqueue_head(&ring->wait);
+	INIT_LIST_HEAD(&ring->dropped_list);
+	ring->head = 0;
+	atomic_set(&ring->tail, 0);
+	ring->max = 0;
+	ring->dropped = 0;
+}
+
+static inline int msm_frame_ring_empty(struct msm_frame_ring *ring)
+{
+	return ACCESS_ONCE(ring->head) == atomic_read(&ring->tail);
+}
+
+/* Called by the single producer.  If the reader has fallen a whole ring
+ * behind, the oldest frame is dropped so that it only ever sees the
+ * most recent ones.  The VFE still needs that frame's buffer back,
+ * which can't be done from here; the reader releases it in
+ * msm_frame_ring_release_dropped().
+ */
+static void msm_frame_ring_put(struct msm_frame_ring *ring,
+		struct msm_queue_cmd *qcmd)
+{
+	unsigned tail = atomic_read(&ring->tail);
+	unsigned depth = ring->head - tail;
+
+	if (depth == MSM_FRAME_RING_SIZE) {
+		struct msm_queue_cmd *old =
+			ring->slot[tail & (MSM_FRAME_RING_SIZE - 1)];
+		/* lost the race if the reader just took it */
+		if (atomic_cmpxchg(&ring->tail, tail, tail + 1) == tail) {
+			unsigned long flags;
+
+			spin_lock_irqsave(&ring->lock, flags);
+			list_add_tail(&old->list_dropped, &ring->dropped_list);
+			spin_unlock_irqrestore(&ring->lock, flags);
+			ring->dropped++;
+		}
+		depth--;
+	}
+
+	ring->slot[ring->head & (MSM_FRAME_RING_SIZE - 1)] = qcmd;
+	smp_wmb();
+	ring->head++;
+
+	if (++depth > ring->max)
+		ring->max = depth;
+	wake_up(&ring->wait);
+}
+
+/* Called by the single consumer. */
+static struct msm_queue_cmd *msm_frame_ring_get(struct msm_frame_ring *ring)
+{
+	struct msm_queue_cmd *qcmd;
+	unsigned tail;
+
+	do {
+		tail = atomic_read(&ring->tail);
+		if (tail == ACCESS_ONCE(ring->head))
+			return NULL;
+		smp_rmb();
+		qcmd = ring->slot[tail & (MSM_FRAME_RING_SIZE - 1)];
+	} while (atomic_cmpxchg(&ring->tail, tail, tail + 1) != tail);
+
+	return qcmd;
+}
+
+static struct msm_queue_cmd *msm_frame_ring_get_dropped(
+		struct msm_frame_ring *ring)
+{
+	struct msm_queue_cmd *qcmd = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ring->lock, flags);
+	if (!list_empty(&ring->dropped_list)) {
+		qcmd = list_first_entry(&ring->dropped_list,
+				struct msm_queue_cmd, list_dropped);
+		list_del_init(&qcmd->list_dropped);
+	}
+	spin_unlock_irqrestore(&ring->lock, flags);
+	return qcmd;
+}
+
+static void msm_frame_ring_drain(struct msm_frame_ring *ring)
+{
+	struct msm_queue_cmd *qcmd;
+
+	while ((qcmd = msm_frame_ring_get(ring)))
+		free_qcmd(qcmd);
+	while ((qcmd = msm_frame_ring_get_dropped(ring)))
+		free_qcmd(qcmd);
 }
 
 static void msm_queue_init(struct msm_device_queue *queue, const char *name)
@@ -150,6 +289,31 @@ static void msm_enqueue(struct msm_device_queue *queue,
 	spin_unlock_irqrestore(&__q->lock, flags);		\
 } while(0)
 
+#define MSM_PMEM_HASH(key) hash_long((key), MSM_PMEM_HASH_BITS)
+
+static inline int msm_pmem_is_frame(int type)
+{
+	return type != MSM_PMEM_AEC_AWB && type != MSM_PMEM_AF;
+}
+
+/* Frames are indexed by the address of their luma plane, which is what
+ * the VFE reports, stats buffers by their base address.
+ */
+static inline unsigned long msm_pmem_key(unsigned long base,
+		struct msm_pmem_info *info)
+{
+	return msm_pmem_is_frame(info->type) ? base + info->y_off : base;
+}
+
+static void msm_pmem_region_free(struct msm_pmem_region *region)
+{
+	hlist_del(&region->list);
+	hlist_del(&region->phys_list);
+	hlist_del(&region->virt_list);
+	put_pmem_file(region->file);
+	kfree(region);
+}
+
 static int check_overlap(struct hlist_head *ptype,
 			unsigned long paddr,
 			unsigned long len)
@@ -199,8 +363,8 @@ error:
 	return -EINVAL;
 }
 
-static int msm_pmem_table_add(struct hlist_head *ptype,
-	struct msm_pmem_info *info)
+static int msm_pmem_table_add(struct msm_sync *sync,
+	struct hlist_head *ptype, struct msm_pmem_info *info)
 {
 	struct file *file;
 	unsigned long paddr;
@@ -248,6 +412,10 @@ static int msm_pmem_table_add(struct hlist_head *ptype,
 	memcpy(&region->info, info, sizeof(region->info));
 
 	hlist_add_head(&(region->list), ptype);
+	hlist_add_head(&region->phys_list, &sync->pmem_phys[
+		MSM_PMEM_HASH(msm_pmem_key(paddr, info))]);
+	hlist_add_head(&region->virt_list, &sync->pmem_virt[
+		MSM_PMEM_HASH(msm_pmem_key((unsigned long)info->vaddr, info))]);
 
 	return 0;
 }
@@ -283,14 +451,16 @@ static int msm_pmem_frame_ptov_lookup(struct msm_sync *sync,
 		struct msm_pmem_region **pmem_region,
 		int take_from_vfe)
 {
-	struct hlist_node *node, *n;
+	struct hlist_node *node;
 	struct msm_pmem_region *region;
 
-	hlist_for_each_entry_safe(region, node, n, &sync->pmem_frames, list) {
+	hlist_for_each_entry(region, node,
+			&sync->pmem_phys[MSM_PMEM_HASH(pyaddr)], phys_list) {
 		if (pyaddr == (region->paddr + region->info.y_off) &&
 				pcbcraddr == (region->paddr +
 						region->info.cbcr_off) &&
-				region->info.vfe_can_write) {
+				region->info.vfe_can_write &&
+				msm_pmem_is_frame(region->info.type)) {
 			*pmem_region = region;
 			region->info.vfe_can_write = !take_from_vfe;
 			return 0;
@@ -304,10 +474,13 @@ static unsigned long msm_pmem_stats_ptov_lookup(struct msm_sync *sync,
 		unsigned long addr, int *fd)
 {
 	struct msm_pmem_region *region;
-	struct hlist_node *node, *n;
+	struct hlist_node *node;
 
-	hlist_for_each_entry_safe(region, node, n, &sync->pmem_stats, list) {
-		if (addr == region->paddr && region->info.vfe_can_write) {
+	hlist_for_each_entry(region, node,
+			&sync->pmem_phys[MSM_PMEM_HASH(addr)], phys_list) {
+		if (!msm_pmem_is_frame(region->info.type) &&
+				addr == region->paddr &&
+				region->info.vfe_can_write) {
 			/* offset since we could pass vaddr inside a
 			 * registered pmem buffer */
 			*fd = region->info.fd;
@@ -317,8 +490,10 @@ static unsigned long msm_pmem_stats_ptov_lookup(struct msm_sync *sync,
 	}
 #if 1
 	printk("msm_pmem_stats_ptov_lookup: lookup vaddr..\n");
-	hlist_for_each_entry_safe(region, node, n, &sync->pmem_stats, list) {
-		if (addr == (unsigned long)(region->info.vaddr)) {
+	hlist_for_each_entry(region, node,
+			&sync->pmem_virt[MSM_PMEM_HASH(addr)], virt_list) {
+		if (!msm_pmem_is_frame(region->info.type) &&
+				addr == (unsigned long)(region->info.vaddr)) {
 			/* offset since we could pass vaddr inside a
 			 * registered pmem buffer */
 			*fd = region->info.fd;
@@ -335,11 +510,13 @@ static unsigned long msm_pmem_frame_vtop_lookup(struct msm_sync *sync,
 		uint32_t yoff, uint32_t cbcroff, int fd)
 {
 	struct msm_pmem_region *region;
-	struct hlist_node *node, *n;
+	struct hlist_node *node;
 
-	hlist_for_each_entry_safe(region,
-		node, n, &sync->pmem_frames, list) {
+	hlist_for_each_entry(region, node,
+			&sync->pmem_virt[MSM_PMEM_HASH(buffer + yoff)],
+			virt_list) {
 		if (((unsigned long)(region->info.vaddr) == buffer) &&
+				msm_pmem_is_frame(region->info.type) &&
 				(region->info.y_off == yoff) &&
 				(region->info.cbcr_off == cbcroff) &&
 				(region->info.fd == fd) &&
@@ -358,10 +535,12 @@ static unsigned long msm_pmem_stats_vtop_lookup(
 		int fd)
 {
 	struct msm_pmem_region *region;
-	struct hlist_node *node, *n;
+	struct hlist_node *node;
 
-	hlist_for_each_entry_safe(region, node, n, &sync->pmem_stats, list) {
+	hlist_for_each_entry(region, node,
+			&sync->pmem_virt[MSM_PMEM_HASH(buffer)], virt_list) {
 		if (((unsigned long)(region->info.vaddr) == buffer) &&
+				!msm_pmem_is_frame(region->info.type) &&
 				(region->info.fd == fd) &&
 				region->info.vfe_can_write == 0) {
 			region->info.vfe_can_write = 1;
@@ -390,11 +569,8 @@ static int __msm_pmem_table_del(struct msm_sync *sync,
 
 			if (pinfo->type == region->info.type &&
 					pinfo->vaddr == region->info.vaddr &&
-					pinfo->fd == region->info.fd) {
-				hlist_del(node);
-				put_pmem_file(region->file);
-				kfree(region);
-			}
+					pinfo->fd == region->info.fd)
+				msm_pmem_region_free(region);
 		}
 		break;
 
@@ -405,11 +581,8 @@ static int __msm_pmem_table_del(struct msm_sync *sync,
 
 			if (pinfo->type == region->info.type &&
 					pinfo->vaddr == region->info.vaddr &&
-					pinfo->fd == region->info.fd) {
-				hlist_del(node);
-				put_pmem_file(region->file);
-				kfree(region);
-			}
+					pinfo->fd == region->info.fd)
+				msm_pmem_region_free(region);
 		}
 		break;
 
@@ -433,6 +606,56 @@ static int msm_pmem_table_del(struct msm_sync *sync, void __user *arg)
 	return __msm_pmem_table_del(sync, &info);
 }
 
+static void msm_frame_account(struct msm_sync *sync,
+		struct msm_queue_cmd *qcmd)
+{
+	unsigned us = ktime_to_us(ktime_sub(ktime_get(), qcmd->stamp));
+
+	sync->frame_count++;
+	sync->frame_latency_us += us;
+	if (us > sync->frame_latency_max_us)
+		sync->frame_latency_max_us = us;
+}
+
+/* Give the buffers of preview frames dropped by msm_frame_ring_put()
+ * back to the VFE, as if user space had released them.  The frames
+ * never left the kernel, so their regions are still marked writable.
+ */
+static void msm_frame_ring_release_dropped(struct msm_sync *sync)
+{
+	struct msm_queue_cmd *qcmd;
+	struct msm_vfe_resp *vdata;
+	struct msm_pmem_region *region;
+	struct msm_vfe_cfg_cmd cfgcmd;
+	struct msm_frame frame;
+	unsigned long pphy;
+
+	while ((qcmd = msm_frame_ring_get_dropped(&sync->frame_q))) {
+		vdata = (struct msm_vfe_resp *)(qcmd->command);
+		if (msm_pmem_frame_ptov_lookup(sync, vdata->phy.y_phy,
+				vdata->phy.cbcr_phy, &region, 0) < 0) {
+			sync->frame_lookup_miss++;
+			pr_err("%s: no region for dropped frame "
+				"y %x cbcr %x\n", __func__,
+				vdata->phy.y_phy, vdata->phy.cbcr_phy);
+			goto next;
+		}
+
+		frame.buffer = (unsigned long)region->info.vaddr;
+		frame.y_off = region->info.y_off;
+		frame.cbcr_off = region->info.cbcr_off;
+		frame.fd = region->info.fd;
+		pphy = region->paddr;
+
+		cfgcmd.cmd_type = CMD_FRAME_BUF_RELEASE;
+		cfgcmd.value = (void *)&frame;
+		if (sync->vfefn.vfe_config)
+			sync->vfefn.vfe_config(&cfgcmd, &pphy);
+next:
+		free_qcmd(qcmd);
+	}
+}
+
 static int __msm_get_frame(struct msm_sync *sync,
 		struct msm_frame *frame)
 {
@@ -443,7 +666,9 @@ static int __msm_get_frame(struct msm_sync *sync,
 	struct msm_vfe_resp *vdata;
 	struct msm_vfe_phy_info *pphy;
 
-	qcmd = msm_dequeue(&sync->frame_q, list_frame);
+	msm_frame_ring_release_dropped(sync);
+
+	qcmd = msm_frame_ring_get(&sync->frame_q);
 
 	if (!qcmd) {
 		pr_err("%s: no preview frame.\n", __func__);
@@ -460,6 +685,7 @@ static int __msm_get_frame(struct msm_sync *sync,
 			1); /* give frame to user space */
 
 	if (rc < 0) {
+		sync->frame_lookup_miss++;
 		pr_err("%s: cannot get frame, invalid lookup address "
 			"y %x cbcr %x\n",
 			__func__,
@@ -472,6 +698,7 @@ static int __msm_get_frame(struct msm_sync *sync,
 	frame->y_off = region->info.y_off;
 	frame->cbcr_off = region->info.cbcr_off;
 	frame->fd = region->info.fd;
+	msm_frame_account(sync, qcmd);
 
 	CDBG("%s: y %x, cbcr %x, qcmd %x, virt_addr %x\n",
 		__func__,
@@ -626,6 +853,7 @@ static struct msm_queue_cmd *__msm_control_nb(struct msm_sync *sync,
 	}
 
 	*qcmd = *qcmd_to_copy;
+	qcmd->pool = NULL;
 	udata = qcmd->command = qcmd + 1;
 	memcpy(udata, udata_to_copy, sizeof(*udata));
 	udata->value = udata + 1;
@@ -1308,12 +1536,12 @@ static int __msm_register_pmem(struct msm_sync *sync,
 	case MSM_PMEM_THUMBNAIL:
 	case MSM_PMEM_MAINIMG:
 	case MSM_PMEM_RAW_MAINIMG:
-		rc = msm_pmem_table_add(&sync->pmem_frames, pinfo);
+		rc = msm_pmem_table_add(sync, &sync->pmem_frames, pinfo);
 		break;
 
 	case MSM_PMEM_AEC_AWB:
 	case MSM_PMEM_AF:
-		rc = msm_pmem_table_add(&sync->pmem_stats, pinfo);
+		rc = msm_pmem_table_add(sync, &sync->pmem_stats, pinfo);
 		break;
 
 	default:
@@ -1658,7 +1886,10 @@ static int msm_pp_release(struct msm_sync *sync, void __user *arg)
 			return -EINVAL;
 		}
 		pr_info("%s: delivering pp_prev\n", __func__);
-		msm_enqueue(&sync->frame_q, &sync->pp_prev->list_frame);
+		/* The VFE callback doesn't touch frame_q while PP_PREV is
+		 * set, so this is still the only producer.
+		 */
+		msm_frame_ring_put(&sync->frame_q, sync->pp_prev);
 		sync->pp_prev = NULL;
 		goto done;
 	}
@@ -1949,21 +2180,15 @@ static int __msm_release(struct msm_sync *sync)
 		/*sensor release moved to vfe_release*/
 
 		hlist_for_each_entry_safe(region, hnode, n,
-				&sync->pmem_frames, list) {
-			hlist_del(hnode);
-			put_pmem_file(region->file);
-			kfree(region);
-		}
+				&sync->pmem_frames, list)
+			msm_pmem_region_free(region);
 
 		hlist_for_each_entry_safe(region, hnode, n,
-				&sync->pmem_stats, list) {
-			hlist_del(hnode);
-			put_pmem_file(region->file);
-			kfree(region);
-		}
+				&sync->pmem_stats, list)
+			msm_pmem_region_free(region);
 
 		msm_queue_drain(&sync->event_q, list_config);
-		msm_queue_drain(&sync->frame_q, list_frame);
+		msm_frame_ring_drain(&sync->frame_q);
 		msm_queue_drain(&sync->pict_q, list_pict);
 
 		wake_unlock(&sync->wake_suspend_lock);
@@ -2038,7 +2263,7 @@ static unsigned int __msm_poll_frame(struct msm_sync *sync,
 	poll_wait(filep, &sync->frame_q.wait, pll_table);
 
 	spin_lock_irqsave(&sync->frame_q.lock, flags);
-	if (!list_empty_careful(&sync->frame_q.list))
+	if (!msm_frame_ring_empty(&sync->frame_q))
 		/* frame ready */
 		rc = POLLIN | POLLRDNORM;
 	if (sync->unblock_poll_frame) {
@@ -2063,19 +2288,34 @@ static unsigned int msm_poll_frame(struct file *filep,
  */
 
 static void *msm_vfe_sync_alloc(int size,
-			void *syncdata __attribute__((unused)),
+			void *syncdata,
 			gfp_t gfp)
 {
-	struct msm_queue_cmd *qcmd =
-		kzalloc(sizeof(struct msm_queue_cmd) + size, gfp);
+	struct msm_sync *sync = (struct msm_sync *)syncdata;
+	struct msm_qcmd_pool *pool = sync ? &sync->qcmd_pool : NULL;
+	struct msm_queue_cmd *qcmd = NULL;
+	unsigned long flags;
+
+	if (pool) {
+		spin_lock_irqsave(&pool->lock, flags);
+		if (size <= MSM_QCMD_POOL_DATA && pool->nfree)
+			qcmd = pool->free[--pool->nfree];
+		else
+			pool->misses++;
+		spin_unlock_irqrestore(&pool->lock, flags);
+	}
+
 	if (qcmd) {
-		/* Becker and kant */
 		memset(qcmd, 0x0, sizeof(struct msm_queue_cmd) + size);
-
-		qcmd->on_heap = 1;
-		return qcmd + 1;
+		qcmd->pool = pool;
+	} else {
+		qcmd = kzalloc(sizeof(struct msm_queue_cmd) + size, gfp);
+		if (!qcmd)
+			return NULL;
 	}
-	return NULL;
+
+	qcmd->on_heap = 1;
+	return qcmd + 1;
 }
 
 static void msm_vfe_sync_free(void *ptr)
@@ -2085,7 +2325,7 @@ static void msm_vfe_sync_free(void *ptr)
 			(struct msm_queue_cmd *)ptr;
 		qcmd--;
 		if (qcmd->on_heap)
-			kfree(qcmd);
+			msm_qcmd_release(qcmd);
 	}
 }
 
@@ -2113,6 +2353,7 @@ static void msm_vfe_sync(struct msm_vfe_resp *vdata,
 	qcmd = ((struct msm_queue_cmd *)vdata) - 1;
 	qcmd->type = qtype;
 	qcmd->command = vdata;
+	qcmd->stamp = ktime_get();
 
 	CDBG("%s: qtype %d \n", __func__, qtype);
 	CDBG("%s: evt_msg.msg_id %d\n", __func__, vdata->evt_msg.msg_id);
@@ -2160,7 +2401,7 @@ static void msm_vfe_sync(struct msm_vfe_resp *vdata,
 		CDBG("%s: msm_enqueue frame_q\n", __func__);
 		if (qcmd->on_heap)
 			qcmd->on_heap++;
-		msm_enqueue(&sync->frame_q, &qcmd->list_frame);
+		msm_frame_ring_put(&sync->frame_q, qcmd);
 		break;
 
 	case VFE_MSG_SNAPSHOT:
@@ -2240,9 +2481,21 @@ static int __msm_open(struct msm_sync *sync, const char *const apps_id)
 		}
 
 		if (rc >= 0) {
+			int i;
+
 			INIT_HLIST_HEAD(&sync->pmem_frames);
 			INIT_HLIST_HEAD(&sync->pmem_stats);
+			for (i = 0; i < ARRAY_SIZE(sync->pmem_phys); i++) {
+				INIT_HLIST_HEAD(&sync->pmem_phys[i]);
+				INIT_HLIST_HEAD(&sync->pmem_virt[i]);
+			}
 			sync->unblock_poll_frame = 0;
+			sync->frame_count = 0;
+			sync->frame_lookup_miss = 0;
+			sync->frame_latency_us = 0;
+			sync->frame_latency_max_us = 0;
+			sync->frame_q.max = 0;
+			sync->frame_q.dropped = 0;
 		}
 	}
 	sync->opencnt++;
@@ -2614,8 +2867,9 @@ static int msm_sync_init(struct msm_sync *sync,
 	sync->sdata = pdev->dev.platform_data;
 
 	msm_queue_init(&sync->event_q, "event");
-	msm_queue_init(&sync->frame_q, "frame");
+	msm_frame_ring_init(&sync->frame_q);
 	msm_queue_init(&sync->pict_q, "pict");
+	msm_qcmd_pool_init(&sync->qcmd_pool);
 
 	wake_lock_init(&sync->wake_suspend_lock, WAKE_LOCK_SUSPEND, "msm_camera_wake");
 	wake_lock_init(&sync->wake_lock, WAKE_LOCK_IDLE, "msm_camera");
@@ -2635,6 +2889,7 @@ static int msm_sync_init(struct msm_sync *sync,
 			sync->sdata->sensor_name);
 		wake_lock_destroy(&sync->wake_suspend_lock);
 		wake_lock_destroy(&sync->wake_lock);
+		kfree(sync->qcmd_pool.mem);
 		return rc;
 	}
 
@@ -2648,6 +2903,7 @@ static int msm_sync_destroy(struct msm_sync *sync)
 {
 	wake_lock_destroy(&sync->wake_suspend_lock);
 	wake_lock_destroy(&sync->wake_lock);
+	kfree(sync->qcmd_pool.mem);
 	return 0;
 }
 
@@ -2697,6 +2953,68 @@ static int msm_device_init(struct msm_device *pmsm,
 	return rc;
 }
 
+#if defined(CONFIG_DEBUG_FS)
+static struct dentry *msm_debugfs_dir;
+
+static int msm_stats_show(struct seq_file *m, void *unused)
+{
+	struct msm_sync *sync = m->private;
+	struct msm_pmem_region *region;
+	struct hlist_node *node;
+	unsigned frames = 0, stats = 0;
+	unsigned avg = 0;
+
+	mutex_lock(&sync->lock);
+	if (sync->opencnt) {
+		hlist_for_each_entry(region, node, &sync->pmem_frames, list)
+			frames++;
+		hlist_for_each_entry(region, node, &sync->pmem_stats, list)
+			stats++;
+	}
+	mutex_unlock(&sync->lock);
+
+	if (sync->frame_count)
+		avg = div_u64(sync->frame_latency_us, sync->frame_count);
+
+	seq_printf(m, "pmem regions:  %u frame, %u stats\n", frames, stats);
+	seq_printf(m, "frames:        %u\n", sync->frame_count);
+	seq_printf(m, "lookup misses: %u\n", sync->frame_lookup_miss);
+	seq_printf(m, "latency (us):  avg %u max %u\n",
+		   avg, sync->frame_latency_max_us);
+	seq_printf(m, "frame_q:       depth %u max %u dropped %u\n",
+		   ACCESS_ONCE(sync->frame_q.head) -
+		   atomic_read(&sync->frame_q.tail),
+		   sync->frame_q.max, sync->frame_q.dropped);
+	seq_printf(m, "event_q:       depth %d max %d\n",
+		   sync->event_q.len, sync->event_q.max);
+	seq_printf(m, "pool misses:   %u\n", sync->qcmd_pool.misses);
+	return 0;
+}
+
+static int msm_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, msm_stats_show, inode->i_private);
+}
+
+static const struct file_operations msm_stats_fops = {
+	.open = msm_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void msm_debugfs_init(struct msm_sync *sync)
+{
+	if (!msm_debugfs_dir)
+		msm_debugfs_dir = debugfs_create_dir("msm_camera", NULL);
+	if (msm_debugfs_dir)
+		debugfs_create_file(sync->sdata->sensor_name, 0444,
+				    msm_debugfs_dir, sync, &msm_stats_fops);
+}
+#else
+static inline void msm_debugfs_init(struct msm_sync *sync) { }
+#endif
+
 int msm_camera_drv_start(struct platform_device *dev,
 		int (*sensor_probe)(struct msm_camera_sensor_info *,
 			struct msm_sensor_ctrl *))
@@ -2754,6 +3072,8 @@ int msm_camera_drv_start(struct platform_device *dev,
 	if (!!sync->sdata->flash_cfg)
 		msm_camera_sysfs_init(sync);
 
+	msm_debugfs_init(sync);
+
 	camera_node++;
 	list_add(&sync->list, &msm_sensors);
 	return rc;
@@ -0,0 +1,606 @@
+/* drivers/media/video/msm/msm_vfe_sim.c
+ *
+ * Copyright (c) 2009, Code Aurora Forum. All rights reserved.
+ *
+ * Derived from msm_vfe7x.c.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+/* Software model of the 7x VFE and of a sensor to go with it.
+ *
+ * The simulated VFE speaks the same command and message protocol as the
+ * QDSP VFE task: it acknowledges VFE_START_CMD/VFE_STOP_CMD, fills the
+ * preview buffers handed to it with CMD_AXI_CFG_OUT1/OUT2 at
+ * msm_vfe_sim.fps, and returns AEC/AWB and AF stats buffers at
+ * msm_vfe_sim.stats_fps.  Each preview frame gets a running sequence
+ * number in the first word of its luma plane so that dropped frames can
+ * be spotted from user space.  Snapshots are not modelled.
+ */
+
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/uaccess.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <media/msm_camera.h>
+#include <mach/camera.h>
+#include "msm_vfe7x.h"
+
+#define VFE_RESET_CMD 0
+#define VFE_START_CMD 1
+#define VFE_STOP_CMD  2
+
+#define MSG_STOP_ACK  1
+#define MSG_START_ACK 4
+#define MSG_OUTPUT1   6
+#define MSG_OUTPUT2   7
+#define MSG_STATS_AF  8
+#define MSG_STATS_WE  9
+
+#define SIM_MAX_OUT   8
+
+static unsigned fps = 30;
+module_param(fps, uint, 0644);
+static unsigned stats_fps = 10;
+module_param(stats_fps, uint, 0644);
+
+struct vfe_sim_buf {
+	uint32_t y_phy;
+	uint32_t cbcr_phy;
+	uint32_t *y_virt;
+	int busy; /* owned by msm_camera until released */
+};
+
+static struct vfe_sim {
+	spinlock_t lock;
+	struct msm_vfe_callback *resp;
+	void *syncdata;
+	int running;
+
+	struct hrtimer frame_timer;
+	struct hrtimer stats_timer;
+
+	enum vfe_resp_msg out_type;
+	struct vfe_sim_buf out[SIM_MAX_OUT];
+	int out_count;
+
+	uint32_t we_buf[NUM_WB_EXP_STAT_OUTPUT_BUFFERS];
+	int we_count;
+	uint32_t af_buf[NUM_AF_STAT_OUTPUT_BUFFERS];
+	int af_count;
+
+	/* statistics */
+	uint32_t seq;
+	unsigned frames;
+	unsigned starved; /* frame ticks with no free buffer */
+	unsigned stats;
+	unsigned ticks;
+	u64 tick_ns; /* time spent generating, including msm_camera */
+} vsim;
+
+static void vfe_sim_send(enum vfe_resp_msg type, uint32_t msg_id,
+			 const void *msg, size_t len,
+			 struct msm_vfe_phy_info *phy)
+{
+	struct msm_vfe_resp *rp;
+
+	rp = vsim.resp->vfe_alloc(sizeof(struct msm_vfe_resp) + len,
+				  vsim.syncdata, GFP_ATOMIC);
+	if (!rp) {
+		pr_err("%s: cannot allocate buffer\n", __func__);
+		return;
+	}
+
+	rp->type = type;
+	rp->evt_msg.type = MSM_CAMERA_MSG;
+	rp->evt_msg.msg_id = msg_id;
+	rp->evt_msg.len = len;
+	if (len) {
+		rp->evt_msg.data = rp + 1;
+		memcpy(rp->evt_msg.data, msg, len);
+	}
+	if (phy)
+		rp->phy = *phy;
+
+	vsim.resp->vfe_resp(rp, MSM_CAM_Q_VFE_MSG, vsim.syncdata, GFP_ATOMIC);
+}
+
+/* Pop the oldest entry of a stats buffer list, 0 if it is empty. */
+static uint32_t vfe_sim_take(uint32_t *bufs, int *count)
+{
+	uint32_t addr;
+
+	if (!*count)
+		return 0;
+	addr = bufs[0];
+	memmove(bufs, bufs + 1, --(*count) * sizeof(*bufs));
+	return addr;
+}
+
+static void vfe_sim_give(uint32_t *bufs, int *count, int max, uint32_t addr)
+{
+	if (*count < max)
+		bufs[(*count)++] = addr;
+}
+
+static void vfe_sim_account(ktime_t start)
+{
+	vsim.ticks++;
+	vsim.tick_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static enum hrtimer_restart vfe_sim_frame(struct hrtimer *timer)
+{
+	ktime_t start = ktime_get();
+	struct vfe_endframe msg;
+	struct msm_vfe_phy_info phy;
+	struct vfe_sim_buf *buf = NULL;
+	int i;
+
+	spin_lock(&vsim.lock);
+	if (!vsim.running) {
+		spin_unlock(&vsim.lock);
+		return HRTIMER_NORESTART;
+	}
+	for (i = 0; i < vsim.out_count; i++)
+		if (!vsim.out[i].busy) {
+			buf = &vsim.out[i];
+			buf->busy = 1;
+			break;
+		}
+	if (!buf)
+		vsim.starved++;
+	spin_unlock(&vsim.lock);
+
+	if (buf) {
+		*buf->y_virt = vsim.seq++;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.y_address = buf->y_phy;
+		msg.cbcr_address = buf->cbcr_phy;
+		memset(&phy, 0, sizeof(phy));
+		phy.y_phy = buf->y_phy;
+		phy.cbcr_phy = buf->cbcr_phy;
+
+		vfe_sim_send(vsim.out_type,
+			     vsim.out_type == VFE_MSG_OUTPUT1 ?
+				MSG_OUTPUT1 : MSG_OUTPUT2,
+			     &msg, sizeof(msg), &phy);
+		vsim.frames++;
+	}
+
+	vfe_sim_account(start);
+	hrtimer_forward_now(timer, ktime_set(0, NSEC_PER_SEC / (fps ?: 1)));
+	return HRTIMER_RESTART;
+}
+
+static enum hrtimer_restart vfe_sim_stats(struct hrtimer *timer)
+{
+	ktime_t start = ktime_get();
+	struct msm_vfe_phy_info phy;
+	uint32_t we, af;
+
+	spin_lock(&vsim.lock);
+	if (!vsim.running) {
+		spin_unlock(&vsim.lock);
+		return HRTIMER_NORESTART;
+	}
+	we = vfe_sim_take(vsim.we_buf, &vsim.we_count);
+	af = vfe_sim_take(vsim.af_buf, &vsim.af_count);
+	spin_unlock(&vsim.lock);
+
+	memset(&phy, 0, sizeof(phy));
+	if (we) {
+		phy.sbuf_phy = we;
+		vfe_sim_send(VFE_MSG_STATS_WE, MSG_STATS_WE,
+			     &we, sizeof(we), &phy);
+		vsim.stats++;
+	}
+	if (af) {
+		phy.sbuf_phy = af;
+		vfe_sim_send(VFE_MSG_STATS_AF, MSG_STATS_AF,
+			     &af, sizeof(af), &phy);
+		vsim.stats++;
+	}
+
+	vfe_sim_account(start);
+	hrtimer_forward_now(timer,
+			    ktime_set(0, NSEC_PER_SEC / (stats_fps ?: 1)));
+	return HRTIMER_RESTART;
+}
+
+static void vfe_sim_start(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&vsim.lock, flags);
+	vsim.running = 1;
+	spin_unlock_irqrestore(&vsim.lock, flags);
+
+	vfe_sim_send(VFE_MSG_GENERAL, MSG_START_ACK, NULL, 0, NULL);
+	hrtimer_start(&vsim.frame_timer,
+		      ktime_set(0, NSEC_PER_SEC / (fps ?: 1)),
+		      HRTIMER_MODE_REL);
+	if (stats_fps)
+		hrtimer_start(&vsim.stats_timer,
+			      ktime_set(0, NSEC_PER_SEC / stats_fps),
+			      HRTIMER_MODE_REL);
+}
+
+static void vfe_sim_stop(int ack)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&vsim.lock, flags);
+	vsim.running = 0;
+	spin_unlock_irqrestore(&vsim.lock, flags);
+
+	hrtimer_cancel(&vsim.frame_timer);
+	hrtimer_cancel(&vsim.stats_timer);
+	if (ack)
+		vfe_sim_send(VFE_MSG_GENERAL, MSG_STOP_ACK, NULL, 0, NULL);
+}
+
+static int vfe_sim_general(struct msm_vfe_cfg_cmd *cmd)
+{
+	struct msm_vfe_command_7k vfecmd;
+	uint32_t header;
+
+	if (copy_from_user(&vfecmd, (void __user *)(cmd->value),
+			   sizeof(vfecmd)))
+		return -EFAULT;
+	if (vfecmd.length < sizeof(header))
+		return 0;
+	if (copy_from_user(&header, (void __user *)(vfecmd.value),
+			   sizeof(header)))
+		return -EFAULT;
+
+	switch (header) {
+	case VFE_START_CMD:
+		vfe_sim_start();
+		break;
+	case VFE_STOP_CMD:
+		vfe_sim_stop(1);
+		break;
+	default:
+		/* everything else only tunes the image pipeline */
+		break;
+	}
+	return 0;
+}
+
+static void vfe_sim_config_out(enum vfe_resp_msg type,
+			       struct msm_pmem_region *region, int count)
+{
+	unsigned long flags;
+	int i;
+
+	if (count > SIM_MAX_OUT)
+		count = SIM_MAX_OUT;
+
+	spin_lock_irqsave(&vsim.lock, flags);
+	vsim.out_type = type;
+	for (i = 0; i < count; i++, region++) {
+		vsim.out[i].y_phy = region->paddr + region->info.y_off;
+		vsim.out[i].cbcr_phy = region->paddr + region->info.cbcr_off;
+		vsim.out[i].y_virt =
+			(uint32_t *)(region->kvaddr + region->info.y_off);
+		vsim.out[i].busy = 0;
+	}
+	vsim.out_count = count;
+	spin_unlock_irqrestore(&vsim.lock, flags);
+}
+
+static void vfe_sim_config_stats(uint32_t *bufs, int *count, int max,
+				 struct axidata *axid)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&vsim.lock, flags);
+	*count = 0;
+	for (i = 0; i < axid->bufnum1 && i < max; i++)
+		bufs[(*count)++] = axid->region[i].paddr;
+	spin_unlock_irqrestore(&vsim.lock, flags);
+}
+
+static int vfe_sim_config(struct msm_vfe_cfg_cmd *cmd, void *data)
+{
+	struct axidata *axid = data;
+	unsigned long flags;
+	int i;
+
+	switch (cmd->cmd_type) {
+	case CMD_GENERAL:
+		return vfe_sim_general(cmd);
+
+	case CMD_AXI_CFG_OUT1:
+		if (!axid)
+			return -EFAULT;
+		vfe_sim_config_out(VFE_MSG_OUTPUT1, axid->region,
+				   axid->bufnum1);
+		break;
+
+	case CMD_AXI_CFG_OUT2:
+	case CMD_RAW_PICT_AXI_CFG:
+		if (!axid)
+			return -EFAULT;
+		vfe_sim_config_out(VFE_MSG_OUTPUT2, axid->region,
+				   axid->bufnum2);
+		break;
+
+	case CMD_STATS_AEC_AWB_ENABLE:
+	case CMD_STATS_AXI_CFG:
+		if (!axid)
+			return -EFAULT;
+		vfe_sim_config_stats(vsim.we_buf, &vsim.we_count,
+				     NUM_WB_EXP_STAT_OUTPUT_BUFFERS, axid);
+		break;
+
+	case CMD_STATS_AF_ENABLE:
+	case CMD_STATS_AF_AXI_CFG:
+		if (!axid)
+			return -EFAULT;
+		vfe_sim_config_stats(vsim.af_buf, &vsim.af_count,
+				     NUM_AF_STAT_OUTPUT_BUFFERS, axid);
+		break;
+
+	case CMD_STATS_DISABLE:
+		spin_lock_irqsave(&vsim.lock, flags);
+		vsim.we_count = 0;
+		vsim.af_count = 0;
+		spin_unlock_irqrestore(&vsim.lock, flags);
+		break;
+
+	case CMD_FRAME_BUF_RELEASE: {
+		struct msm_frame *b = (struct msm_frame *)(cmd->value);
+		uint32_t y_phy;
+
+		if (!data)
+			return -EFAULT;
+		y_phy = *(unsigned long *)data + b->y_off;
+
+		spin_lock_irqsave(&vsim.lock, flags);
+		for (i = 0; i < vsim.out_count; i++)
+			if (vsim.out[i].y_phy == y_phy)
+				vsim.out[i].busy = 0;
+		spin_unlock_irqrestore(&vsim.lock, flags);
+		break;
+	}
+
+	case CMD_STATS_BUF_RELEASE:
+		if (!data)
+			return -EFAULT;
+		spin_lock_irqsave(&vsim.lock, flags);
+		vfe_sim_give(vsim.we_buf, &vsim.we_count,
+			     NUM_WB_EXP_STAT_OUTPUT_BUFFERS, *(uint32_t *)data);
+		spin_unlock_irqrestore(&vsim.lock, flags);
+		break;
+
+	case CMD_STATS_AF_BUF_RELEASE:
+		if (!data)
+			return -EFAULT;
+		spin_lock_irqsave(&vsim.lock, flags);
+		vfe_sim_give(vsim.af_buf, &vsim.af_count,
+			     NUM_AF_STAT_OUTPUT_BUFFERS, *(uint32_t *)data);
+		spin_unlock_irqrestore(&vsim.lock, flags);
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int vfe_sim_enable(struct camera_enable_cmd *enable)
+{
+	return 0;
+}
+
+static int vfe_sim_disable(struct camera_enable_cmd *enable,
+			   struct platform_device *dev)
+{
+	return 0;
+}
+
+static int vfe_sim_init(struct msm_vfe_callback *presp,
+			struct platform_device *dev)
+{
+	if (!presp || !presp->vfe_resp)
+		return -EFAULT;
+
+	vsim.resp = presp;
+	vsim.running = 0;
+	vsim.out_count = 0;
+	vsim.we_count = 0;
+	vsim.af_count = 0;
+	vsim.seq = 0;
+	vsim.frames = 0;
+	vsim.starved = 0;
+	vsim.stats = 0;
+	vsim.ticks = 0;
+	vsim.tick_ns = 0;
+	return 0;
+}
+
+static void vfe_sim_release(struct platform_device *pdev)
+{
+	struct msm_sync *sync = vsim.syncdata;
+
+	vfe_sim_stop(0);
+	vsim.syncdata = NULL;
+
+	if (sync && sync->sctrl.s_release)
+		sync->sctrl.s_release();
+}
+
+void msm_camvfe_fn_init(struct msm_camvfe_fn *fptr, void *data)
+{
+	fptr->vfe_init = vfe_sim_init;
+	fptr->vfe_enable = vfe_sim_enable;
+	fptr->vfe_config = vfe_sim_config;
+	fptr->vfe_disable = vfe_sim_disable;
+	fptr->vfe_release = vfe_sim_release;
+	vsim.syncdata = data;
+}
+
+/* ------------------- sensor --------------------- */
+
+static int sim_sensor_init(struct msm_camera_sensor_info *data)
+{
+	return 0;
+}
+
+static int sim_sensor_release(void)
+{
+	return 0;
+}
+
+static int sim_sensor_config(void __user *argp)
+{
+	struct sensor_cfg_data cdata;
+
+	if (copy_from_user(&cdata, argp, sizeof(cdata)))
+		return -EFAULT;
+
+	switch (cdata.cfgtype) {
+	case CFG_GET_PICT_FPS:
+		cdata.cfg.gfps.pictfps = cdata.cfg.gfps.prevfps;
+		break;
+	case CFG_GET_PREV_L_PF:
+	case CFG_GET_PICT_L_PF:
+		cdata.cfg.prevl_pf = 480;
+		break;
+	case CFG_GET_PREV_P_PL:
+	case CFG_GET_PICT_P_PL:
+		cdata.cfg.prevp_pl = 640;
+		break;
+	case CFG_GET_PICT_MAX_EXP_LC:
+		cdata.cfg.pict_max_exp_lc = 480;
+		break;
+	case CFG_GET_AF_MAX_STEPS:
+		cdata.max_steps = 0;
+		break;
+	default:
+		/* the synthetic image ignores all settings */
+		return 0;
+	}
+
+	if (copy_to_user(argp, &cdata, sizeof(cdata)))
+		return -EFAULT;
+	return 0;
+}
+
+static int sim_sensor_probe(struct msm_camera_sensor_info *info,
+			    struct msm_sensor_ctrl *s)
+{
+	s->s_init = sim_sensor_init;
+	s->s_release = sim_sensor_release;
+	s->s_config = sim_sensor_config;
+	return 0;
+}
+
+static void sim_gpio(void)
+{
+}
+
+static struct msm_camera_device_platform_data sim_camera_device_data = {
+	.camera_gpio_on = sim_gpio,
+	.camera_gpio_off = sim_gpio,
+};
+
+static struct msm_camera_sensor_info sim_sensor_data = {
+	.sensor_name = "vfe_sim",
+	.pdata = &sim_camera_device_data,
+};
+
+static struct platform_device sim_camera_device = {
+	.name = "msm_camera_sim",
+	.dev = {
+		.platform_data = &sim_sensor_data,
+	},
+};
+
+static int __sim_sensor_probe(struct platform_device *pdev)
+{
+	return msm_camera_drv_start(pdev, sim_sensor_probe);
+}
+
+static struct platform_driver sim_camera_driver = {
+	.probe = __sim_sensor_probe,
+	.driver = {
+		.name = "msm_camera_sim",
+		.owner = THIS_MODULE,
+	},
+};
+
+#if defined(CONFIG_DEBUG_FS)
+static int vfe_sim_stats_show(struct seq_file *m, void *unused)
+{
+	unsigned cost = 0;
+
+	if (vsim.ticks)
+		cost = div_u64(vsim.tick_ns, vsim.ticks);
+
+	seq_printf(m, "running:       %d\n", vsim.running);
+	seq_printf(m, "rate:          %u fps, stats %u fps\n", fps, stats_fps);
+	seq_printf(m, "frames:        %u\n", vsim.frames);
+	seq_printf(m, "starved:       %u\n", vsim.starved);
+	seq_printf(m, "stats:         %u\n", vsim.stats);
+	seq_printf(m, "tick cost:     %u ns\n", cost);
+	return 0;
+}
+
+static int vfe_sim_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vfe_sim_stats_show, NULL);
+}
+
+static const struct file_operations vfe_sim_stats_fops = {
+	.open = vfe_sim_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+#endif
+
+static int __init vfe_sim_module_init(void)
+{
+	int rc;
+
+	spin_lock_init(&vsim.lock);
+	hrtimer_init(&vsim.frame_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	vsim.frame_timer.function = vfe_sim_frame;
+	hrtimer_init(&vsim.stats_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	vsim.stats_timer.function = vfe_sim_stats;
+
+#if defined(CONFIG_DEBUG_FS)
+	debugfs_create_file("msm_vfe_sim", 0444, NULL, NULL,
+			    &vfe_sim_stats_fops);
+#endif
+
+	rc = platform_driver_register(&sim_camera_driver);
+	if (rc < 0)
+		return rc;
+	return platform_device_register(&sim_camera_device);
+}
+
+module_init(vfe_sim_module_init);
@@ -36,6 +36,9 @@
 #include <linux/io.h>
 #include <linux/memory.h>
 #include <linux/wakelock.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #include <asm/cacheflush.h>
 #include <asm/div64.h>
@@ -71,6 +74,7 @@ static unsigned int msmsdcc_4bit = 1;
 static unsigned int msmsdcc_pwrsave = 1;
 static unsigned int msmsdcc_sdioirq = 1;
 static unsigned int msmsdcc_piopoll = 0;
+static unsigned int msmsdcc_adaptive = 1;
 static unsigned long msmsdcc_irqtime = 0;
 
 #define PIO_SPINMAX 30
@@ -205,6 +209,67 @@ static char *mmc_type_str(unsigned int slot_type)
 	}
 }
 
+static inline int msmsdcc_xfer_bucket(unsigned int size)
+{
+	if (size < 64)
+		return 0;
+	return min(ilog2(size) - 5, MSMSDCC_XFER_BUCKETS - 1);
+}
+
+static void
+msmsdcc_record_xfer(struct msmsdcc_host *host, struct mmc_data *data,
+		    u64 ns)
+{
+	struct msmsdcc_stats *st = &host->stats;
+	int path = host->curr.xfer_path;
+	struct msmsdcc_xfer_path *xp;
+	u32 us = (u32)div_u64(ns, NSEC_PER_USEC);
+	int lat;
+
+	xp = &st->xfer[msmsdcc_xfer_bucket(data->blksz * data->blocks)]
+		.path[path];
+	/* time the CPU spent copying (or spinning on) the FIFO counts on
+	 * top of the latency, so polled PIO only wins when it pays off */
+	ns += host->curr.pio_ns;
+	if (ns > 0xffffffff)
+		ns = 0xffffffff;
+	if (xp->count++)
+		xp->avg_ns = xp->avg_ns - (xp->avg_ns >> 3) + ((u32)ns >> 3);
+	else
+		xp->avg_ns = ns;
+
+	lat = us < 16 ? 0 : min(ilog2(us) - 3, MSMSDCC_LAT_BUCKETS - 1);
+	st->lat_hist[path][lat]++;
+}
+
+static void
+msmsdcc_account_req(struct msmsdcc_host *host, struct mmc_request *mrq)
+{
+	struct msmsdcc_stats *st = &host->stats;
+	u64 ns;
+
+	st->req_end = ktime_get();
+	ns = ktime_to_ns(ktime_sub(st->req_end, st->req_start));
+	st->busy_ns += ns;
+	if (mrq->data) {
+		st->bytes += mrq->data->bytes_xfered;
+		if (!mrq->cmd->error && !mrq->data->error)
+			msmsdcc_record_xfer(host, mrq->data, ns);
+	}
+}
+
+static void
+msmsdcc_unprepare_dma(struct msmsdcc_host *host)
+{
+	if (!host->dma.prepared)
+		return;
+	dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg, host->dma.num_ents,
+		     host->dma.dir);
+	host->dma.sg = NULL;
+	host->dma.num_ents = 0;
+	host->dma.prepared = NULL;
+}
+
 static void
 msmsdcc_request_end(struct msmsdcc_host *host, struct mmc_request *mrq)
 {
@@ -213,8 +278,12 @@ msmsdcc_request_end(struct msmsdcc_host *host, struct mmc_request *mrq)
 	host->curr.mrq = NULL;
 	host->curr.cmd = NULL;
 
+	/* the command failed before its data phase started */
+	msmsdcc_unprepare_dma(host);
+
 	if (mrq->data)
 		mrq->data->bytes_xfered = host->curr.data_xfered;
+	msmsdcc_account_req(host, mrq);
 	if (mrq->cmd->error == -ETIMEDOUT)
 		mdelay(5);
 
@@ -351,6 +420,7 @@ msmsdcc_dma_complete_func(struct msm_dmov_cmd *cmd,
 			host->curr.mrq = NULL;
 			host->curr.cmd = NULL;
 			mrq->data->bytes_xfered = host->curr.data_xfered;
+			msmsdcc_account_req(host, mrq);
 
 			spin_unlock_irqrestore(&host->lock, flags);
 #ifdef CONFIG_MMC_BUSCLK_PWRSAVE
@@ -382,6 +452,44 @@ static int validate_dma(struct msmsdcc_host *host, struct mmc_data *data)
 	return 0;
 }
 
+/*
+ * Pick how to move the data of a request.  Small transfers (SDIO
+ * register and short block accesses) use whichever of polled PIO, irq
+ * driven PIO and DMA has been cheapest for their size on this host,
+ * re-measuring the others now and then; larger ones always use DMA
+ * when the transfer allows it.  The cost of a path is its request
+ * latency plus the CPU time spent in the PIO handler, so busy-waiting
+ * is not mistaken for being cheap.
+ */
+static int
+msmsdcc_pick_xfer(struct msmsdcc_host *host, struct mmc_data *data)
+{
+	unsigned int size = data->blksz * data->blocks;
+	int pio = msmsdcc_piopoll ? MSMSDCC_XFER_PIO_POLL :
+				    MSMSDCC_XFER_PIO_IRQ;
+	struct msmsdcc_xfer_bucket *xb;
+	int paths, best, i;
+
+	paths = validate_dma(host, data) ? MSMSDCC_XFER_DMA :
+					   MSMSDCC_XFER_PATHS;
+	if (!host->adaptive || size > MSMSDCC_ADAPT_MAX)
+		return paths == MSMSDCC_XFER_PATHS ? MSMSDCC_XFER_DMA : pio;
+
+	xb = &host->stats.xfer[msmsdcc_xfer_bucket(size)];
+	for (i = 0; i < paths; i++)
+		if (xb->path[i].count < MSMSDCC_ADAPT_MIN)
+			return i;
+
+	if (++xb->picks % MSMSDCC_ADAPT_PROBE == 0)
+		return (xb->picks / MSMSDCC_ADAPT_PROBE) % paths;
+
+	best = 0;
+	for (i = 1; i < paths; i++)
+		if (xb->path[i].avg_ns < xb->path[best].avg_ns)
+			best = i;
+	return best;
+}
+
 static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 {
 	struct msmsdcc_nc_dmadata *nc;
@@ -555,9 +663,16 @@ msmsdcc_start_data(struct msmsdcc_host *host, struct mmc_data *data,
 
 	datactrl = MCI_DPSM_ENABLE | (data->blksz << 4);
 
-	if (!msmsdcc_config_dma(host, data))
+	if (host->dma.prepared == data) {
+		host->dma.prepared = NULL;
+		datactrl |= MCI_DPSM_DMAENABLE;
+	} else if (host->curr.xfer_path == MSMSDCC_XFER_DMA &&
+		   !msmsdcc_config_dma(host, data))
 		datactrl |= MCI_DPSM_DMAENABLE;
 	else {
+		if (host->curr.xfer_path == MSMSDCC_XFER_DMA)
+			host->curr.xfer_path = MSMSDCC_XFER_PIO_IRQ;
+
 		host->pio.sg = data->sg;
 		host->pio.sg_len = data->sg_len;
 		host->pio.sg_off = 0;
@@ -757,6 +872,7 @@ msmsdcc_pio_irq(int irq, void *dev_id)
 {
 	struct msmsdcc_host	*host = dev_id;
 	uint32_t		status;
+	ktime_t			start = ktime_get();
 
 	status = msmsdcc_readl(host, MMCISTATUS);
 #if IRQ_DEBUG
@@ -801,7 +917,8 @@ msmsdcc_pio_irq(int irq, void *dev_id)
 		char *buffer;
 
 		if (!(status & (MCI_TXFIFOHALFEMPTY | MCI_RXDATAAVLBL))) {
-			if (host->curr.xfer_remain == 0 || !msmsdcc_piopoll)
+			if (host->curr.xfer_remain == 0 ||
+			    host->curr.xfer_path != MSMSDCC_XFER_PIO_POLL)
 				break;
 
 			if (msmsdcc_spin_on_status(host,
@@ -857,6 +974,7 @@ msmsdcc_pio_irq(int irq, void *dev_id)
 	if (!host->curr.xfer_remain)
 		msmsdcc_writel(host, 0, MMCIMASK1);
 
+	host->curr.pio_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
 	return IRQ_HANDLED;
 }
 
@@ -1037,7 +1155,9 @@ static void
 msmsdcc_request(struct mmc_host *mmc, struct mmc_request *mrq)
 {
 	struct msmsdcc_host *host = mmc_priv(mmc);
+	struct msmsdcc_stats	*st = &host->stats;
 	unsigned long		flags;
+	u64			gap;
 
 	WARN_ON(host->curr.mrq != NULL);
 
@@ -1045,7 +1165,15 @@ msmsdcc_request(struct mmc_host *mmc, struct mmc_request *mrq)
 
 	spin_lock_irqsave(&host->lock, flags);
 
-	host->stats.reqs++;
+	st->reqs++;
+	st->req_start = ktime_get();
+	if (ktime_to_ns(st->req_end)) {
+		gap = ktime_to_ns(ktime_sub(st->req_start, st->req_end));
+		st->gap_ns += gap;
+		if (gap > st->gap_max_ns)
+			st->gap_max_ns = gap;
+		st->gaps++;
+	}
 
 	if (host->eject) {
 		if (mrq->data && !(mrq->data->flags & MMC_DATA_READ)) {
@@ -1063,12 +1191,27 @@ msmsdcc_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	msmsdcc_enable_clocks(host);
 
 	host->curr.mrq = mrq;
+	host->curr.pio_ns = 0;
+	if (mrq->data)
+		host->curr.xfer_path = msmsdcc_pick_xfer(host, mrq->data);
 
 	if (mrq->data && mrq->data->flags & MMC_DATA_READ)
 		/* Queue/read data, daisy-chain command when data starts */
 		msmsdcc_start_data(host, mrq->data, mrq->cmd, 0);
-	else
+	else {
+		/*
+		 * Writes only start their data phase from the command
+		 * response interrupt.  Build the DM command list and map
+		 * the sg now so that only the enqueue is left by then.
+		 */
+		if (mrq->data &&
+		    host->curr.xfer_path == MSMSDCC_XFER_DMA &&
+		    !msmsdcc_config_dma(host, mrq->data)) {
+			host->dma.prepared = mrq->data;
+			st->dma_prepared++;
+		}
 		msmsdcc_start_command(host, mrq->cmd, 0);
+	}
 
 	if (host->cmdpoll && !msmsdcc_spin_on_status(host,
 				MCI_CMDRESPEND|MCI_CMDCRCFAIL|MCI_CMDTIMEOUT,
@@ -1394,6 +1537,7 @@ msmsdcc_probe(struct platform_device *pdev)
 	host->curr.cmd = NULL;
 
 	host->cmdpoll = 1;
+	host->adaptive = msmsdcc_adaptive;
 
 	host->base = ioremap(memres->start, PAGE_SIZE);
 	if (!host->base) {
@@ -1705,6 +1849,18 @@ static int __init msmsdcc_nopiopoll_setup(char *__unused)
 	return 1;
 }
 
+static int __init msmsdcc_adaptive_setup(char *__unused)
+{
+	msmsdcc_adaptive = 1;
+	return 1;
+}
+
+static int __init msmsdcc_noadaptive_setup(char *__unused)
+{
+	msmsdcc_adaptive = 0;
+	return 1;
+}
+
 static int __init msmsdcc_pwrsave_setup(char *__unused)
 {
 	msmsdcc_pwrsave = 1;
@@ -1771,6 +1927,8 @@ __setup("msmsdcc_fmin=", msmsdcc_fmin_setup);
 __setup("msmsdcc_fmax=", msmsdcc_fmax_setup);
 __setup("msmsdcc_piopoll", msmsdcc_piopoll_setup);
 __setup("msmsdcc_nopiopoll", msmsdcc_nopiopoll_setup);
+__setup("msmsdcc_adaptive", msmsdcc_adaptive_setup);
+__setup("msmsdcc_noadaptive", msmsdcc_noadaptive_setup);
 
 module_init(msmsdcc_init);
 module_exit(msmsdcc_exit);
@@ -1827,8 +1985,22 @@ msmsdcc_dbg_state_read(struct file *file, char __user *ubuf,
 	i += scnprintf(buf + i, max - i, "CmdPoll  : %d\n", host->cmdpoll);
 	i += scnprintf(buf + i, max - i, "PollHit  : %u\n",
 		       host->stats.cmdpoll_hits);
-	i += scnprintf(buf + i, max - i, "PollMiss : %u\n\n",
+	i += scnprintf(buf + i, max - i, "PollMiss : %u\n",
 		       host->stats.cmdpoll_misses);
+	i += scnprintf(buf + i, max - i, "DmaPrep  : %u\n",
+		       host->stats.dma_prepared);
+	i += scnprintf(buf + i, max - i, "Bytes    : %llu\n",
+		       host->stats.bytes);
+	i += scnprintf(buf + i, max - i, "KB/s     : %llu (while busy)\n",
+		       host->stats.busy_ns ?
+		       div64_u64(host->stats.bytes * (NSEC_PER_SEC >> 10),
+				 host->stats.busy_ns) : 0);
+	i += scnprintf(buf + i, max - i, "GapAvg   : %llu us\n",
+		       host->stats.gaps ?
+		       div64_u64(host->stats.gap_ns, (u64)host->stats.gaps *
+				 NSEC_PER_USEC) : 0);
+	i += scnprintf(buf + i, max - i, "GapMax   : %llu us\n\n",
+		       div_u64(host->stats.gap_max_ns, NSEC_PER_USEC));
 
 	i += scnprintf(buf + i, max - i, "DmaBusy    : %d\n", host->dma.busy);
 	i += scnprintf(buf + i, max - i, "DmaActive  : %d\n", host->dma.active);
@@ -1852,11 +2024,84 @@ static const struct file_operations msmsdcc_dbg_state_ops = {
 	.open	= msmsdcc_dbg_state_open,
 };
 
+static const char *msmsdcc_xfer_names[MSMSDCC_XFER_PATHS] = {
+	"pio_poll", "pio_irq", "dma"
+};
+
+static ssize_t
+msmsdcc_dbg_xfer_read(struct file *file, char __user *ubuf,
+		      size_t count, loff_t *ppos)
+{
+	struct msmsdcc_host *host = (struct msmsdcc_host *) file->private_data;
+	struct msmsdcc_stats *st = &host->stats;
+	const int max = 2048;
+	char *buf;
+	int b, p, i = 0;
+	ssize_t ret;
+
+	buf = kmalloc(max, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	i += scnprintf(buf + i, max - i, "adaptive %u\n", host->adaptive);
+	i += scnprintf(buf + i, max - i, "size     ");
+	for (p = 0; p < MSMSDCC_XFER_PATHS; p++)
+		i += scnprintf(buf + i, max - i, " %7s count/cost us",
+			       msmsdcc_xfer_names[p]);
+	i += scnprintf(buf + i, max - i, "\n");
+	for (b = 0; b < MSMSDCC_XFER_BUCKETS; b++) {
+		if (b == MSMSDCC_XFER_BUCKETS - 1)
+			i += scnprintf(buf + i, max - i, ">=%-7u", 32 << b);
+		else
+			i += scnprintf(buf + i, max - i, "<%-8u", 64 << b);
+		for (p = 0; p < MSMSDCC_XFER_PATHS; p++)
+			i += scnprintf(buf + i, max - i, " %12u/%-8u",
+				       st->xfer[b].path[p].count,
+				       st->xfer[b].path[p].avg_ns /
+				       NSEC_PER_USEC);
+		i += scnprintf(buf + i, max - i, "\n");
+	}
+
+	i += scnprintf(buf + i, max - i, "\nlatency  ");
+	for (p = 0; p < MSMSDCC_XFER_PATHS; p++)
+		i += scnprintf(buf + i, max - i, " %10s",
+			       msmsdcc_xfer_names[p]);
+	i += scnprintf(buf + i, max - i, "\n");
+	for (b = 0; b < MSMSDCC_LAT_BUCKETS; b++) {
+		if (b == MSMSDCC_LAT_BUCKETS - 1)
+			i += scnprintf(buf + i, max - i, ">=%-5uus", 8 << b);
+		else
+			i += scnprintf(buf + i, max - i, "<%-6uus", 16 << b);
+		for (p = 0; p < MSMSDCC_XFER_PATHS; p++)
+			i += scnprintf(buf + i, max - i, " %10u",
+				       st->lat_hist[p][b]);
+		i += scnprintf(buf + i, max - i, "\n");
+	}
+
+	ret = simple_read_from_buffer(ubuf, count, ppos, buf, i);
+	kfree(buf);
+	return ret;
+}
+
+static const struct file_operations msmsdcc_dbg_xfer_ops = {
+	.read	= msmsdcc_dbg_xfer_read,
+	.open	= msmsdcc_dbg_state_open,
+};
+
 static void msmsdcc_dbg_createhost(struct msmsdcc_host *host)
 {
+	char name[32];
+
 	if (debugfs_dir) {
 		debugfs_create_file(mmc_hostname(host->mmc), 0644, debugfs_dir,
 				    host, &msmsdcc_dbg_state_ops);
+		snprintf(name, sizeof(name), "%s-xfer",
+			 mmc_hostname(host->mmc));
+		debugfs_create_file(name, 0444, debugfs_dir, host,
+				    &msmsdcc_dbg_xfer_ops);
+		snprintf(name, sizeof(name), "%s-adaptive",
+			 mmc_hostname(host->mmc));
+		debugfs_create_u32(name, 0644, debugfs_dir, &host->adaptive);
 	}
 }
 
@@ -174,6 +174,9 @@ struct msmsdcc_dma_data {
 	struct msmsdcc_host		*host;
 	int				busy; /* Set if DM is busy */
 	int				active;
+	/* data whose command list was built and sg mapped before its
+	 * command was sent */
+	struct mmc_data			*prepared;
 };
 
 struct msmsdcc_pio_data {
@@ -182,6 +185,36 @@ struct msmsdcc_pio_data {
 	unsigned int		sg_off;
 };
 
+/* ways of moving the data of a request */
+enum {
+	MSMSDCC_XFER_PIO_POLL,	/* PIO, irq handler spins on the FIFO */
+	MSMSDCC_XFER_PIO_IRQ,	/* PIO, one irq per half FIFO */
+	MSMSDCC_XFER_DMA,
+	MSMSDCC_XFER_PATHS,
+};
+
+/* transfer sizes <64, <128, ... <4096 bytes and larger */
+#define MSMSDCC_XFER_BUCKETS	8
+/* request latencies <16, <32, ... <1024 us and longer */
+#define MSMSDCC_LAT_BUCKETS	8
+
+/* transfers up to this size pick their path from measured cost */
+#define MSMSDCC_ADAPT_MAX	4096
+/* samples each path gets before the cheapest one is preferred */
+#define MSMSDCC_ADAPT_MIN	4
+/* after that, every Nth transfer in a bucket re-measures another path */
+#define MSMSDCC_ADAPT_PROBE	32
+
+struct msmsdcc_xfer_path {
+	unsigned int	count;
+	u32		avg_ns;		/* moving average of latency + CPU */
+};
+
+struct msmsdcc_xfer_bucket {
+	struct msmsdcc_xfer_path path[MSMSDCC_XFER_PATHS];
+	unsigned int	picks;
+};
+
 struct msmsdcc_curr_req {
 	struct mmc_request	*mrq;
 	struct mmc_command	*cmd;
@@ -192,6 +225,8 @@ struct msmsdcc_curr_req {
 	int			got_dataend;
 	int			got_datablkend;
 	int			user_pages;
+	int			xfer_path;	/* MSMSDCC_XFER_* */
+	u64			pio_ns;		/* CPU time in the PIO irq */
 };
 
 struct msmsdcc_stats {
@@ -199,6 +234,17 @@ struct msmsdcc_stats {
 	unsigned int cmds;
 	unsigned int cmdpoll_hits;
 	unsigned int cmdpoll_misses;
+	unsigned int dma_prepared;	/* dma set up ahead of the command */
+	u64 bytes;
+	u64 busy_ns;		/* request start to completion */
+	u64 gap_ns;		/* completion to next request start */
+	u64 gap_max_ns;
+	unsigned int gaps;
+	ktime_t req_start;
+	ktime_t req_end;
+
+	struct msmsdcc_xfer_bucket xfer[MSMSDCC_XFER_BUCKETS];
+	unsigned int lat_hist[MSMSDCC_XFER_PATHS][MSMSDCC_LAT_BUCKETS];
 };
 
 struct msmsdcc_host {
@@ -236,6 +282,7 @@ struct msmsdcc_host {
 	struct msmsdcc_dma_data	dma;
 	struct msmsdcc_pio_data	pio;
 	int			cmdpoll;
+	u32			adaptive;	/* pick PIO/DMA per size */
 	struct msmsdcc_stats	stats;
 
 #ifdef CONFIG_MMC_MSM7X00A_RESUME_IN_WQ
@@ -25,6 +25,8 @@
 #include <linux/wait.h>
 #include <linux/err.h>
 #include <linux/interrupt.h>
+#include <linux/moduleparam.h>
+#include <linux/debugfs.h>
 
 #include <linux/types.h>
 #include <linux/device.h>
@@ -36,11 +38,32 @@
 
 #include "f_adb.h"
 
-#define BULK_BUFFER_SIZE           4096
+#define BULK_BUFFER_SIZE           16384
+#define BULK_BUFFER_MAX            65536
+/* OUT requests only complete when full or on a short packet, and hosts
+ * send adb payloads of up to 4096 bytes without a ZLP, so OUT requests
+ * must not be larger than that */
+#define BULK_OUT_SIZE              4096
 
 /* number of rx and tx requests to allocate */
-#define RX_REQ_MAX 4
-#define TX_REQ_MAX 4
+#define RX_REQ_DEFAULT 4
+#define TX_REQ_DEFAULT 8
+#define REQ_MAX 32
+
+/* IN request size and queue depths, read when the function is bound.
+ * More and larger requests keep the endpoint busy while adbd is
+ * copying; the UDC has to accept requests of this size. */
+static unsigned int adb_buffer_size = BULK_BUFFER_SIZE;
+module_param(adb_buffer_size, uint, S_IRUGO);
+MODULE_PARM_DESC(adb_buffer_size, "size of each bulk IN request (bytes)");
+
+static unsigned int adb_rx_reqs = RX_REQ_DEFAULT;
+module_param(adb_rx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(adb_rx_reqs, "number of OUT requests");
+
+static unsigned int adb_tx_reqs = TX_REQ_DEFAULT;
+module_param(adb_tx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(adb_tx_reqs, "number of IN requests");
 
 static const char shortname[] = "android_adb";
 
@@ -70,6 +93,22 @@ struct adb_dev {
 	struct usb_request *read_req;
 	unsigned char *read_buf;
 	unsigned read_count;
+
+	/* bulk request size and number, fixed at bind */
+	unsigned bulk_size;
+	unsigned rx_size;
+	unsigned rx_reqs;
+	unsigned tx_reqs;
+
+	/* counters for debugfs */
+	unsigned long rx_bytes;
+	unsigned long tx_bytes;
+	unsigned long rx_queued;
+	unsigned long tx_queued;
+	/* adb_read found no completed request, adb_write no idle one */
+	unsigned long rx_waits;
+	unsigned long tx_waits;
+	struct dentry *debugfs;
 };
 
 static struct usb_interface_descriptor adb_interface_desc = {
@@ -261,17 +300,23 @@ static int __init create_bulk_endpoints(struct adb_dev *dev,
 	DBG(cdev, "usb_ep_autoconfig for adb ep_out got %s\n", ep->name);
 	dev->ep_out = ep;
 
+	dev->bulk_size = clamp_t(unsigned, adb_buffer_size, 512,
+				 BULK_BUFFER_MAX) & ~511;
+	dev->rx_size = BULK_OUT_SIZE;
+	dev->rx_reqs = clamp_t(unsigned, adb_rx_reqs, 1, REQ_MAX);
+	dev->tx_reqs = clamp_t(unsigned, adb_tx_reqs, 1, REQ_MAX);
+
 	/* now allocate requests for our endpoints */
-	for (i = 0; i < RX_REQ_MAX; i++) {
-		req = adb_request_new(dev->ep_out, BULK_BUFFER_SIZE);
+	for (i = 0; i < dev->rx_reqs; i++) {
+		req = adb_request_new(dev->ep_out, dev->rx_size);
 		if (!req)
 			goto fail;
 		req->complete = adb_complete_out;
 		req_put(dev, &dev->rx_idle, req);
 	}
 
-	for (i = 0; i < TX_REQ_MAX; i++) {
-		req = adb_request_new(dev->ep_in, BULK_BUFFER_SIZE);
+	for (i = 0; i < dev->tx_reqs; i++) {
+		req = adb_request_new(dev->ep_in, dev->bulk_size);
 		if (!req)
 			goto fail;
 		req->complete = adb_complete_in;
@@ -320,7 +365,7 @@ static ssize_t adb_read(struct file *fp, char __user *buf,
 		/* if we have idle read requests, get them queued */
 		while ((req = req_get(dev, &dev->rx_idle))) {
 requeue_req:
-			req->length = BULK_BUFFER_SIZE;
+			req->length = dev->rx_size;
 			ret = usb_ep_queue(dev->ep_out, req, GFP_ATOMIC);
 
 			if (ret < 0) {
@@ -330,6 +375,7 @@ requeue_req:
 				goto fail;
 			} else {
 				DBG(cdev, "rx %p queue\n", req);
+				dev->rx_queued++;
 			}
 		}
 
@@ -358,8 +404,10 @@ requeue_req:
 		}
 
 		/* wait for a request to complete */
-		req = 0;
-		ret = wait_event_interruptible(dev->read_wq,
+		req = req_get(dev, &dev->rx_done);
+		if (!req)
+			dev->rx_waits++;
+		ret = wait_event_interruptible(dev->read_wq, req ||
 			((req = req_get(dev, &dev->rx_done)) || dev->error));
 		if (req != 0) {
 			/* if we got a 0-len one we need to put it back into
@@ -372,6 +420,7 @@ requeue_req:
 			dev->read_req = req;
 			dev->read_count = req->actual;
 			dev->read_buf = req->buf;
+			dev->rx_bytes += req->actual;
 			DBG(cdev, "rx %p %d\n", req, req->actual);
 		}
 
@@ -409,8 +458,10 @@ static ssize_t adb_write(struct file *fp, const char __user *buf,
 		}
 
 		/* get an idle tx request to use */
-		req = 0;
-		ret = wait_event_interruptible(dev->write_wq,
+		req = req_get(dev, &dev->tx_idle);
+		if (!req)
+			dev->tx_waits++;
+		ret = wait_event_interruptible(dev->write_wq, req ||
 			((req = req_get(dev, &dev->tx_idle)) || dev->error));
 
 		if (ret < 0) {
@@ -419,8 +470,8 @@ static ssize_t adb_write(struct file *fp, const char __user *buf,
 		}
 
 		if (req != 0) {
-			if (count > BULK_BUFFER_SIZE)
-				xfer = BULK_BUFFER_SIZE;
+			if (count > dev->bulk_size)
+				xfer = dev->bulk_size;
 			else
 				xfer = count;
 			if (copy_from_user(req->buf, buf, xfer)) {
@@ -439,6 +490,8 @@ static ssize_t adb_write(struct file *fp, const char __user *buf,
 
 			buf += xfer;
 			count -= xfer;
+			dev->tx_bytes += xfer;
+			dev->tx_queued++;
 
 			/* zero this so we don't try to free it on error exit */
 			req = 0;
@@ -489,6 +542,63 @@ static struct miscdevice adb_device = {
 	.fops = &adb_fops,
 };
 
+#if defined(CONFIG_DEBUG_FS)
+static int adb_debug_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static ssize_t adb_debug_read(struct file *file, char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	struct adb_dev *dev = file->private_data;
+	char buf[512];
+	int i;
+
+	i = scnprintf(buf, sizeof(buf),
+		      "bulk_size: %u\n"
+		      "rx_size: %u\n"
+		      "rx_reqs: %u\n"
+		      "tx_reqs: %u\n"
+		      "rx_bytes: %lu\n"
+		      "tx_bytes: %lu\n"
+		      "rx_queued: %lu\n"
+		      "tx_queued: %lu\n"
+		      "rx_waits: %lu\n"
+		      "tx_waits: %lu\n",
+		      dev->bulk_size, dev->rx_size, dev->rx_reqs, dev->tx_reqs,
+		      dev->rx_bytes, dev->tx_bytes,
+		      dev->rx_queued, dev->tx_queued,
+		      dev->rx_waits, dev->tx_waits);
+	return simple_read_from_buffer(ubuf, count, ppos, buf, i);
+}
+
+static const struct file_operations adb_debug_ops = {
+	.open = adb_debug_open,
+	.read = adb_debug_read,
+};
+
+static void adb_debugfs_init(struct adb_dev *dev)
+{
+	struct dentry *dent;
+
+	dent = debugfs_create_file("adb", 0444, NULL, dev, &adb_debug_ops);
+	if (IS_ERR(dent))
+		return;
+	dev->debugfs = dent;
+}
+
+static void adb_debugfs_remove(struct adb_dev *dev)
+{
+	debugfs_remove(dev->debugfs);
+	dev->debugfs = NULL;
+}
+#else
+static void adb_debugfs_init(struct adb_dev *dev) {}
+static void adb_debugfs_remove(struct adb_dev *dev) {}
+#endif
+
 static int __init
 adb_function_bind(struct usb_configuration *c, struct usb_function *f)
 {
@@ -523,6 +633,7 @@ adb_function_bind(struct usb_configuration *c, struct usb_function *f)
 	DBG(cdev, "%s speed %s: IN/%s, OUT/%s\n",
 			gadget_is_dualspeed(c->cdev->gadget) ? "dual" : "full",
 			f->name, dev->ep_in->name, dev->ep_out->name);
+	adb_debugfs_init(dev);
 	return 0;
 }
 
@@ -543,6 +654,7 @@ adb_function_unbind(struct usb_configuration *c, struct usb_function *f)
 	dev->error = 1;
 	spin_unlock_irq(&dev->lock);
 
+	adb_debugfs_remove(dev);
 	misc_deregister(&adb_device);
 	kfree(_adb_dev);
 	_adb_dev = NULL;
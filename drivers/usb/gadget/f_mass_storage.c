@@ -68,6 +68,11 @@
 #include <linux/utsname.h>
 #include <linux/wakelock.h>
 #include <linux/platform_device.h>
+#include <linux/moduleparam.h>
+#include <linux/uio.h>
+#include <linux/pagemap.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #include <linux/usb_usual.h>
 #include <linux/usb/ch9.h>
@@ -79,7 +84,24 @@
 #include "gadget_chips.h"
 
 
-#define BULK_BUFFER_SIZE           4096
+#define BULK_BUFFER_SIZE           16384
+#define BULK_BUFFER_MAX            65536
+/* the UDC only takes OUT requests that fit a single 16K dTD */
+#define BULK_OUT_MAX               16384
+
+/* size and number of the data buffers, read when the function is bound */
+static unsigned int fsg_buffer_size = BULK_BUFFER_SIZE;
+module_param(fsg_buffer_size, uint, S_IRUGO);
+MODULE_PARM_DESC(fsg_buffer_size, "size of each data buffer (bytes)");
+
+static unsigned int fsg_num_buffers = 4;
+module_param(fsg_num_buffers, uint, S_IRUGO);
+MODULE_PARM_DESC(fsg_num_buffers, "number of data buffers (2-8)");
+
+/* how far ahead of a sequential READ stream to start backing file I/O */
+static unsigned int fsg_readahead_kb = 512;
+module_param(fsg_readahead_kb, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fsg_readahead_kb, "read-ahead for sequential reads (KB)");
 
 /*-------------------------------------------------------------------------*/
 
@@ -238,6 +260,19 @@ struct lun {
 	u32		sense_data_info;
 	u32		unit_attention_data;
 
+	/* the block after the last READ, to spot sequential streams */
+	u32		next_read_lba;
+
+	/* backing file I/O counters, see show_stats() */
+	u64		read_bytes;
+	u64		read_ns;
+	u64		write_bytes;
+	u64		write_ns;
+	unsigned long	seq_reads;
+	unsigned long	readaheads;
+	unsigned long	writes;
+	unsigned long	write_bufs;
+
 	struct device	dev;
 };
 
@@ -252,8 +287,10 @@ static struct lun *dev_to_lun(struct device *dev)
 /* Big enough to hold our biggest descriptor */
 #define EP0_BUFSIZE	256
 
-/* Number of buffers we will use.  2 is enough for double-buffering */
-#define NUM_BUFFERS	2
+/* Most buffers we will use; fsg->num_buffers of them are allocated.
+ * 2 is enough for double-buffering, more let USB run ahead of (or
+ * behind) a slow backing file. */
+#define MAX_BUFFERS	8
 
 enum fsg_buffer_state {
 	BUF_STATE_EMPTY = 0,
@@ -337,7 +374,8 @@ struct fsg_dev {
 
 	struct fsg_buffhd	*next_buffhd_to_fill;
 	struct fsg_buffhd	*next_buffhd_to_drain;
-	struct fsg_buffhd	buffhds[NUM_BUFFERS];
+	struct fsg_buffhd	buffhds[MAX_BUFFERS];
+	unsigned int		num_buffers;
 
 	int			thread_wakeup_needed;
 	struct completion	thread_notifier;
@@ -357,6 +395,9 @@ struct fsg_dev {
 	struct lun		*luns;
 	struct lun		*curlun;
 
+	/* set by a sequential READ, read ahead once its reply is sent */
+	struct lun		*readahead_lun;
+
 	u32				buf_size;
 	const char		*vendor;
 	const char		*product;
@@ -760,6 +801,34 @@ static int sleep_thread(struct fsg_dev *fsg)
 
 /*-------------------------------------------------------------------------*/
 
+static void readahead(struct lun *curlun, loff_t file_offset)
+{
+	struct file	*filp = curlun->filp;
+	pgoff_t		index = file_offset >> PAGE_CACHE_SHIFT;
+	pgoff_t		end;
+	unsigned long	nr;
+
+	nr = fsg_readahead_kb >> (PAGE_CACHE_SHIFT - 10);
+	end = (curlun->file_length + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	if (!nr || index >= end)
+		return;
+	nr = min_t(unsigned long, nr, end - index);
+	page_cache_sync_readahead(filp->f_mapping, &filp->f_ra, filp,
+				  index, nr);
+	curlun->readaheads++;
+}
+
+static void do_readahead(struct fsg_dev *fsg)
+{
+	struct lun	*curlun = fsg->readahead_lun;
+
+	fsg->readahead_lun = NULL;
+	down_read(&fsg->filesem);
+	if (backing_file_is_open(curlun))
+		readahead(curlun, (loff_t) curlun->next_read_lba << 9);
+	up_read(&fsg->filesem);
+}
+
 static int do_read(struct fsg_dev *fsg)
 {
 	struct lun		*curlun = fsg->curlun;
@@ -771,6 +840,8 @@ static int do_read(struct fsg_dev *fsg)
 	unsigned int		amount;
 	unsigned int		partial_page;
 	ssize_t			nread;
+	ktime_t			start;
+	int			sequential;
 
 	/* Get the starting Logical Block Address and check that it's
 	 * not too big */
@@ -792,6 +863,10 @@ static int do_read(struct fsg_dev *fsg)
 		return -EINVAL;
 	}
 	file_offset = ((loff_t) lba) << 9;
+	fsg->readahead_lun = NULL;
+	sequential = (lba == curlun->next_read_lba);
+	if (sequential)
+		curlun->seq_reads++;
 
 	/* Carry out the file reads */
 	amount_left = fsg->data_size_from_cmnd;
@@ -839,9 +914,11 @@ static int do_read(struct fsg_dev *fsg)
 
 		/* Perform the read */
 		file_offset_tmp = file_offset;
+		start = ktime_get();
 		nread = vfs_read(curlun->filp,
 				(char __user *) bh->buf,
 				amount, &file_offset_tmp);
+		curlun->read_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
 		VLDBG(curlun, "file read %u @ %llu -> %d\n", amount,
 				(unsigned long long) file_offset,
 				(int) nread);
@@ -860,6 +937,7 @@ static int do_read(struct fsg_dev *fsg)
 		file_offset  += nread;
 		amount_left  -= nread;
 		fsg->residue -= nread;
+		curlun->read_bytes += nread;
 		bh->inreq->length = nread;
 		bh->state = BUF_STATE_FULL;
 
@@ -871,8 +949,14 @@ static int do_read(struct fsg_dev *fsg)
 			break;
 		}
 
-		if (amount_left == 0)
+		if (amount_left == 0) {
+			/* The host is streaming: once the last buffer and
+			 * the status are on their way, start reading what
+			 * it will most likely ask for next. */
+			if (sequential)
+				fsg->readahead_lun = curlun;
 			break;		/* No more left to read */
+		}
 
 		/* Send this buffer and go read some more */
 		start_transfer(fsg, fsg->bulk_in, bh->inreq,
@@ -880,6 +964,7 @@ static int do_read(struct fsg_dev *fsg)
 		fsg->next_buffhd_to_fill = bh->next;
 	}
 
+	curlun->next_read_lba = file_offset >> 9;
 	return -EIO;		/* No default reply */
 }
 
@@ -898,6 +983,9 @@ static int do_write(struct fsg_dev *fsg)
 	unsigned int		partial_page;
 	ssize_t			nwritten;
 	int			rc;
+	struct iovec		iov[MAX_BUFFERS];
+	int			nbufs, short_packet;
+	ktime_t			start;
 
 	if (curlun->ro) {
 		curlun->sense_data = SS_WRITE_PROTECTED;
@@ -949,6 +1037,7 @@ static int do_write(struct fsg_dev *fsg)
 			 *	to write past the end of file.
 			 * Finally, round down to a block boundary. */
 			amount = min(amount_left_to_req, (u32)fsg->buf_size);
+			amount = min(amount, (u32)BULK_OUT_MAX);
 			amount = min((loff_t) amount, curlun->file_length -
 					usb_offset);
 			partial_page = usb_offset & (PAGE_CACHE_SIZE - 1);
@@ -996,31 +1085,72 @@ static int do_write(struct fsg_dev *fsg)
 			break;			/* We stopped early */
 		if (bh->state == BUF_STATE_FULL) {
 			smp_rmb();
-			fsg->next_buffhd_to_drain = bh->next;
-			bh->state = BUF_STATE_EMPTY;
 
 			/* Did something go wrong with the transfer? */
 			if (bh->outreq->status != 0) {
+				fsg->next_buffhd_to_drain = bh->next;
+				bh->state = BUF_STATE_EMPTY;
 				curlun->sense_data = SS_COMMUNICATION_FAILURE;
 				curlun->sense_data_info = file_offset >> 9;
 				curlun->info_valid = 1;
 				break;
 			}
 
-			amount = bh->outreq->actual;
-			if (curlun->file_length - file_offset < amount) {
-				LERROR(curlun,
+			/* Write every buffer that has arrived in one go.
+			 * Stop at a short packet, or at a failed transfer
+			 * which is reported on the next pass. */
+			amount = 0;
+			nbufs = 0;
+			short_packet = 0;
+			for (;;) {
+				unsigned int len = bh->outreq->actual;
+
+				if (curlun->file_length - file_offset - amount
+						< len) {
+					LERROR(curlun,
 	"write %u @ %llu beyond end %llu\n",
-	amount, (unsigned long long) file_offset,
+	len, (unsigned long long) file_offset + amount,
 	(unsigned long long) curlun->file_length);
-				amount = curlun->file_length - file_offset;
+					len = curlun->file_length -
+						file_offset - amount;
+				}
+				iov[nbufs].iov_base = bh->buf;
+				iov[nbufs].iov_len = len;
+				nbufs++;
+				amount += len;
+
+				fsg->next_buffhd_to_drain = bh->next;
+				bh->state = BUF_STATE_EMPTY;
+
+				/* Did the host decide to stop early? */
+				if (bh->outreq->actual != bh->outreq->length) {
+					short_packet = 1;
+					break;
+				}
+				bh = bh->next;
+				if (nbufs == fsg->num_buffers ||
+				    bh->state != BUF_STATE_FULL)
+					break;
+				smp_rmb();
+				if (bh->outreq->status != 0)
+					break;
 			}
 
 			/* Perform the write */
 			file_offset_tmp = file_offset;
-			nwritten = vfs_write(curlun->filp,
-					(char __user *) bh->buf,
+			start = ktime_get();
+			if (nbufs == 1)
+				nwritten = vfs_write(curlun->filp,
+					(char __user *) iov[0].iov_base,
 					amount, &file_offset_tmp);
+			else
+				nwritten = vfs_writev(curlun->filp,
+					(struct iovec __user *) iov, nbufs,
+					&file_offset_tmp);
+			curlun->write_ns += ktime_to_ns(ktime_sub(ktime_get(),
+								  start));
+			curlun->writes++;
+			curlun->write_bufs += nbufs;
 			VLDBG(curlun, "file write %u @ %llu -> %d\n", amount,
 					(unsigned long long) file_offset,
 					(int) nwritten);
@@ -1040,6 +1170,7 @@ static int do_write(struct fsg_dev *fsg)
 			file_offset += nwritten;
 			amount_left_to_write -= nwritten;
 			fsg->residue -= nwritten;
+			curlun->write_bytes += nwritten;
 
 			/* If an error occurred, report it and its position */
 			if (nwritten < amount) {
@@ -1049,8 +1180,7 @@ static int do_write(struct fsg_dev *fsg)
 				break;
 			}
 
-			/* Did the host decide to stop early? */
-			if (bh->outreq->actual != bh->outreq->length) {
+			if (short_packet) {
 				fsg->short_packet_received = 1;
 				break;
 			}
@@ -1530,6 +1660,7 @@ static int throw_away_data(struct fsg_dev *fsg)
 		bh = fsg->next_buffhd_to_fill;
 		if (bh->state == BUF_STATE_EMPTY && fsg->usb_amount_left > 0) {
 			amount = min(fsg->usb_amount_left, (u32) fsg->buf_size);
+			amount = min(amount, (u32) BULK_OUT_MAX);
 
 			/* amount is always divisible by 512, hence by
 			 * the bulk-out maxpacket size */
@@ -2160,7 +2291,7 @@ reset:
 	}
 
 	/* Deallocate the requests */
-	for (i = 0; i < NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg->num_buffers; ++i) {
 		struct fsg_buffhd *bh = &fsg->buffhds[i];
 		if (bh->inreq) {
 			usb_ep_free_request(fsg->bulk_in, bh->inreq);
@@ -2192,7 +2323,7 @@ reset:
 	fsg->bulk_out_maxpacket = le16_to_cpu(d->wMaxPacketSize);
 
 	/* Allocate the requests */
-	for (i = 0; i < NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg->num_buffers; ++i) {
 		struct fsg_buffhd	*bh = &fsg->buffhds[i];
 
 		rc = alloc_request(fsg, fsg->bulk_in, &bh->inreq);
@@ -2310,7 +2441,7 @@ static void handle_exception(struct fsg_dev *fsg)
 	 * state, and the exception.  Then invoke the handler. */
 	spin_lock_irq(&fsg->lock);
 
-	for (i = 0; i < NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg->num_buffers; ++i) {
 		bh = &fsg->buffhds[i];
 		bh->state = BUF_STATE_EMPTY;
 	}
@@ -2429,6 +2560,9 @@ static int fsg_main_thread(void *fsg_)
 		if (send_status(fsg))
 			continue;
 
+		if (fsg->readahead_lun)
+			do_readahead(fsg);
+
 		spin_lock_irq(&fsg->lock);
 		if (!exception_in_progress(fsg))
 			fsg->state = FSG_STATE_IDLE;
@@ -2629,6 +2763,34 @@ static ssize_t store_file(struct device *dev, struct device_attribute *attr,
 
 static DEVICE_ATTR(file, 0444, show_file, store_file);
 
+/* KB/s spent in the backing file, not counting USB time */
+static u64 kbps(u64 bytes, u64 ns)
+{
+	return ns ? div64_u64(bytes * (NSEC_PER_SEC >> 10), ns) : 0;
+}
+
+static ssize_t show_stats(struct device *dev, struct device_attribute *attr,
+		char *buf)
+{
+	struct lun	*curlun = dev_to_lun(dev);
+	struct fsg_dev	*fsg = dev_get_drvdata(dev);
+
+	return sprintf(buf,
+		"buffers %u x %u\n"
+		"read_bytes %llu (%llu KB/s)\n"
+		"seq_reads %lu readaheads %lu\n"
+		"write_bytes %llu (%llu KB/s)\n"
+		"writes %lu buffers %lu\n",
+		fsg->num_buffers, fsg->buf_size,
+		curlun->read_bytes, kbps(curlun->read_bytes, curlun->read_ns),
+		curlun->seq_reads, curlun->readaheads,
+		curlun->write_bytes,
+		kbps(curlun->write_bytes, curlun->write_ns),
+		curlun->writes, curlun->write_bufs);
+}
+
+static DEVICE_ATTR(stats, 0444, show_stats, NULL);
+
 /*-------------------------------------------------------------------------*/
 
 static void fsg_release(struct kref *ref)
@@ -2690,6 +2852,7 @@ fsg_function_unbind(struct usb_configuration *c, struct usb_function *f)
 	for (i = 0; i < fsg->nluns; ++i) {
 		curlun = &fsg->luns[i];
 		if (curlun->registered) {
+			device_remove_file(&curlun->dev, &dev_attr_stats);
 			device_remove_file(&curlun->dev, &dev_attr_file);
 			device_unregister(&curlun->dev);
 			curlun->registered = 0;
@@ -2706,7 +2869,7 @@ fsg_function_unbind(struct usb_configuration *c, struct usb_function *f)
 	}
 
 	/* Free the data buffers */
-	for (i = 0; i < NUM_BUFFERS; ++i)
+	for (i = 0; i < fsg->num_buffers; ++i)
 		kfree(fsg->buffhds[i].buf);
 	switch_dev_unregister(&fsg->sdev);
 }
@@ -2771,6 +2934,13 @@ fsg_function_bind(struct usb_configuration *c, struct usb_function *f)
 			device_unregister(&curlun->dev);
 			goto out;
 		}
+		rc = device_create_file(&curlun->dev, &dev_attr_stats);
+		if (rc != 0) {
+			ERROR(fsg, "device_create_file failed: %d\n", rc);
+			device_remove_file(&curlun->dev, &dev_attr_file);
+			device_unregister(&curlun->dev);
+			goto out;
+		}
 		curlun->registered = 1;
 		kref_get(&fsg->ref);
 	}
@@ -2806,7 +2976,7 @@ fsg_function_bind(struct usb_configuration *c, struct usb_function *f)
 	}
 
 	/* Allocate the data buffers */
-	for (i = 0; i < NUM_BUFFERS; ++i) {
+	for (i = 0; i < fsg->num_buffers; ++i) {
 		struct fsg_buffhd	*bh = &fsg->buffhds[i];
 
 		/* Allocate for the bulk-in endpoint.  We assume that
@@ -2817,7 +2987,7 @@ fsg_function_bind(struct usb_configuration *c, struct usb_function *f)
 			goto out;
 		bh->next = bh + 1;
 	}
-	fsg->buffhds[NUM_BUFFERS - 1].next = &fsg->buffhds[0];
+	fsg->buffhds[fsg->num_buffers - 1].next = &fsg->buffhds[0];
 
 	fsg->thread_task = kthread_create(fsg_main_thread, fsg,
 			shortname);
@@ -2930,7 +3100,11 @@ int __init mass_storage_function_add(struct usb_composite_dev *cdev,
 	kref_init(&fsg->ref);
 	init_completion(&fsg->thread_notifier);
 
-	the_fsg->buf_size = BULK_BUFFER_SIZE;
+	the_fsg->buf_size = clamp_t(unsigned int, fsg_buffer_size,
+				    PAGE_CACHE_SIZE, BULK_BUFFER_MAX) &
+			    ~(PAGE_CACHE_SIZE - 1);
+	the_fsg->num_buffers = clamp_t(unsigned int, fsg_num_buffers,
+				       2, MAX_BUFFERS);
 	the_fsg->sdev.name = DRIVER_NAME;
 	the_fsg->sdev.print_name = print_switch_name;
 	the_fsg->sdev.print_state = print_switch_state;
@@ -29,6 +29,7 @@
 #include <linux/debugfs.h>
 #include <linux/workqueue.h>
 #include <linux/clk.h>
+#include <linux/math64.h>
 
 #include <linux/usb/ch9.h>
 #include <linux/usb/gadget.h>
@@ -54,6 +55,15 @@ static const char driver_name[] = "msm72k_udc";
 
 #define SETUP_BUF_SIZE      4096
 
+/* each dTD covers five 4K pages, so 16K always fits whatever the
+ * alignment of the buffer; larger IN requests chain several dTDs.
+ * OUT requests get a single dTD: after a short packet the controller
+ * carries on into the next dTD of the same request, and whatever the
+ * host sends next would land there.
+ */
+#define DTD_MAX_BYTES       0x4000
+#define MAX_DTDS_PER_REQ    8
+
 
 static const char *const ep_name[] = {
 	"ep0out", "ep1out", "ep2out", "ep3out",
@@ -89,6 +99,15 @@ struct msm_request {
 	dma_addr_t item_dma;
 
 	struct ept_queue_item *item;
+
+	/* extra dTDs chained behind item for requests larger than
+	 * DTD_MAX_BYTES; allocated on first use, kept until freed
+	 */
+	unsigned nitems;
+	unsigned xitems;
+	struct ept_queue_item *xitem[MAX_DTDS_PER_REQ - 1];
+	dma_addr_t xitem_dma[MAX_DTDS_PER_REQ - 1];
+	struct ept_queue_item *tail;
 };
 
 #define to_msm_request(r) container_of(r, struct msm_request, req)
@@ -111,6 +130,12 @@ struct msm_endpoint {
 	/* pointers to DMA transfer list area */
 	/* these are allocated from the usb_info dma space */
 	struct ept_queue_head *head;
+
+	/* completion statistics, reported through debugfs */
+	unsigned irqs;
+	unsigned reqs;
+	unsigned dtds;
+	u64 bytes;
 };
 
 static void usb_do_work(struct work_struct *w);
@@ -166,6 +191,16 @@ struct usb_info {
 	void (*usb_connected)(int);
 
 	struct work_struct work;
+
+	/* endpoint completions are retired in batches from here,
+	** ep0 is still handled in the interrupt to keep control
+	** transfers in step with setup packets
+	*/
+	struct tasklet_struct done_tasklet;
+	unsigned done_bits;
+	unsigned done_runs;
+	unsigned done_max_batch;
+
 	unsigned phy_status;
 	unsigned phy_fail_count;
 
@@ -339,9 +374,14 @@ fail1:
 
 static void do_free_req(struct usb_info *ui, struct msm_request *req)
 {
+	unsigned n;
+
 	if (req->alloced)
 		kfree(req->req.buf);
 
+	for (n = 0; n < req->xitems; n++)
+		dma_pool_free(ui->pool, req->xitem[n], req->xitem_dma[n]);
+
 	dma_pool_free(ui->pool, req->item, req->item_dma);
 	kfree(req);
 }
@@ -400,17 +440,81 @@ static void usb_ept_start(struct msm_endpoint *ept)
 	}
 }
 
+static inline struct ept_queue_item *
+req_item(struct msm_request *req, unsigned n)
+{
+	return n ? req->xitem[n - 1] : req->item;
+}
+
+static inline dma_addr_t req_item_dma(struct msm_request *req, unsigned n)
+{
+	return n ? req->xitem_dma[n - 1] : req->item_dma;
+}
+
+/* make sure the request has enough dTDs to cover length bytes */
+static int usb_req_alloc_items(struct usb_info *ui, struct msm_endpoint *ept,
+			       struct msm_request *req, unsigned length)
+{
+	unsigned nitems = length ? DIV_ROUND_UP(length, DTD_MAX_BYTES) : 1;
+
+	if (nitems > ((ept->flags & EPT_FLAG_IN) ? MAX_DTDS_PER_REQ : 1))
+		return -EMSGSIZE;
+
+	while (req->xitems < nitems - 1) {
+		unsigned n = req->xitems;
+
+		req->xitem[n] = dma_pool_alloc(ui->pool, GFP_ATOMIC,
+					       &req->xitem_dma[n]);
+		if (!req->xitem[n])
+			return -ENOMEM;
+		req->xitems++;
+	}
+	return nitems;
+}
+
+/* build the dTD chain for a request, interrupting on the last dTD */
+static void usb_req_fill_items(struct msm_request *req, unsigned nitems)
+{
+	unsigned length = req->req.length;
+	dma_addr_t dma = req->dma;
+	unsigned n, len, info;
+
+	for (n = 0; n < nitems; n++) {
+		struct ept_queue_item *item = req_item(req, n);
+
+		len = min_t(unsigned, length, DTD_MAX_BYTES);
+		info = INFO_BYTES(len) | INFO_ACTIVE;
+		if (n == nitems - 1)
+			info |= INFO_IOC;
+
+		item->next = (n == nitems - 1) ?
+			TERMINATE : req_item_dma(req, n + 1);
+		item->info = info;
+		item->page0 = dma;
+		item->page1 = (dma + 0x1000) & 0xfffff000;
+		item->page2 = (dma + 0x2000) & 0xfffff000;
+		item->page3 = (dma + 0x3000) & 0xfffff000;
+		item->page4 = (dma + 0x4000) & 0xfffff000;
+
+		dma += len;
+		length -= len;
+	}
+	req->nitems = nitems;
+	req->tail = req_item(req, nitems - 1);
+}
+
 int usb_ept_queue_xfer(struct msm_endpoint *ept, struct usb_request *_req)
 {
 	unsigned long flags;
 	struct msm_request *req = to_msm_request(_req);
 	struct msm_request *last;
 	struct usb_info *ui = ept->ui;
-	struct ept_queue_item *item = req->item;
 	unsigned length = req->req.length;
+	int nitems;
 
-	if (length > 0x4000)
-		return -EMSGSIZE;
+	nitems = usb_req_alloc_items(ui, ept, req, length);
+	if (nitems < 0)
+		return nitems;
 
 	spin_lock_irqsave(&ui->lock, flags);
 
@@ -437,13 +541,8 @@ int usb_ept_queue_xfer(struct msm_endpoint *ept, struct usb_request *_req)
 				  (ept->flags & EPT_FLAG_IN) ?
 				  DMA_TO_DEVICE : DMA_FROM_DEVICE);
 
-	/* prepare the transaction descriptor item for the hardware */
-	item->next = TERMINATE;
-	item->info = INFO_BYTES(length) | INFO_IOC | INFO_ACTIVE;
-	item->page0 = req->dma;
-	item->page1 = (req->dma + 0x1000) & 0xfffff000;
-	item->page2 = (req->dma + 0x2000) & 0xfffff000;
-	item->page3 = (req->dma + 0x3000) & 0xfffff000;
+	/* prepare the transaction descriptor items for the hardware */
+	usb_req_fill_items(req, nitems);
 
 	/* Add the new request to the end of the queue */
 	last = ept->last;
@@ -458,7 +557,7 @@ int usb_ept_queue_xfer(struct msm_endpoint *ept, struct usb_request *_req)
 		 * that request is not live
 		 */
 		if (!last->live)
-			last->item->next = req->item_dma;
+			last->tail->next = req->item_dma;
 	} else {
 		/* queue was empty -- kick the hardware */
 		ept->req = req;
@@ -700,12 +799,45 @@ ack:
 	ep0_setup_ack(ui);
 }
 
+/* Walk the dTD chain of a live request.  Returns 0 while the hardware
+ * still owns part of it, otherwise 1 with the transferred byte count and
+ * any error bits filled in.
+ */
+static int usb_req_retired(struct msm_request *req, unsigned *actual,
+			   unsigned *errors)
+{
+	unsigned length = req->req.length;
+	unsigned n, len, left, info;
+
+	*actual = 0;
+	*errors = 0;
+
+	for (n = 0; n < req->nitems; n++) {
+		info = req_item(req, n)->info;
+		if (info & INFO_ACTIVE)
+			return 0;
+
+		len = min_t(unsigned, length, DTD_MAX_BYTES);
+		left = (info >> 16) & 0x7FFF;
+		*actual += len - left;
+		length -= len;
+
+		*errors = info &
+			(INFO_HALTED | INFO_BUFFER_ERROR | INFO_TXN_ERROR);
+		if (*errors)
+			return 1;
+	}
+	return 1;
+}
+
 static void handle_endpoint(struct usb_info *ui, unsigned bit)
 {
 	struct msm_endpoint *ept = ui->ept + bit;
 	struct msm_request *req;
+	struct msm_request *done = 0, **tail = &done;
 	unsigned long flags;
-	unsigned info;
+	unsigned actual, errors;
+	int dead;
 
 	/*
 	INFO("handle_endpoint() %d %s req=%p(%08x)\n",
@@ -716,8 +848,6 @@ static void handle_endpoint(struct usb_info *ui, unsigned bit)
 	/* expire all requests that are no longer active */
 	spin_lock_irqsave(&ui->lock, flags);
 	while ((req = ept->req)) {
-		info = req->item->info;
-
 		/* if we've processed all live requests, time to
 		 * restart the hardware on the next non-live request
 		 */
@@ -727,7 +857,7 @@ static void handle_endpoint(struct usb_info *ui, unsigned bit)
 		}
 
 		/* if the transaction is still in-flight, stop here */
-		if (info & INFO_ACTIVE)
+		if (!usb_req_retired(req, &actual, &errors))
 			break;
 
 		/* advance ept queue to the next request */
@@ -739,31 +869,74 @@ static void handle_endpoint(struct usb_info *ui, unsigned bit)
 				 (ept->flags & EPT_FLAG_IN) ?
 				 DMA_TO_DEVICE : DMA_FROM_DEVICE);
 
-		if (info & (INFO_HALTED | INFO_BUFFER_ERROR | INFO_TXN_ERROR)) {
+		if (errors) {
 			/* XXX pass on more specific error code */
 			req->req.status = -EIO;
 			req->req.actual = 0;
 			INFO("msm72k_udc: ept %d %s error. info=%08x\n",
 			       ept->num,
 			       (ept->flags & EPT_FLAG_IN) ? "in" : "out",
-			       info);
+			       errors);
 		} else {
 			req->req.status = 0;
-			req->req.actual =
-				req->req.length - ((info >> 16) & 0x7FFF);
+			req->req.actual = actual;
 		}
-		req->busy = 0;
 		req->live = 0;
-		if (req->dead)
+
+		ept->reqs++;
+		ept->dtds += req->nitems;
+		ept->bytes += req->req.actual;
+
+		/* completions run once the whole queue has been walked;
+		 * the request stays busy until then
+		 */
+		req->next = 0;
+		*tail = req;
+		tail = &req->next;
+	}
+	spin_unlock_irqrestore(&ui->lock, flags);
+
+	while ((req = done)) {
+		done = req->next;
+
+		spin_lock_irqsave(&ui->lock, flags);
+		req->busy = 0;
+		dead = req->dead;
+		spin_unlock_irqrestore(&ui->lock, flags);
+
+		if (dead)
 			do_free_req(ui, req);
+		else if (req->req.complete)
+			req->req.complete(&ept->ep, &req->req);
+	}
+}
 
-		if (req->req.complete) {
+static void usb_done_tasklet(unsigned long data)
+{
+	struct usb_info *ui = (struct usb_info *) data;
+	unsigned long flags;
+	unsigned bits, batch = 0;
+
+	for (;;) {
+		spin_lock_irqsave(&ui->lock, flags);
+		bits = ui->done_bits;
+		ui->done_bits = 0;
+		if (bits == 0) {
+			ui->done_runs++;
+			if (batch > ui->done_max_batch)
+				ui->done_max_batch = batch;
 			spin_unlock_irqrestore(&ui->lock, flags);
-			req->req.complete(&ept->ep, &req->req);
-			spin_lock_irqsave(&ui->lock, flags);
+			break;
+		}
+		spin_unlock_irqrestore(&ui->lock, flags);
+
+		while (bits) {
+			unsigned bit = __ffs(bits);
+			handle_endpoint(ui, bit);
+			bits &= ~(1 << bit);
+			batch++;
 		}
 	}
-	spin_unlock_irqrestore(&ui->lock, flags);
 }
 
 static void flush_endpoint_hw(struct usb_info *ui, unsigned bits)
@@ -837,7 +1010,7 @@ static void flush_all_endpoints(struct usb_info *ui)
 static irqreturn_t usb_interrupt(int irq, void *data)
 {
 	struct usb_info *ui = data;
-	unsigned n;
+	unsigned n, bits;
 
 	n = readl(USB_USBSTS);
 	writel(n, USB_USBSTS);
@@ -899,10 +1072,25 @@ static irqreturn_t usb_interrupt(int irq, void *data)
 
 		n = readl(USB_ENDPTCOMPLETE);
 		writel(n, USB_ENDPTCOMPLETE);
-		while (n) {
-			unsigned bit = __ffs(n);
-			handle_endpoint(ui, bit);
-			n = n & (~(1 << bit));
+
+		for (bits = n; bits; bits &= ~(1 << __ffs(bits)))
+			ui->ept[__ffs(bits)].irqs++;
+
+		/* ep0 is handled right away, the rest is retired from
+		** the tasklet so that completions queued up behind one
+		** another are handed back in a single pass
+		*/
+		if (n & EPT_RX(0))
+			handle_endpoint(ui, 0);
+		if (n & EPT_TX(0))
+			handle_endpoint(ui, 16);
+
+		n &= ~(EPT_RX(0) | EPT_TX(0));
+		if (n) {
+			spin_lock(&ui->lock);
+			ui->done_bits |= n;
+			spin_unlock(&ui->lock);
+			tasklet_schedule(&ui->done_tasklet);
 		}
 	}
 	return IRQ_HANDLED;
@@ -1225,15 +1413,26 @@ static ssize_t debug_read_status(struct file *file, char __user *ubuf,
 			ept->head->config, ept->head->active,
 			ept->head->next, ept->head->info);
 
+		i += scnprintf(buf + i, PAGE_SIZE - i,
+			"  irqs=%u reqs=%u dtds=%u bytes=%llu irqs/MB=%llu\n",
+			ept->irqs, ept->reqs, ept->dtds, ept->bytes,
+			ept->bytes ?
+			div64_u64((u64) ept->irqs << 20, ept->bytes) : 0);
+
 		for (req = ept->req; req; req = req->next)
 			i += scnprintf(buf + i, PAGE_SIZE - i,
-			"  req @%08x next=%08x info=%08x page0=%08x %c %c\n",
-				req->item_dma, req->item->next,
-				req->item->info, req->item->page0,
+			"  req @%08x next=%08x info=%08x page0=%08x dtds=%u"
+			" %c %c\n",
+				req->item_dma, req->tail->next,
+				req->tail->info, req->item->page0,
+				req->nitems,
 				req->busy ? 'B' : ' ',
 				req->live ? 'L' : ' ');
 	}
 
+	i += scnprintf(buf + i, PAGE_SIZE - i,
+			   "completion passes: %u, max batch: %u\n",
+			   ui->done_runs, ui->done_max_batch);
 	i += scnprintf(buf + i, PAGE_SIZE - i,
 			   "phy failure count: %d\n", ui->phy_fail_count);
 
@@ -1594,6 +1793,8 @@ static int msm72k_probe(struct platform_device *pdev)
 	if (IS_ERR(ui->pclk))
 		return usb_free(ui, PTR_ERR(ui->pclk));
 
+	tasklet_init(&ui->done_tasklet, usb_done_tasklet, (unsigned long) ui);
+
 	ret = request_irq(irq, usb_interrupt, 0, pdev->name, ui);
 	if (ret)
 		return usb_free(ui, ret);
@@ -1685,6 +1886,7 @@ EXPORT_SYMBOL(usb_gadget_register_driver);
 int usb_gadget_unregister_driver(struct usb_gadget_driver *driver)
 {
 	struct usb_info *dev = the_usb_info;
+	unsigned long flags;
 
 	if (!dev)
 		return -ENODEV;
@@ -1692,6 +1894,13 @@ int usb_gadget_unregister_driver(struct usb_gadget_driver *driver)
 		return -EINVAL;
 
 	device_remove_file(&dev->gadget.dev, &dev_attr_wakeup);
+
+	/* no completions may reach the function once it is unbound */
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->done_bits = 0;
+	spin_unlock_irqrestore(&dev->lock, flags);
+	tasklet_kill(&dev->done_tasklet);
+
 	driver->unbind(&dev->gadget);
 	dev->gadget.dev.driver = NULL;
 	dev->driver = NULL;
@@ -25,6 +25,10 @@
 #include <linux/android_pmem.h>
 #include <linux/major.h>
 #include <linux/msm_hw3d.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
 
 #include <mach/msm_iomap.h>
 #include <mach/msm_fb.h>
@@ -395,14 +399,14 @@ done:
 }
 
 static int get_img(struct mdp_img *img, struct fb_info *info,
-		   unsigned long *start, unsigned long *len,
-		   struct file** filep)
+		   unsigned long *start, unsigned long *vstart,
+		   unsigned long *len, struct file** filep)
 {
 	int put_needed, ret = 0;
 	struct file *file;
-	unsigned long vstart;
 
-	if (!get_pmem_file(img->memory_id, start, &vstart, len, filep))
+	*vstart = 0;
+	if (!get_pmem_file(img->memory_id, start, vstart, len, filep))
 		return 0;
 	else if (!get_msm_hw3d_file(img->memory_id, &img->offset, start, len,
 				    filep))
@@ -414,6 +418,7 @@ static int get_img(struct mdp_img *img, struct fb_info *info,
 
 	if (MAJOR(file->f_dentry->d_inode->i_rdev) == FB_MAJOR) {
 		*start = info->fix.smem_start;
+		*vstart = (unsigned long)info->screen_base;
 		*len = info->fix.smem_len;
 		ret = 0;
 	} else
@@ -500,14 +505,32 @@ int mdp_set_output_format(struct mdp_device *mdp_dev, int bpp)
 	return 0;
 }
 
-int mdp_blit(struct mdp_device *mdp_dev, struct fb_info *fb,
-	     struct mdp_blit_req *req)
-{
-	int ret;
-	unsigned long src_start = 0, src_len = 0, dst_start = 0, dst_len = 0;
-	struct mdp_info *mdp = container_of(mdp_dev, struct mdp_info, mdp_dev);
-	struct file *src_file = 0, *dst_file = 0;
+/* One blit request with its source and destination memory pinned. */
+struct mdp_blit_entry {
+	struct mdp_blit_req req;
+	struct file *src_file;
+	struct file *dst_file;
+	unsigned long src_start;
+	unsigned long src_len;
+	unsigned long dst_start;
+	unsigned long dst_len;
+	/* kernel mappings, 0 if there is none (hw3d) */
+	unsigned long src_vaddr;
+	unsigned long dst_vaddr;
+};
 
+struct mdp_blit_job {
+	struct list_head list;
+	uint32_t fence;
+	int count;
+	struct mdp_blit_entry entry[0];
+};
+
+#define MDP_BLIT_QUEUE_MAX 8
+
+static int mdp_blit_get(struct fb_info *fb, struct mdp_blit_req *req,
+			struct mdp_blit_entry *e)
+{
 	/* WORKAROUND FOR HARDWARE BUG IN BG TILE FETCH */
 	if (unlikely(req->src_rect.h == 0 ||
 		     req->src_rect.w == 0)) {
@@ -518,74 +541,487 @@ int mdp_blit(struct mdp_device *mdp_dev, struct fb_info *fb,
 		     req->dst_rect.w == 0))
 		return -EINVAL;
 
+	memcpy(&e->req, req, sizeof(e->req));
+	e->src_file = NULL;
+	e->dst_file = NULL;
+	e->src_start = e->src_len = 0;
+	e->dst_start = e->dst_len = 0;
+	e->src_vaddr = e->dst_vaddr = 0;
+
 	/* do this first so that if this fails, the caller can always
 	 * safely call put_img */
-	if (unlikely(get_img(&req->src, fb, &src_start, &src_len, &src_file))) {
+	if (unlikely(get_img(&e->req.src, fb, &e->src_start, &e->src_vaddr,
+			     &e->src_len, &e->src_file))) {
 		printk(KERN_ERR "mpd_ppp: could not retrieve src image from "
 				"memory\n");
 		return -EINVAL;
 	}
 
-	if (unlikely(get_img(&req->dst, fb, &dst_start, &dst_len, &dst_file))) {
+	if (unlikely(get_img(&e->req.dst, fb, &e->dst_start, &e->dst_vaddr,
+			     &e->dst_len, &e->dst_file))) {
 		printk(KERN_ERR "mpd_ppp: could not retrieve dst image from "
 				"memory\n");
-		put_img(src_file);
+		put_img(e->src_file);
 		return -EINVAL;
 	}
-	mutex_lock(&mdp_mutex);
-	timeout_req = req;
+
 	/* transp_masking unimplemented */
-	req->transp_mask = MDP_TRANSP_NOP;
+	e->req.transp_mask = MDP_TRANSP_NOP;
+	return 0;
+}
+
+static void mdp_blit_put(struct mdp_blit_entry *e)
+{
+	put_img(e->src_file);
+	put_img(e->dst_file);
+}
+
+static int mdp_blit_needs_tiles(struct mdp_blit_req *req)
+{
 #ifndef CONFIG_MSM_MDP31
-	if (unlikely((req->transp_mask != MDP_TRANSP_NOP ||
-		      req->alpha != MDP_ALPHA_NOP ||
-		      HAS_ALPHA(req->src.format)) &&
-		     (req->flags & MDP_ROT_90 &&
-		      req->dst_rect.w <= 16 && req->dst_rect.h >= 16))) {
-		int i;
-		unsigned int tiles = req->dst_rect.h / 16;
-		unsigned int remainder = req->dst_rect.h % 16;
-		req->src_rect.w = 16*req->src_rect.w / req->dst_rect.h;
-		req->dst_rect.h = 16;
-		for (i = 0; i < tiles; i++) {
-			enable_mdp_irq(mdp, DL0_ROI_DONE);
-			ret = mdp_ppp_blit(mdp, req, src_file, src_start,
-					   src_len, dst_file, dst_start,
-					   dst_len);
+	return (req->transp_mask != MDP_TRANSP_NOP ||
+		req->alpha != MDP_ALPHA_NOP ||
+		HAS_ALPHA(req->src.format)) &&
+	       (req->flags & MDP_ROT_90 &&
+		req->dst_rect.w <= 16 && req->dst_rect.h >= 16);
+#else
+	return 0;
+#endif
+}
+
+static int mdp_blit_prepare(struct mdp_info *mdp, struct mdp_blit_entry *e,
+			    struct ppp_regs *regs)
+{
+	return mdp_ppp_prepare(mdp, &e->req, regs, e->src_start, e->src_len,
+			       e->dst_start, e->dst_len);
+}
+
+static ktime_t ppp_model_done;
+
+static void mdp_blit_start(struct mdp_info *mdp, struct mdp_blit_entry *e,
+			   struct ppp_regs *regs, uint32_t model_mpix)
+{
+	u64 pixels;
+
+	timeout_req = &e->req;
+	if (model_mpix) {
+		pixels = (u64)e->req.dst_rect.w * e->req.dst_rect.h;
+		ppp_model_done = ktime_add_ns(ktime_get(),
+					      div_u64(pixels * 1000,
+						      model_mpix));
+		return;
+	}
+
+	enable_mdp_irq(mdp, DL0_ROI_DONE);
+	mdp_ppp_start(mdp, &e->req, regs, e->src_file, e->dst_file);
+}
+
+static int mdp_blit_wait(struct mdp_info *mdp, uint32_t model_mpix)
+{
+	if (model_mpix) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		schedule_hrtimeout(&ppp_model_done, HRTIMER_MODE_ABS);
+		return 0;
+	}
+	return mdp_ppp_wait(mdp);
+}
+
+static int mdp_blit_one(struct mdp_info *mdp, struct mdp_blit_entry *e,
+			uint32_t model_mpix)
+{
+	struct ppp_regs regs;
+	int ret;
+
+	ret = mdp_blit_prepare(mdp, e, &regs);
+	if (ret)
+		return ret;
+	mdp_blit_start(mdp, e, &regs, model_mpix);
+	return mdp_blit_wait(mdp, model_mpix);
+}
+
+static int mdp_blit_tiles(struct mdp_info *mdp, struct mdp_blit_entry *e,
+			  uint32_t model_mpix)
+{
+	struct mdp_blit_req *req = &e->req;
+	unsigned int tiles = req->dst_rect.h / 16;
+	unsigned int remainder = req->dst_rect.h % 16;
+	int ret;
+	int i;
+
+	req->src_rect.w = 16*req->src_rect.w / req->dst_rect.h;
+	req->dst_rect.h = 16;
+	for (i = 0; i < tiles; i++) {
+		ret = mdp_blit_one(mdp, e, model_mpix);
+		if (ret)
+			return ret;
+		req->dst_rect.y += 16;
+		req->src_rect.x += req->src_rect.w;
+	}
+	if (!remainder)
+		return 0;
+	req->src_rect.w = remainder*req->src_rect.w / req->dst_rect.h;
+	req->dst_rect.h = remainder;
+	return mdp_blit_one(mdp, e, model_mpix);
+}
+
+static inline int mdp_span_overlaps(unsigned long start, unsigned long end,
+				    unsigned long addr, unsigned long len)
+{
+	return start < end && addr < end && addr + len > start;
+}
+
+/* Wait for CPU blits to finish and publish the memory the PPP is about
+ * to touch, so that no new CPU blit starts on it. */
+static void mdp_blit_hw_claim(struct mdp_info *mdp, struct mdp_blit_entry *e,
+			      int count)
+{
+	unsigned long src_start = ULONG_MAX, src_end = 0;
+	unsigned long dst_start = ULONG_MAX, dst_end = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		src_start = min(src_start, e[i].src_start);
+		src_end = max(src_end, e[i].src_start + e[i].src_len);
+		dst_start = min(dst_start, e[i].dst_start);
+		dst_end = max(dst_end, e[i].dst_start + e[i].dst_len);
+	}
+
+	spin_lock(&mdp->blit_lock);
+	while (mdp->ppp_sw_busy) {
+		spin_unlock(&mdp->blit_lock);
+		wait_event(mdp->ppp_sw_wq, !ACCESS_ONCE(mdp->ppp_sw_busy));
+		spin_lock(&mdp->blit_lock);
+	}
+	mdp->ppp_src_start = src_start;
+	mdp->ppp_src_end = src_end;
+	mdp->ppp_dst_start = dst_start;
+	mdp->ppp_dst_end = dst_end;
+	spin_unlock(&mdp->blit_lock);
+}
+
+static void mdp_blit_hw_release(struct mdp_info *mdp)
+{
+	spin_lock(&mdp->blit_lock);
+	mdp->ppp_src_start = mdp->ppp_src_end = 0;
+	mdp->ppp_dst_start = mdp->ppp_dst_end = 0;
+	spin_unlock(&mdp->blit_lock);
+}
+
+/* Run a list of pinned blits in order.  While the PPP works on one
+ * request the registers for the next one are computed, so back to back
+ * blits only pay for the register writes between interrupts.  Must be
+ * called with mdp_mutex held. */
+static int mdp_blit_run(struct mdp_info *mdp, struct mdp_blit_entry *e,
+			int count)
+{
+	struct ppp_regs regs[2];
+	uint32_t model_mpix = mdp->ppp_model_mpix;
+	int prepared = 0;
+	int next_ret = 0;
+	int cur = 0;
+	int ret = 0;
+	int i;
+
+	mdp_blit_hw_claim(mdp, e, count);
+
+	for (i = 0; i < count; i++) {
+		if (mdp_blit_needs_tiles(&e[i].req)) {
+			ret = mdp_blit_tiles(mdp, &e[i], model_mpix);
 			if (ret)
-				goto err_bad_blit;
-			ret = mdp_ppp_wait(mdp);
+				break;
+			mdp->blit_stats.tiled++;
+			mdp->blit_stats.blits++;
+			prepared = 0;
+			continue;
+		}
+
+		if (!prepared) {
+			ret = mdp_blit_prepare(mdp, &e[i], &regs[cur]);
 			if (ret)
-				goto err_wait_failed;
-			req->dst_rect.y += 16;
-			req->src_rect.x += req->src_rect.w;
+				break;
+		}
+		mdp_blit_start(mdp, &e[i], &regs[cur], model_mpix);
+
+		prepared = 0;
+		if (i + 1 < count && !mdp_blit_needs_tiles(&e[i + 1].req)) {
+			next_ret = mdp_blit_prepare(mdp, &e[i + 1],
+						    &regs[cur ^ 1]);
+			prepared = !next_ret;
+			if (prepared)
+				mdp->blit_stats.prepared_ahead++;
 		}
-		if (!remainder)
-			goto end;
-		req->src_rect.w = remainder*req->src_rect.w / req->dst_rect.h;
-		req->dst_rect.h = remainder;
+
+		ret = mdp_blit_wait(mdp, model_mpix);
+		if (ret)
+			break;
+		mdp->blit_stats.blits++;
+		if (next_ret) {
+			ret = next_ret;
+			break;
+		}
+		cur ^= 1;
 	}
-#endif
-	enable_mdp_irq(mdp, DL0_ROI_DONE);
-	ret = mdp_ppp_blit(mdp, req, src_file, src_start, src_len, dst_file,
-			   dst_start,
-			   dst_len);
-	if (ret)
-		goto err_bad_blit;
-	ret = mdp_ppp_wait(mdp);
+
+	mdp_blit_hw_release(mdp);
+
 	if (ret)
-		goto err_wait_failed;
-end:
-	put_img(src_file);
-	put_img(dst_file);
-	mutex_unlock(&mdp_mutex);
+		mdp->blit_stats.errors++;
+	return ret;
+}
+
+static int mdp_blit_sw_ok(struct mdp_blit_entry *e, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!e[i].src_vaddr || !e[i].dst_vaddr ||
+		    !mdp_ppp_sw_supported(&e[i].req))
+			return 0;
+	}
+	return 1;
+}
+
+/* Let e[0..count) run on the CPU if no queued async blit has to land
+ * first and the PPP isn't touching the same memory.  On success the
+ * PPP won't start anything new until mdp_blit_sw_release(). */
+static int mdp_blit_sw_claim(struct mdp_info *mdp, struct mdp_blit_entry *e,
+			     int count)
+{
+	int ok = 0;
+	int i;
+
+	spin_lock(&mdp->blit_lock);
+	if (mdp->blit_queue_len)
+		goto done;
+	for (i = 0; i < count; i++) {
+		if (mdp_span_overlaps(mdp->ppp_dst_start, mdp->ppp_dst_end,
+				      e[i].dst_start, e[i].dst_len) ||
+		    mdp_span_overlaps(mdp->ppp_dst_start, mdp->ppp_dst_end,
+				      e[i].src_start, e[i].src_len) ||
+		    mdp_span_overlaps(mdp->ppp_src_start, mdp->ppp_src_end,
+				      e[i].dst_start, e[i].dst_len))
+			goto done;
+	}
+	mdp->ppp_sw_busy++;
+	ok = 1;
+done:
+	spin_unlock(&mdp->blit_lock);
+	return ok;
+}
+
+static void mdp_blit_sw_release(struct mdp_info *mdp)
+{
+	spin_lock(&mdp->blit_lock);
+	mdp->ppp_sw_busy--;
+	spin_unlock(&mdp->blit_lock);
+	wake_up_all(&mdp->ppp_sw_wq);
+}
+
+/* Run a list of pinned blits on the CPU.  Used instead of waiting for
+ * mdp_mutex when the PPP is busy with another synchronous blit and
+ * ppp_sw_fallback is set.  Must be called after mdp_blit_sw_claim(). */
+static int mdp_blit_run_sw(struct mdp_info *mdp, struct mdp_blit_entry *e,
+			   int count)
+{
+	struct ppp_regs regs;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		ret = mdp_blit_prepare(mdp, &e[i], &regs);
+		if (ret)
+			break;
+		ret = mdp_ppp_sw_blit(&e[i].req, &regs,
+				      (void *)e[i].src_vaddr,
+				      (void *)e[i].dst_vaddr, e[i].dst_file);
+		if (ret)
+			break;
+		mdp->blit_stats.sw_blits++;
+	}
+	return ret;
+}
+
+int mdp_blit_list(struct mdp_device *mdp_dev, struct fb_info *fb,
+		  struct mdp_blit_req *req, int count)
+{
+	struct mdp_info *mdp = container_of(mdp_dev, struct mdp_info, mdp_dev);
+	struct mdp_blit_entry one;
+	struct mdp_blit_entry *e = &one;
+	int run_ret;
+	int ret = 0;
+	int i;
+
+	if (count <= 0)
+		return 0;
+	if (count > 1) {
+		e = kmalloc(count * sizeof(*e), GFP_KERNEL);
+		if (!e)
+			return -ENOMEM;
+	}
+
+	/* if a request can't be pinned, the ones before it still run */
+	for (i = 0; i < count; i++) {
+		ret = mdp_blit_get(fb, &req[i], &e[i]);
+		if (ret)
+			break;
+	}
+	count = i;
+
+	if (mutex_trylock(&mdp_mutex)) {
+		run_ret = mdp_blit_run(mdp, e, count);
+		mutex_unlock(&mdp_mutex);
+	} else if (mdp->ppp_sw_fallback && mdp_blit_sw_ok(e, count) &&
+		   mdp_blit_sw_claim(mdp, e, count)) {
+		run_ret = mdp_blit_run_sw(mdp, e, count);
+		mdp_blit_sw_release(mdp);
+	} else {
+		mutex_lock(&mdp_mutex);
+		run_ret = mdp_blit_run(mdp, e, count);
+		mutex_unlock(&mdp_mutex);
+	}
+
+	for (i = 0; i < count; i++)
+		mdp_blit_put(&e[i]);
+	if (e != &one)
+		kfree(e);
+
+	return run_ret ? run_ret : ret;
+}
+
+int mdp_blit(struct mdp_device *mdp_dev, struct fb_info *fb,
+	     struct mdp_blit_req *req)
+{
+	return mdp_blit_list(mdp_dev, fb, req, 1);
+}
+
+static void mdp_blit_work(struct work_struct *work)
+{
+	struct mdp_info *mdp = container_of(work, struct mdp_info, blit_work);
+	struct mdp_blit_job *job;
+	struct mdp_blit_failed *failed;
+	int ret;
+	int i;
+
+	for (;;) {
+		spin_lock(&mdp->blit_lock);
+		if (list_empty(&mdp->blit_queue)) {
+			spin_unlock(&mdp->blit_lock);
+			break;
+		}
+		job = list_first_entry(&mdp->blit_queue, struct mdp_blit_job,
+				       list);
+		list_del(&job->list);
+		spin_unlock(&mdp->blit_lock);
+
+		mutex_lock(&mdp_mutex);
+		ret = mdp_blit_run(mdp, job->entry, job->count);
+		mutex_unlock(&mdp_mutex);
+
+		for (i = 0; i < job->count; i++)
+			mdp_blit_put(&job->entry[i]);
+
+		spin_lock(&mdp->blit_lock);
+		if (ret) {
+			failed = &mdp->blit_failed[mdp->blit_failed_next];
+			failed->fence = job->fence;
+			failed->error = ret;
+			mdp->blit_failed_next = (mdp->blit_failed_next + 1) %
+						MDP_BLIT_FAILED_MAX;
+		}
+		mdp->blit_queue_len--;
+		mdp->blit_fence_done = job->fence;
+		spin_unlock(&mdp->blit_lock);
+		wake_up_all(&mdp->blit_fence_wq);
+
+		kfree(job);
+	}
+}
+
+/* Pin the memory for count requests in the caller's context and queue
+ * them for blit_work.  Blits from separate calls run in submission
+ * order; synchronous blits may run in between. */
+int mdp_blit_async(struct mdp_device *mdp_dev, struct fb_info *fb,
+		   struct mdp_blit_req *req, int count, uint32_t *fence)
+{
+	struct mdp_info *mdp = container_of(mdp_dev, struct mdp_info, mdp_dev);
+	struct mdp_blit_job *job;
+	int ret = 0;
+	int i;
+
+	if (count <= 0 || count > MDP_ASYNC_BLIT_MAX)
+		return -EINVAL;
+
+	job = kmalloc(sizeof(*job) + count * sizeof(struct mdp_blit_entry),
+		      GFP_KERNEL);
+	if (!job)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		ret = mdp_blit_get(fb, &req[i], &job->entry[i]);
+		if (ret)
+			goto err_put;
+	}
+	job->count = count;
+
+	spin_lock(&mdp->blit_lock);
+	while (mdp->blit_queue_len >= MDP_BLIT_QUEUE_MAX) {
+		mdp->blit_stats.queue_full++;
+		spin_unlock(&mdp->blit_lock);
+		ret = wait_event_interruptible(mdp->blit_fence_wq,
+				mdp->blit_queue_len < MDP_BLIT_QUEUE_MAX);
+		if (ret)
+			goto err_put;
+		spin_lock(&mdp->blit_lock);
+	}
+	job->fence = ++mdp->blit_fence_next;
+	list_add_tail(&job->list, &mdp->blit_queue);
+	mdp->blit_queue_len++;
+	if (mdp->blit_queue_len > mdp->blit_stats.max_queue_len)
+		mdp->blit_stats.max_queue_len = mdp->blit_queue_len;
+	mdp->blit_stats.jobs++;
+	spin_unlock(&mdp->blit_lock);
+
+	queue_work(mdp->blit_wq, &mdp->blit_work);
+	*fence = job->fence;
 	return 0;
-err_bad_blit:
-	disable_mdp_irq(mdp, DL0_ROI_DONE);
-err_wait_failed:
-	put_img(src_file);
-	put_img(dst_file);
-	mutex_unlock(&mdp_mutex);
+
+err_put:
+	while (--i >= 0)
+		mdp_blit_put(&job->entry[i]);
+	kfree(job);
+	return ret;
+}
+
+static int mdp_blit_fence_done(struct mdp_info *mdp, uint32_t fence)
+{
+	return (int32_t)(mdp->blit_fence_done - fence) >= 0;
+}
+
+/* Returns the error of the job the fence was handed out for, if it
+ * failed and was one of the last MDP_BLIT_FAILED_MAX failures. */
+int mdp_blit_wait_fence(struct mdp_device *mdp_dev, uint32_t fence)
+{
+	struct mdp_info *mdp = container_of(mdp_dev, struct mdp_info, mdp_dev);
+	int ret;
+	int i;
+
+	if ((int32_t)(fence - mdp->blit_fence_next) > 0)
+		return -EINVAL;
+
+	ret = wait_event_interruptible(mdp->blit_fence_wq,
+				       mdp_blit_fence_done(mdp, fence));
+	if (ret)
+		return ret;
+
+	spin_lock(&mdp->blit_lock);
+	for (i = 0; i < MDP_BLIT_FAILED_MAX; i++) {
+		if (mdp->blit_failed[i].error &&
+		    mdp->blit_failed[i].fence == fence) {
+			ret = mdp->blit_failed[i].error;
+			break;
+		}
+	}
+	spin_unlock(&mdp->blit_lock);
 	return ret;
 }
 
@@ -786,6 +1222,65 @@ void mdp_hw_init(struct mdp_info *mdp)
 
 }
 
+#if defined(CONFIG_DEBUG_FS)
+static ssize_t mdp_blit_stats_read(struct file *file, char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct mdp_info *mdp = file->private_data;
+	struct mdp_blit_stats *st = &mdp->blit_stats;
+	char tmp[256];
+	int n;
+
+	n = scnprintf(tmp, sizeof(tmp),
+		      "blits: %lu\n"
+		      "prepared_ahead: %lu\n"
+		      "tiled: %lu\n"
+		      "sw_blits: %lu\n"
+		      "errors: %lu\n"
+		      "async_jobs: %lu\n"
+		      "queue_full: %lu\n"
+		      "max_queue_len: %d\n"
+		      "fence: %u/%u\n",
+		      st->blits, st->prepared_ahead, st->tiled, st->sw_blits,
+		      st->errors,
+		      st->jobs, st->queue_full, st->max_queue_len,
+		      mdp->blit_fence_done, mdp->blit_fence_next);
+	return simple_read_from_buffer(buf, count, ppos, tmp, n);
+}
+
+static int mdp_debug_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations mdp_blit_stats_fops = {
+	.open = mdp_debug_open,
+	.read = mdp_blit_stats_read,
+};
+
+static void mdp_debugfs_init(struct mdp_info *mdp)
+{
+	struct dentry *dent;
+
+	dent = debugfs_create_dir("mdp", 0);
+	if (IS_ERR(dent))
+		return;
+
+	debugfs_create_file("blit_stats", 0444, dent, mdp,
+			    &mdp_blit_stats_fops);
+	debugfs_create_u32("ppp_model_mpix", 0644, dent,
+			   &mdp->ppp_model_mpix);
+#ifdef CONFIG_MSM_MDP_PPP_SW
+	debugfs_create_u32("ppp_sw_fallback", 0644, dent,
+			   &mdp->ppp_sw_fallback);
+#endif
+	mdp_ppp_sw_debugfs_init(mdp, dent);
+}
+#else
+static void mdp_debugfs_init(struct mdp_info *mdp) {}
+#endif
+
 uint32_t msm_mdp_base;
 int mdp_probe(struct platform_device *pdev)
 {
@@ -805,6 +1300,11 @@ int mdp_probe(struct platform_device *pdev)
 		return -ENOMEM;
 
 	spin_lock_init(&mdp->lock);
+	spin_lock_init(&mdp->blit_lock);
+	INIT_LIST_HEAD(&mdp->blit_queue);
+	INIT_WORK(&mdp->blit_work, mdp_blit_work);
+	init_waitqueue_head(&mdp->blit_fence_wq);
+	init_waitqueue_head(&mdp->ppp_sw_wq);
 
 	mdp->irq = platform_get_irq(pdev, 0);
 	if (mdp->irq < 0) {
@@ -824,6 +1324,9 @@ int mdp_probe(struct platform_device *pdev)
 	mdp->mdp_dev.dma = mdp_dma;
 	mdp->mdp_dev.dma_wait = mdp_dma_wait;
 	mdp->mdp_dev.blit = mdp_blit;
+	mdp->mdp_dev.blit_list = mdp_blit_list;
+	mdp->mdp_dev.blit_async = mdp_blit_async;
+	mdp->mdp_dev.blit_wait = mdp_blit_wait_fence;
 	mdp->mdp_dev.set_grp_disp = mdp_set_grp_disp;
 	mdp->mdp_dev.set_output_format = mdp_set_output_format;
 	mdp->mdp_dev.check_output_format = mdp_check_output_format;
@@ -856,6 +1359,12 @@ int mdp_probe(struct platform_device *pdev)
 		goto error_get_ebi1_clk;
 	}
 
+	mdp->blit_wq = create_singlethread_workqueue("mdp_blit");
+	if (!mdp->blit_wq) {
+		ret = -ENOMEM;
+		goto error_create_wq;
+	}
+
 	ret = request_irq(mdp->irq, mdp_isr, IRQF_DISABLED, "msm_mdp", mdp);
 	if (ret)
 		goto error_request_irq;
@@ -876,11 +1385,15 @@ int mdp_probe(struct platform_device *pdev)
 	if (ret)
 		goto error_device_register;
 
+	mdp_debugfs_init(mdp);
+
 	return 0;
 
 error_device_register:
 	free_irq(mdp->irq, mdp);
 error_request_irq:
+	destroy_workqueue(mdp->blit_wq);
+error_create_wq:
 	clk_put(mdp->ebi1_clk);
 error_get_ebi1_clk:
 	clk_put(mdp->clk);
@@ -17,6 +17,8 @@
 
 #include <linux/platform_device.h>
 #include <linux/wait.h>
+#include <linux/list.h>
+#include <linux/workqueue.h>
 #include <mach/msm_iomap.h>
 #include <mach/msm_fb.h>
 
@@ -41,6 +43,24 @@ struct mdp_out_interface {
 	struct msmfb_callback	*irq_cb;
 };
 
+struct mdp_blit_stats {
+	unsigned long blits;
+	unsigned long prepared_ahead;
+	unsigned long tiled;
+	unsigned long sw_blits;
+	unsigned long errors;
+	unsigned long jobs;
+	unsigned long queue_full;
+	int max_queue_len;
+};
+
+#define MDP_BLIT_FAILED_MAX 16
+
+struct mdp_blit_failed {
+	uint32_t fence;
+	int error;
+};
+
 struct mdp_info {
 	spinlock_t lock;
 	struct mdp_device mdp_dev;
@@ -52,6 +72,37 @@ struct mdp_info {
 	int format;
 	int pack_pattern;
 	bool dma_config_dirty;
+
+	/* asynchronous blit queue, drained by blit_work */
+	spinlock_t blit_lock;
+	struct list_head blit_queue;
+	int blit_queue_len;
+	struct workqueue_struct *blit_wq;
+	struct work_struct blit_work;
+	wait_queue_head_t blit_fence_wq;
+	uint32_t blit_fence_next;
+	uint32_t blit_fence_done;
+	/* the most recent async jobs that failed, for blit_wait */
+	struct mdp_blit_failed blit_failed[MDP_BLIT_FAILED_MAX];
+	int blit_failed_next;
+	struct mdp_blit_stats blit_stats;
+
+	/* if non-zero, blits are validated but not sent to the PPP; each
+	 * one instead takes as long as a PPP running at this many
+	 * megapixels per second would */
+	uint32_t ppp_model_mpix;
+
+	/* if non-zero, blits that find the PPP busy run on the CPU when
+	 * mdp_ppp_sw_blit() can handle them */
+	uint32_t ppp_sw_fallback;
+
+	/* Under blit_lock: the memory the PPP is reading and writing for
+	 * the blit list it is running (empty when start == end), and how
+	 * many CPU blits are running, which the PPP waits out. */
+	unsigned long ppp_src_start, ppp_src_end;
+	unsigned long ppp_dst_start, ppp_dst_end;
+	int ppp_sw_busy;
+	wait_queue_head_t ppp_sw_wq;
 };
 
 extern int mdp_out_if_register(struct mdp_device *mdp_dev, int interface,
@@ -355,14 +355,10 @@ static int blit_scale(const struct mdp_info *mdp, struct mdp_blit_req *req,
 static void blit_blur(const struct mdp_info *mdp, struct mdp_blit_req *req,
 		      struct ppp_regs *regs)
 {
-	int ret;
 	if (!(req->flags & MDP_BLUR))
 		return;
 
-	ret = mdp_ppp_load_blur(mdp);
-	if (ret)
-		return;
-
+	regs->load_blur = 1;
 	regs->op |= (PPP_OP_SCALE_Y_ON | PPP_OP_SCALE_X_ON);
 }
 
@@ -547,13 +543,15 @@ void mdp_dump_blit(struct mdp_blit_req *req)
 	pr_info("%s: flags=%08x\n", __func__, req->flags);
 }
 
-int mdp_ppp_blit(const struct mdp_info *mdp, struct mdp_blit_req *req,
-		 struct file *src_file, unsigned long src_start, unsigned long src_len,
-		 struct file *dst_file, unsigned long dst_start, unsigned long dst_len)
+int mdp_ppp_prepare(const struct mdp_info *mdp, struct mdp_blit_req *req,
+		    struct ppp_regs *regs, unsigned long src_start,
+		    unsigned long src_len, unsigned long dst_start,
+		    unsigned long dst_len)
 {
-	struct ppp_regs regs = {0};
 	uint32_t luma_base;
 
+	memset(regs, 0, sizeof(*regs));
+
 #if PPP_DUMP_BLITS
 	mdp_dump_blit(req);
 #endif
@@ -581,64 +579,66 @@ int mdp_ppp_blit(const struct mdp_info *mdp, struct mdp_blit_req *req,
         }
 
 	/* set the src image configuration */
-	regs.src_cfg = src_img_cfg[req->src.format];
-	regs.src_cfg |= (req->src_rect.x & 0x1) ? PPP_SRC_BPP_ROI_ODD_X : 0;
-	regs.src_cfg |= (req->src_rect.y & 0x1) ? PPP_SRC_BPP_ROI_ODD_Y : 0;
-	regs.src_pack = pack_pattern[req->src.format];
+	regs->src_cfg = src_img_cfg[req->src.format];
+	regs->src_cfg |= (req->src_rect.x & 0x1) ? PPP_SRC_BPP_ROI_ODD_X : 0;
+	regs->src_cfg |= (req->src_rect.y & 0x1) ? PPP_SRC_BPP_ROI_ODD_Y : 0;
+	regs->src_pack = pack_pattern[req->src.format];
 
 	/* set the dest image configuration */
-	regs.dst_cfg = dst_img_cfg[req->dst.format] | PPP_DST_OUT_SEL_AXI;
-	regs.dst_pack = pack_pattern[req->dst.format];
+	regs->dst_cfg = dst_img_cfg[req->dst.format] | PPP_DST_OUT_SEL_AXI;
+	regs->dst_pack = pack_pattern[req->dst.format];
 
 #if defined (CONFIG_MSM_MDP31)
 	/* set src, bpp, start pixel and ystride */
-	regs.src_bpp = bytes_per_pixel[req->src.format];
+	regs->src_bpp = bytes_per_pixel[req->src.format];
 	luma_base = src_start + req->src.offset;
-	regs.src0 = luma_base +
-		get_luma_offset(&req->src, &req->src_rect, regs.src_bpp);
-	regs.src1 = get_chroma_base(&req->src, luma_base, regs.src_bpp);
-	regs.src1 += get_chroma_offset(&req->src, &req->src_rect, regs.src_bpp);
-	regs.src_ystride = req->src.width * regs.src_bpp;
-	set_src_region(&req->src, &req->src_rect, &regs);
+	regs->src0 = luma_base +
+		get_luma_offset(&req->src, &req->src_rect, regs->src_bpp);
+	regs->src1 = get_chroma_base(&req->src, luma_base, regs->src_bpp);
+	regs->src1 += get_chroma_offset(&req->src, &req->src_rect,
+					regs->src_bpp);
+	regs->src_ystride = req->src.width * regs->src_bpp;
+	set_src_region(&req->src, &req->src_rect, regs);
 
 	/* set dst, bpp, start pixel and ystride */
-	regs.dst_bpp = bytes_per_pixel[req->dst.format];
+	regs->dst_bpp = bytes_per_pixel[req->dst.format];
 	luma_base = dst_start + req->dst.offset;
-	regs.dst0 = luma_base +
-		get_luma_offset(&req->dst, &req->dst_rect, regs.dst_bpp);
-	regs.dst1 = get_chroma_base(&req->dst, luma_base, regs.dst_bpp);
-	regs.dst1 += get_chroma_offset(&req->dst, &req->dst_rect, regs.dst_bpp);
-	regs.dst_ystride = req->dst.width * regs.dst_bpp;
-	set_dst_region(&req->dst_rect, &regs);
+	regs->dst0 = luma_base +
+		get_luma_offset(&req->dst, &req->dst_rect, regs->dst_bpp);
+	regs->dst1 = get_chroma_base(&req->dst, luma_base, regs->dst_bpp);
+	regs->dst1 += get_chroma_offset(&req->dst, &req->dst_rect,
+					regs->dst_bpp);
+	regs->dst_ystride = req->dst.width * regs->dst_bpp;
+	set_dst_region(&req->dst_rect, regs);
 
 	/* for simplicity, always write the chroma stride */
-	regs.src_ystride &= 0x3fff;
-	regs.src_ystride |= regs.src_ystride << 16;
-	regs.dst_ystride &= 0x3fff;
-	regs.dst_ystride |= regs.dst_ystride << 16;
+	regs->src_ystride &= 0x3fff;
+	regs->src_ystride |= regs->src_ystride << 16;
+	regs->dst_ystride &= 0x3fff;
+	regs->dst_ystride |= regs->dst_ystride << 16;
 #else
-	regs.src_rect = (req->src_rect.h << 16) | req->src_rect.w;
-	regs.dst_rect = (req->dst_rect.h << 16) | req->dst_rect.w;
+	regs->src_rect = (req->src_rect.h << 16) | req->src_rect.w;
+	regs->dst_rect = (req->dst_rect.h << 16) | req->dst_rect.w;
 	/* set src, bpp, start pixel and ystride */
-	regs.src_bpp = bytes_per_pixel[req->src.format];
-	regs.src0 = src_start + req->src.offset;
-	regs.src_ystride = req->src.width * regs.src_bpp;
-	get_chroma_addr(&req->src, &req->src_rect, regs.src0, regs.src_bpp,
-			regs.src_cfg, &regs.src1, &regs.src_ystride);
-	regs.src0 += (req->src_rect.x + (req->src_rect.y * req->src.width)) *
-		      regs.src_bpp;
+	regs->src_bpp = bytes_per_pixel[req->src.format];
+	regs->src0 = src_start + req->src.offset;
+	regs->src_ystride = req->src.width * regs->src_bpp;
+	get_chroma_addr(&req->src, &req->src_rect, regs->src0, regs->src_bpp,
+			regs->src_cfg, &regs->src1, &regs->src_ystride);
+	regs->src0 += (req->src_rect.x + (req->src_rect.y * req->src.width)) *
+		      regs->src_bpp;
 
 	/* set dst, bpp, start pixel and ystride */
-	regs.dst_bpp = bytes_per_pixel[req->dst.format];
-	regs.dst0 = dst_start + req->dst.offset;
-	regs.dst_ystride = req->dst.width * regs.dst_bpp;
-	get_chroma_addr(&req->dst, &req->dst_rect, regs.dst0, regs.dst_bpp,
-			regs.dst_cfg, &regs.dst1, &regs.dst_ystride);
-	regs.dst0 += (req->dst_rect.x + (req->dst_rect.y * req->dst.width)) *
-		      regs.dst_bpp;
+	regs->dst_bpp = bytes_per_pixel[req->dst.format];
+	regs->dst0 = dst_start + req->dst.offset;
+	regs->dst_ystride = req->dst.width * regs->dst_bpp;
+	get_chroma_addr(&req->dst, &req->dst_rect, regs->dst0, regs->dst_bpp,
+			regs->dst_cfg, &regs->dst1, &regs->dst_ystride);
+	regs->dst0 += (req->dst_rect.x + (req->dst_rect.y * req->dst.width)) *
+		      regs->dst_bpp;
 #endif
 	if (!valid_src_dst(src_start, src_len, dst_start, dst_len, req,
-			   &regs)) {
+			   regs)) {
 		printk(KERN_ERR "mdp_ppp: final src or dst location is "
 			"invalid, are you trying to make an image too large "
 			"or to place it outside the screen?\n");
@@ -646,18 +646,18 @@ int mdp_ppp_blit(const struct mdp_info *mdp, struct mdp_blit_req *req,
 	}
 
 	/* set up operation register */
-	regs.op = 0;
-	blit_rotate(req, &regs);
-	blit_convert(req, &regs);
+	regs->op = 0;
+	blit_rotate(req, regs);
+	blit_convert(req, regs);
 	if (req->flags & MDP_DITHER)
-		regs.op |= PPP_OP_DITHER_EN;
-	blit_blend(req, &regs);
-	if (blit_scale(mdp, req, &regs)) {
+		regs->op |= PPP_OP_DITHER_EN;
+	blit_blend(req, regs);
+	if (blit_scale(mdp, req, regs)) {
 		printk(KERN_ERR "mdp_ppp: error computing scale for img.\n");
 		return -EINVAL;
 	}
-	blit_blur(mdp, req, &regs);
-	regs.op |= dst_op_chroma[req->dst.format] |
+	blit_blur(mdp, req, regs);
+	regs->op |= dst_op_chroma[req->dst.format] |
 		   src_op_chroma[req->src.format];
 
 	/* if the image is YCRYCB, the x and w must be even */
@@ -668,12 +668,35 @@ int mdp_ppp_blit(const struct mdp_info *mdp, struct mdp_blit_req *req,
 		req->dst_rect.w = req->dst_rect.w & (~0x1);
 	}
 
-	if (mdp_ppp_cfg_edge_cond(req, &regs))
+	if (mdp_ppp_cfg_edge_cond(req, regs))
 		return -EINVAL;
 
+	return 0;
+}
+
+void mdp_ppp_start(const struct mdp_info *mdp, struct mdp_blit_req *req,
+		   struct ppp_regs *regs, struct file *src_file,
+		   struct file *dst_file)
+{
+	mdp_ppp_load_scale(mdp, regs);
 #if PPP_DUMP_BLITS
 	pr_info("%s: sending blit\n", __func__);
 #endif
-	send_blit(mdp, req, &regs, src_file, dst_file);
+	send_blit(mdp, req, regs, src_file, dst_file);
+}
+
+int mdp_ppp_blit(const struct mdp_info *mdp, struct mdp_blit_req *req,
+		 struct file *src_file, unsigned long src_start, unsigned long src_len,
+		 struct file *dst_file, unsigned long dst_start, unsigned long dst_len)
+{
+	struct ppp_regs regs;
+	int ret;
+
+	ret = mdp_ppp_prepare(mdp, req, &regs, src_start, src_len,
+			      dst_start, dst_len);
+	if (ret)
+		return ret;
+
+	mdp_ppp_start(mdp, req, &regs, src_file, dst_file);
 	return 0;
 }
@@ -59,6 +59,12 @@ struct ppp_regs {
 	uint32_t scale_cfg;
 	uint32_t csc_cfg;
 #endif
+
+	/* scaler tables needed by this blit, see mdp_ppp_load_scale() */
+	int load_scale;
+	int load_blur;
+	int downscale_x;
+	int downscale_y;
 };
 
 struct mdp_info;
@@ -70,8 +76,50 @@ int mdp_ppp_cfg_scale(const struct mdp_info *mdp, struct ppp_regs *regs,
 		      struct mdp_rect *src_rect, struct mdp_rect *dst_rect,
 		      uint32_t src_format, uint32_t dst_format);
 int mdp_ppp_load_blur(const struct mdp_info *mdp);
+void mdp_ppp_load_scale(const struct mdp_info *mdp, struct ppp_regs *regs);
 void mdp_dump_blit(struct mdp_blit_req *req);
 
+/* mdp_ppp_blit() split in two: mdp_ppp_prepare() validates the request
+ * and computes the register image without touching the hardware, so it
+ * can run while a previous blit is still in flight; mdp_ppp_start()
+ * loads any scaler tables and kicks the PPP. */
+int mdp_ppp_prepare(const struct mdp_info *mdp, struct mdp_blit_req *req,
+		    struct ppp_regs *regs, unsigned long src_start,
+		    unsigned long src_len, unsigned long dst_start,
+		    unsigned long dst_len);
+void mdp_ppp_start(const struct mdp_info *mdp, struct mdp_blit_req *req,
+		   struct ppp_regs *regs, struct file *src_file,
+		   struct file *dst_file);
+
+
+#ifdef CONFIG_MSM_MDP_PPP_SW
+struct file;
+int mdp_ppp_sw_supported(struct mdp_blit_req *req);
+int mdp_ppp_sw_blit(struct mdp_blit_req *req, struct ppp_regs *regs,
+		    void *src_base, void *dst_base, struct file *dst_file);
+#else
+static inline int mdp_ppp_sw_supported(struct mdp_blit_req *req)
+{
+	return 0;
+}
+static inline int mdp_ppp_sw_blit(struct mdp_blit_req *req,
+				  struct ppp_regs *regs, void *src_base,
+				  void *dst_base, struct file *dst_file)
+{
+	return -ENOSYS;
+}
+#endif
+
+struct dentry;
+#if defined(CONFIG_MSM_MDP_PPP_SW) && defined(CONFIG_DEBUG_FS)
+void mdp_ppp_sw_debugfs_init(const struct mdp_info *mdp,
+			     struct dentry *dent);
+#else
+static inline void mdp_ppp_sw_debugfs_init(const struct mdp_info *mdp,
+					   struct dentry *dent)
+{
+}
+#endif
 
 #ifndef CONFIG_MSM_MDP31
 int mdp_ppp_cfg_edge_cond(struct mdp_blit_req *req, struct ppp_regs *regs);
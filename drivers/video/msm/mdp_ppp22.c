@@ -39,7 +39,7 @@ enum {
 static int downscale_x_table;
 static int downscale_y_table;
 
-static struct mdp_table_entry mdp_upscale_table[] = {
+struct mdp_table_entry mdp_upscale_table[] = {
 	{ 0x5fffc, 0x0 },
 	{ 0x50200, 0x7fc00000 },
 	{ 0x5fffc, 0xff80000d },
@@ -1020,7 +1020,6 @@ int mdp_ppp_cfg_scale(const struct mdp_info *mdp, struct ppp_regs *regs,
 		      struct mdp_rect *src_rect, struct mdp_rect *dst_rect,
 		      uint32_t src_format, uint32_t dst_format)
 {
-	int downscale;
 	uint32_t phase_init_x, phase_init_y, phase_step_x, phase_step_y;
 	uint32_t scale_factor_x, scale_factor_y;
 
@@ -1039,32 +1038,26 @@ int mdp_ppp_cfg_scale(const struct mdp_info *mdp, struct ppp_regs *regs,
 	scale_factor_y = (dst_rect->h * 10) / src_rect->h;
 
 	if (scale_factor_x > 8)
-		downscale = MDP_DOWNSCALE_PT8TO1;
+		regs->downscale_x = MDP_DOWNSCALE_PT8TO1;
 	else if (scale_factor_x > 6)
-		downscale = MDP_DOWNSCALE_PT6TOPT8;
+		regs->downscale_x = MDP_DOWNSCALE_PT6TOPT8;
 	else if (scale_factor_x > 4)
-		downscale = MDP_DOWNSCALE_PT4TOPT6;
+		regs->downscale_x = MDP_DOWNSCALE_PT4TOPT6;
 	else
-		downscale = MDP_DOWNSCALE_PT2TOPT4;
-
-	if (downscale != downscale_x_table) {
-		load_table(mdp, mdp_downscale_x_table[downscale], 64);
-		downscale_x_table = downscale;
-	}
+		regs->downscale_x = MDP_DOWNSCALE_PT2TOPT4;
 
 	if (scale_factor_y > 8)
-		downscale = MDP_DOWNSCALE_PT8TO1;
+		regs->downscale_y = MDP_DOWNSCALE_PT8TO1;
 	else if (scale_factor_y > 6)
-		downscale = MDP_DOWNSCALE_PT6TOPT8;
+		regs->downscale_y = MDP_DOWNSCALE_PT6TOPT8;
 	else if (scale_factor_y > 4)
-		downscale = MDP_DOWNSCALE_PT4TOPT6;
+		regs->downscale_y = MDP_DOWNSCALE_PT4TOPT6;
 	else
-		downscale = MDP_DOWNSCALE_PT2TOPT4;
+		regs->downscale_y = MDP_DOWNSCALE_PT2TOPT4;
 
-	if (downscale != downscale_y_table) {
-		load_table(mdp, mdp_downscale_y_table[downscale], 64);
-		downscale_y_table = downscale;
-	}
+	/* the tables themselves are loaded by mdp_ppp_load_scale() right
+	 * before the blit is sent, so this can run while the PPP is busy */
+	regs->load_scale = 1;
 
 	return 0;
 }
@@ -1082,6 +1075,27 @@ int mdp_ppp_load_blur(const struct mdp_info *mdp)
 	return 0;
 }
 
+void mdp_ppp_load_scale(const struct mdp_info *mdp, struct ppp_regs *regs)
+{
+	if (regs->load_blur) {
+		mdp_ppp_load_blur(mdp);
+		return;
+	}
+
+	if (!regs->load_scale)
+		return;
+
+	if (regs->downscale_x != downscale_x_table) {
+		load_table(mdp, mdp_downscale_x_table[regs->downscale_x], 64);
+		downscale_x_table = regs->downscale_x;
+	}
+
+	if (regs->downscale_y != downscale_y_table) {
+		load_table(mdp, mdp_downscale_y_table[regs->downscale_y], 64);
+		downscale_y_table = regs->downscale_y;
+	}
+}
+
 #define MDP_SCALE_CFG_RETRY	3
 void mdp_ppp_init_scale(const struct mdp_info *mdp)
 {
@@ -0,0 +1,506 @@
+/* drivers/video/msm/mdp_ppp_sw.c
+ *
+ * Software reference implementation of the MDP PPP blit.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Executes an mdp_blit_req on the CPU from the register image built by
+ * mdp_ppp_prepare(): the same phase init/step values and the same
+ * polyphase coefficient tables (mdp_scale_tables.h) the PPP is loaded
+ * with.  RGB formats only; dithering is not modelled.
+ *
+ * The scaler is separable: a horizontal pass per source row, then a
+ * vertical pass that combines four rows with one set of coefficients.
+ * Both work on unpacked 8 bit channels so the inner loops are plain
+ * multiply-accumulates over contiguous bytes.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/fb.h>
+#include <linux/msm_mdp.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
+#include <linux/math64.h>
+#include <linux/android_pmem.h>
+
+#include "mdp_hw.h"
+#include "mdp_ppp.h"
+#include "mdp_scale_tables.h"
+
+#define SW_PHASES	32
+#define SW_TAPS		4
+#define SW_COEF_SHIFT	9
+#define SW_PHASE_SHIFT	29
+
+struct sw_filter {
+	int c[SW_PHASES][SW_TAPS];
+};
+
+/* Scratch space for the unpacked, scaled images and the filter.  It only
+ * ever grows, so after the first few blits no allocation is made.  Held
+ * for the whole blit, which also serializes software blits. */
+static DEFINE_MUTEX(sw_scratch_lock);
+static void *sw_scratch;
+static size_t sw_scratch_size;
+
+static void *sw_scratch_get(size_t size)
+{
+	void *p;
+
+	if (size <= sw_scratch_size)
+		return sw_scratch;
+	p = vmalloc(PAGE_ALIGN(size));
+	if (!p)
+		return NULL;
+	vfree(sw_scratch);
+	sw_scratch = p;
+	sw_scratch_size = PAGE_ALIGN(size);
+	return p;
+}
+
+static size_t sw_filter_size(int out_n)
+{
+	return ALIGN(sizeof(struct sw_filter) +
+		     out_n * (SW_TAPS * sizeof(int) + 1), 4);
+}
+
+static inline int sext10(uint32_t v)
+{
+	v &= 0x3ff;
+	return (v & 0x200) ? (int)v - 0x400 : (int)v;
+}
+
+static inline uint8_t sw_clamp(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/* Each phase is two table writes: taps 2/3 through the 0x5fffc staging
+ * register, then taps 0/1 to the coefficient register itself.  Taps are
+ * 10 bit signed values in bits 0-9 and 22-31, summing to 1 << 9. */
+static void sw_load_filter(struct mdp_table_entry *table,
+			   struct sw_filter *f)
+{
+	uint32_t hi, lo;
+	int p;
+
+	for (p = 0; p < SW_PHASES; p++) {
+		hi = table[2 * p].val;
+		lo = table[2 * p + 1].val;
+		f->c[p][0] = sext10(lo);
+		f->c[p][1] = sext10(lo >> 22);
+		f->c[p][2] = sext10(hi);
+		f->c[p][3] = sext10(hi >> 22);
+	}
+}
+
+/* Source positions for each output sample: tap t of output i reads
+ * idx[i * SW_TAPS + t], clamped to the source rectangle like the PPP's
+ * edge repeat, with coefficients from phase ph[i]. */
+static void sw_positions(int32_t init, uint32_t step, int in, int out,
+			 int *idx, uint8_t *ph)
+{
+	int64_t pos = init;
+	int i, t, base, v;
+
+	for (i = 0; i < out; i++, pos += step) {
+		base = (int)(pos >> SW_PHASE_SHIFT);
+		ph[i] = (pos >> (SW_PHASE_SHIFT - 5)) & (SW_PHASES - 1);
+		for (t = 0; t < SW_TAPS; t++) {
+			v = base - 1 + t;
+			idx[i * SW_TAPS + t] = v < 0 ? 0 : (v >= in ? in - 1 : v);
+		}
+	}
+}
+
+static void sw_scale_row(const uint8_t *in, uint8_t *out, int out_w,
+			 const int *idx, const uint8_t *ph,
+			 const struct sw_filter *f)
+{
+	const uint8_t *p0, *p1, *p2, *p3;
+	const int *c;
+	int x, ch;
+
+	for (x = 0; x < out_w; x++) {
+		c = f->c[ph[x]];
+		p0 = in + 4 * idx[x * SW_TAPS + 0];
+		p1 = in + 4 * idx[x * SW_TAPS + 1];
+		p2 = in + 4 * idx[x * SW_TAPS + 2];
+		p3 = in + 4 * idx[x * SW_TAPS + 3];
+		for (ch = 0; ch < 4; ch++)
+			out[4 * x + ch] = sw_clamp((c[0] * p0[ch] +
+						    c[1] * p1[ch] +
+						    c[2] * p2[ch] +
+						    c[3] * p3[ch] +
+						    (1 << (SW_COEF_SHIFT - 1)))
+						   >> SW_COEF_SHIFT);
+	}
+}
+
+static void sw_scale_col(const uint8_t *r0, const uint8_t *r1,
+			 const uint8_t *r2, const uint8_t *r3,
+			 uint8_t *out, int n, const int *c)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		out[i] = sw_clamp((c[0] * r0[i] + c[1] * r1[i] +
+				   c[2] * r2[i] + c[3] * r3[i] +
+				   (1 << (SW_COEF_SHIFT - 1))) >> SW_COEF_SHIFT);
+}
+
+static uint32_t bpp_of(uint32_t format)
+{
+	switch (format) {
+	case MDP_RGB_565:
+		return 2;
+	case MDP_RGB_888:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+/* pixels are handled internally as 0xAARRGGBB */
+static uint32_t sw_read(const uint8_t *p, uint32_t format)
+{
+	uint32_t v, r, g, b;
+
+	switch (format) {
+	case MDP_RGB_565:
+		v = p[0] | (p[1] << 8);
+		r = (v >> 11) & 0x1f;
+		g = (v >> 5) & 0x3f;
+		b = v & 0x1f;
+		return 0xff000000 | (((r << 3) | (r >> 2)) << 16) |
+			(((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+	case MDP_RGB_888:
+		return 0xff000000 | (p[0] << 16) | (p[1] << 8) | p[2];
+	case MDP_RGBA_8888:
+		return (p[3] << 24) | (p[0] << 16) | (p[1] << 8) | p[2];
+	case MDP_RGBX_8888:
+		return 0xff000000 | (p[0] << 16) | (p[1] << 8) | p[2];
+	case MDP_XRGB_8888:
+		return 0xff000000 | (p[2] << 16) | (p[1] << 8) | p[0];
+	case MDP_ARGB_8888:
+	case MDP_BGRA_8888:
+	default:
+		return (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+	}
+}
+
+static void sw_write(uint8_t *p, uint32_t v, uint32_t format)
+{
+	uint32_t a = v >> 24, r = (v >> 16) & 0xff;
+	uint32_t g = (v >> 8) & 0xff, b = v & 0xff;
+
+	switch (format) {
+	case MDP_RGB_565:
+		v = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+		p[0] = v;
+		p[1] = v >> 8;
+		break;
+	case MDP_RGB_888:
+		p[0] = r;
+		p[1] = g;
+		p[2] = b;
+		break;
+	case MDP_RGBA_8888:
+	case MDP_RGBX_8888:
+		p[0] = r;
+		p[1] = g;
+		p[2] = b;
+		p[3] = a;
+		break;
+	case MDP_XRGB_8888:
+	case MDP_ARGB_8888:
+	case MDP_BGRA_8888:
+	default:
+		p[0] = b;
+		p[1] = g;
+		p[2] = r;
+		p[3] = a;
+		break;
+	}
+}
+
+static inline uint32_t div255(uint32_t x)
+{
+	return (x + 1 + (x >> 8)) >> 8;
+}
+
+static uint32_t sw_blend(uint32_t s, uint32_t d, uint32_t a)
+{
+	uint32_t out = 0;
+	int sh;
+
+	for (sh = 0; sh < 32; sh += 8)
+		out |= div255(((s >> sh) & 0xff) * a +
+			      ((d >> sh) & 0xff) * (255 - a)) << sh;
+	return out;
+}
+
+int mdp_ppp_sw_supported(struct mdp_blit_req *req)
+{
+	return IS_RGB(req->src.format) && IS_RGB(req->dst.format) &&
+		!(req->flags & MDP_BLUR) &&
+		req->transp_mask == MDP_TRANSP_NOP;
+}
+
+static int sw_scaled(int in_n, int out_n, uint32_t step)
+{
+	return in_n != out_n && step;
+}
+
+/* Scale one axis of a w x h ARGB image into out, using f (at least
+ * sw_filter_size() bytes) for the coefficients.  Returns out, or the
+ * input if the axis is not scaled. */
+static uint8_t *sw_scale(uint8_t *in, int w, int h, int out_w, int out_h,
+			 int horizontal, int32_t init, uint32_t step,
+			 int downscale, uint8_t *out, struct sw_filter *f)
+{
+	int *idx;
+	uint8_t *ph;
+	int in_n = horizontal ? w : h;
+	int out_n = horizontal ? out_w : out_h;
+	int y;
+
+	if (!sw_scaled(in_n, out_n, step))
+		return in;
+
+	idx = (int *)(f + 1);
+	ph = (uint8_t *)(idx + out_n * SW_TAPS);
+
+	if (out_n > in_n)
+		sw_load_filter(mdp_upscale_table, f);
+	else if (horizontal)
+		sw_load_filter(mdp_downscale_x_table[downscale], f);
+	else
+		sw_load_filter(mdp_downscale_y_table[downscale], f);
+	sw_positions(init, step, in_n, out_n, idx, ph);
+
+	if (horizontal) {
+		for (y = 0; y < h; y++)
+			sw_scale_row(in + y * w * 4, out + y * out_w * 4,
+				     out_w, idx, ph, f);
+	} else {
+		for (y = 0; y < out_h; y++) {
+			const int *r = idx + y * SW_TAPS;
+			sw_scale_col(in + r[0] * w * 4, in + r[1] * w * 4,
+				     in + r[2] * w * 4, in + r[3] * w * 4,
+				     out + y * w * 4, w * 4, f->c[ph[y]]);
+		}
+	}
+
+	return out;
+}
+
+int mdp_ppp_sw_blit(struct mdp_blit_req *req, struct ppp_regs *regs,
+		    void *src_base, void *dst_base, struct file *dst_file)
+{
+	uint32_t sbpp = bpp_of(req->src.format);
+	uint32_t dbpp = bpp_of(req->dst.format);
+	int src_w = req->src_rect.w, src_h = req->src_rect.h;
+	int dst_w = req->dst_rect.w, dst_h = req->dst_rect.h;
+	int rot90 = req->flags & MDP_ROT_90;
+	int sw = rot90 ? dst_h : dst_w;
+	int sh = rot90 ? dst_w : dst_h;
+	int scale_x = sw_scaled(src_w, sw, regs->phasex_step);
+	int scale_y = sw_scaled(src_h, sh, regs->phasey_step);
+	size_t src_size = src_w * src_h * 4;
+	size_t hbuf_size = scale_x ? sw * src_h * 4 : 0;
+	size_t vbuf_size = scale_y ? sw * sh * 4 : 0;
+	size_t filter_size = sw_filter_size(max(sw, sh));
+	uint8_t *src, *hbuf, *vbuf;
+	struct sw_filter *f;
+	uint32_t *img;
+	uint8_t *row;
+	uint32_t s, d, a;
+	int x, y, dx, dy, sx, sy;
+
+	if (!mdp_ppp_sw_supported(req))
+		return -EINVAL;
+
+	mutex_lock(&sw_scratch_lock);
+	src = sw_scratch_get(filter_size + src_size + hbuf_size + vbuf_size);
+	if (!src) {
+		mutex_unlock(&sw_scratch_lock);
+		return -ENOMEM;
+	}
+	f = (struct sw_filter *)src;
+	src += filter_size;
+
+	/* unpack the source rectangle */
+	img = (uint32_t *)src;
+	for (y = 0; y < src_h; y++) {
+		row = (uint8_t *)src_base + req->src.offset +
+			((req->src_rect.y + y) * req->src.width +
+			 req->src_rect.x) * sbpp;
+		for (x = 0; x < src_w; x++, row += sbpp)
+			*img++ = sw_read(row, req->src.format);
+	}
+
+	hbuf = sw_scale(src, src_w, src_h, sw, src_h, 1,
+			(int32_t)regs->phasex_init, regs->phasex_step,
+			regs->downscale_x, src + src_size, f);
+	vbuf = sw_scale(hbuf, sw, src_h, sw, sh, 0,
+			(int32_t)regs->phasey_init, regs->phasey_step,
+			regs->downscale_y, src + src_size + hbuf_size, f);
+
+	/* scaled (sw x sh) image -> rotate/flip -> blend into dst */
+	img = (uint32_t *)vbuf;
+	for (dy = 0; dy < dst_h; dy++) {
+		row = (uint8_t *)dst_base + req->dst.offset +
+			((req->dst_rect.y + dy) * req->dst.width +
+			 req->dst_rect.x) * dbpp;
+		for (dx = 0; dx < dst_w; dx++, row += dbpp) {
+			x = (req->flags & MDP_FLIP_LR) ? dst_w - 1 - dx : dx;
+			y = (req->flags & MDP_FLIP_UD) ? dst_h - 1 - dy : dy;
+			if (rot90) {
+				sx = y;
+				sy = sh - 1 - x;
+			} else {
+				sx = x;
+				sy = y;
+			}
+			s = img[sy * sw + sx];
+			if (regs->op & PPP_OP_BLEND_ON) {
+				d = sw_read(row, req->dst.format);
+				a = (regs->op & PPP_OP_BLEND_CONSTANT_ALPHA) ?
+					req->alpha : s >> 24;
+				s = sw_blend(s, d, a);
+			}
+			sw_write(row, s, req->dst.format);
+		}
+	}
+
+#ifdef CONFIG_ANDROID_PMEM
+	/* push the result out of the cache for the display and the PPP */
+	if (dst_file)
+		flush_pmem_file(dst_file, req->dst.offset,
+				(req->dst_rect.y + dst_h) * req->dst.width *
+				dbpp);
+#endif
+
+	mutex_unlock(&sw_scratch_lock);
+	return 0;
+}
+
+#if defined(CONFIG_DEBUG_FS)
+/* Write "src_w src_h dst_w dst_h" to time one RGB565 -> RGB565 scaled
+ * blit between vmalloc'ed buffers; read back the result. */
+static const struct mdp_info *bench_mdp;
+static char bench_result[128];
+
+/* Benchmark images are no bigger than the panel, in either orientation
+ * (WVGA until the framebuffer has registered). */
+static int sw_bench_size_ok(unsigned w, unsigned h)
+{
+	struct fb_info *fb = num_registered_fb ? registered_fb[0] : NULL;
+	unsigned xres = fb ? fb->var.xres : 800;
+	unsigned yres = fb ? fb->var.yres : 480;
+
+	return w <= max(xres, yres) && h <= max(xres, yres) &&
+	       w * h <= xres * yres;
+}
+
+static ssize_t sw_bench_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct mdp_blit_req req;
+	struct ppp_regs regs;
+	char tmp[64];
+	unsigned sw, sh, dw, dh;
+	void *src, *dst;
+	ktime_t start;
+	u64 us;
+	int ret;
+
+	if (count >= sizeof(tmp))
+		return -EINVAL;
+	if (copy_from_user(tmp, buf, count))
+		return -EFAULT;
+	tmp[count] = '\0';
+	if (sscanf(tmp, "%u %u %u %u", &sw, &sh, &dw, &dh) != 4 ||
+	    !sw || !sh || !dw || !dh ||
+	    !sw_bench_size_ok(sw, sh) || !sw_bench_size_ok(dw, dh))
+		return -EINVAL;
+
+	memset(&req, 0, sizeof(req));
+	req.src.width = sw;
+	req.src.height = sh;
+	req.src.format = MDP_RGB_565;
+	req.dst.width = dw;
+	req.dst.height = dh;
+	req.dst.format = MDP_RGB_565;
+	req.src_rect.w = sw;
+	req.src_rect.h = sh;
+	req.dst_rect.w = dw;
+	req.dst_rect.h = dh;
+	req.alpha = MDP_ALPHA_NOP;
+	req.transp_mask = MDP_TRANSP_NOP;
+
+	src = vmalloc(sw * sh * 2);
+	dst = vmalloc(dw * dh * 2);
+	if (!src || !dst) {
+		ret = -ENOMEM;
+		goto done;
+	}
+	memset(src, 0x5a, sw * sh * 2);
+
+	ret = mdp_ppp_prepare(bench_mdp, &req, &regs, 0, sw * sh * 2,
+			      0, dw * dh * 2);
+	if (ret)
+		goto done;
+
+	start = ktime_get();
+	ret = mdp_ppp_sw_blit(&req, &regs, src, dst, NULL);
+	us = div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)), 1000);
+	if (ret)
+		goto done;
+
+	scnprintf(bench_result, sizeof(bench_result),
+		  "%ux%u -> %ux%u: %llu us, %llu kpix/s\n", sw, sh, dw, dh,
+		  us, us ? div64_u64((u64)dw * dh * 1000, us) : 0);
+	ret = count;
+done:
+	vfree(src);
+	vfree(dst);
+	return ret;
+}
+
+static ssize_t sw_bench_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	return simple_read_from_buffer(buf, count, ppos, bench_result,
+				       strlen(bench_result));
+}
+
+static const struct file_operations sw_bench_fops = {
+	.read = sw_bench_read,
+	.write = sw_bench_write,
+};
+
+void mdp_ppp_sw_debugfs_init(const struct mdp_info *mdp,
+			     struct dentry *dent)
+{
+	bench_mdp = mdp;
+	debugfs_create_file("ppp_sw_bench", 0644, dent, NULL,
+			    &sw_bench_fops);
+}
+#endif
@@ -32,6 +32,9 @@
 #include <linux/clk.h>
 #include <linux/debugfs.h>
 #include <linux/dma-mapping.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/sort.h>
 
 extern void start_drawing_late_resume(struct early_suspend *h);
 static void msmfb_resume_handler(struct early_suspend *h);
@@ -72,6 +75,43 @@ module_param_named(msmfb_debug_mask, msmfb_debug_mask, int,
 
 struct mdp_device *mdp;
 
+/* updates that arrive while an earlier one is still waiting for vsync
+ * are merged into it rather than requesting another vsync, unless the
+ * request is older than this (a lost vsync) */
+#define MSMFB_COALESCE_NS (50 * NSEC_PER_MSEC)
+
+struct msmfb_stats {
+	unsigned long updates;
+	unsigned long merged;
+	unsigned long skipped;
+	unsigned long frames;
+	unsigned long vsyncs;
+	unsigned long fake_vsyncs;
+	unsigned long idle_wakeups;
+	u64 bytes;
+	u64 full_bytes;
+	/* bytes pushed to the panel in the current one second window */
+	u64 window_bytes;
+	ktime_t window_start;
+	u64 bytes_per_sec;
+};
+
+/* timestamps of one frame: pan_display entry (zero for updates that
+ * didn't come through pan_display), vsync, dma start and dma done */
+struct msmfb_frame {
+	ktime_t pan;
+	ktime_t vsync;
+	ktime_t dma;
+	ktime_t done;
+	uint16_t w;
+	uint16_t h;
+};
+
+#define MSMFB_FRAME_LOG 128
+/* frames that take longer than two refreshes from pan to dma done are
+ * counted as late */
+#define MSMFB_FRAME_LATE_NS (2 * NSEC_PER_SEC / 60)
+
 struct msmfb_info {
 	struct fb_info *fb;
 	struct msm_panel_data *panel;
@@ -105,6 +145,20 @@ struct msmfb_info {
 	struct hrtimer fake_vsync;
 	ktime_t vsync_request_time;
 	unsigned fb_resumed;
+	/* a vsync (or fake vsync) has been requested for update_info and
+	 * the dma hasn't been started yet */
+	int update_pending;
+	struct msmfb_stats stats;
+
+	/* per-frame timing: the frame being sent and a ring of the last
+	 * MSMFB_FRAME_LOG completed ones, all under update_lock */
+	ktime_t pan_time;
+	ktime_t vsync_time;
+	struct msmfb_frame frame_cur;
+	int frame_cur_valid;
+	struct msmfb_frame frame_log[MSMFB_FRAME_LOG];
+	unsigned frame_log_next;
+	unsigned long frames_late;
 };
 
 static int msmfb_open(struct fb_info *info, int user)
@@ -117,6 +171,22 @@ static int msmfb_release(struct fb_info *info, int user)
 	return 0;
 }
 
+/* Called with update_lock held */
+static void msmfb_frame_done(struct msmfb_info *msmfb)
+{
+	struct msmfb_frame *f = &msmfb->frame_cur;
+
+	if (!msmfb->frame_cur_valid)
+		return;
+	msmfb->frame_cur_valid = 0;
+	f->done = ktime_get();
+	if (ktime_to_ns(f->pan) &&
+	    ktime_to_ns(ktime_sub(f->done, f->pan)) > MSMFB_FRAME_LATE_NS)
+		msmfb->frames_late++;
+	msmfb->frame_log[msmfb->frame_log_next % MSMFB_FRAME_LOG] = *f;
+	msmfb->frame_log_next++;
+}
+
 /* Called from dma interrupt handler, must not sleep */
 static void msmfb_handle_dma_interrupt(struct msmfb_callback *callback)
 {
@@ -131,6 +201,7 @@ static void msmfb_handle_dma_interrupt(struct msmfb_callback *callback)
 #endif
 
 	spin_lock_irqsave(&msmfb->update_lock, irq_flags);
+	msmfb_frame_done(msmfb);
 	msmfb->frame_done = msmfb->frame_requested;
 	if (msmfb->sleeping == UPDATING &&
 	    msmfb->frame_done == msmfb->update_frame) {
@@ -153,6 +224,28 @@ static void msmfb_handle_dma_interrupt(struct msmfb_callback *callback)
 	wake_up(&msmfb->frame_wq);
 }
 
+/* Called with update_lock held */
+static void msmfb_account_dma(struct msmfb_info *msmfb, uint32_t w,
+			      uint32_t h)
+{
+	struct msmfb_stats *st = &msmfb->stats;
+	ktime_t now = ktime_get();
+	uint32_t bytes = w * h * BYTES_PER_PIXEL(msmfb);
+	s64 dt;
+
+	st->frames++;
+	st->bytes += bytes;
+	st->full_bytes += msmfb->xres * msmfb->yres * BYTES_PER_PIXEL(msmfb);
+	st->window_bytes += bytes;
+	dt = ktime_to_ns(ktime_sub(now, st->window_start));
+	if (dt >= NSEC_PER_SEC) {
+		st->bytes_per_sec = div64_u64(st->window_bytes * NSEC_PER_SEC,
+					      dt);
+		st->window_bytes = 0;
+		st->window_start = now;
+	}
+}
+
 static int msmfb_start_dma(struct msmfb_info *msmfb)
 {
 	uint32_t x, y, w, h;
@@ -163,6 +256,7 @@ static int msmfb_start_dma(struct msmfb_info *msmfb)
 	struct msm_panel_data *panel = msmfb->panel;
 
 	spin_lock_irqsave(&msmfb->update_lock, irq_flags);
+	msmfb->update_pending = 0;
 	time_since_request = ktime_to_ns(ktime_sub(ktime_get(),
 			     msmfb->vsync_request_time));
 	if (time_since_request > 20 * NSEC_PER_MSEC) {
@@ -172,6 +266,7 @@ static int msmfb_start_dma(struct msmfb_info *msmfb)
 			"request\n", time_since_request, us);
 	}
 	if (msmfb->frame_done == msmfb->frame_requested) {
+		msmfb->stats.idle_wakeups++;
 		spin_unlock_irqrestore(&msmfb->update_lock, irq_flags);
 		return -1;
 	}
@@ -196,6 +291,14 @@ static int msmfb_start_dma(struct msmfb_info *msmfb)
 		msmfb->frame_done = msmfb->frame_requested;
 		goto error;
 	}
+	msmfb_account_dma(msmfb, w, h);
+	msmfb->frame_cur.pan = msmfb->pan_time;
+	msmfb->frame_cur.vsync = msmfb->vsync_time;
+	msmfb->frame_cur.dma = ktime_get();
+	msmfb->frame_cur.w = w;
+	msmfb->frame_cur.h = h;
+	msmfb->frame_cur_valid = 1;
+	msmfb->pan_time = ktime_set(0, 0);
 	spin_unlock_irqrestore(&msmfb->update_lock, irq_flags);
 
 	addr = ((msmfb->xres * (yoffset + y) + x) * BYTES_PER_PIXEL(msmfb));
@@ -219,6 +322,8 @@ static void msmfb_handle_vsync_interrupt(struct msmfb_callback *callback)
 	struct msmfb_info *msmfb = container_of(callback, struct msmfb_info,
 					       vsync_callback);
 	wake_unlock(&msmfb->idle_lock);
+	msmfb->vsync_time = ktime_get();
+	msmfb->stats.vsyncs++;
 	msmfb_start_dma(msmfb);
 }
 
@@ -226,6 +331,8 @@ static enum hrtimer_restart msmfb_fake_vsync(struct hrtimer *timer)
 {
 	struct msmfb_info *msmfb  = container_of(timer, struct msmfb_info,
 					       fake_vsync);
+	msmfb->vsync_time = ktime_get();
+	msmfb->stats.fake_vsyncs++;
 	msmfb_start_dma(msmfb);
 	return HRTIMER_NORESTART;
 }
@@ -239,6 +346,9 @@ static void msmfb_pan_update(struct fb_info *info, uint32_t left, uint32_t top,
 	unsigned long irq_flags;
 	int sleeping;
 	int retry = 1;
+	int merge;
+	ktime_t now;
+	ktime_t entry = ktime_get();
 #if PRINT_FPS
 	ktime_t t1, t2;
 	static uint64_t pans;
@@ -312,6 +422,23 @@ restart:
 	}
 #endif
 
+	/* clip to the panel; an empty rectangle that doesn't move the
+	 * display offset leaves the panel contents as they are */
+	if (eright > msmfb->xres)
+		eright = msmfb->xres;
+	if (ebottom > msmfb->yres)
+		ebottom = msmfb->yres;
+	if ((left >= eright || top >= ebottom) &&
+	    (!pan_display || yoffset == msmfb->yoffset)) {
+		msmfb->stats.skipped++;
+		spin_unlock_irqrestore(&msmfb->update_lock, irq_flags);
+		return;
+	}
+	msmfb->stats.updates++;
+	/* a frame merging several pans is timed from the first one */
+	if (pan_display && !ktime_to_ns(msmfb->pan_time))
+		msmfb->pan_time = entry;
+
 	msmfb->frame_requested++;
 	/* if necessary, update the y offset, if this is the
 	 * first full update on resume, set the sleeping state */
@@ -340,11 +467,24 @@ restart:
 		msmfb->update_info.left, msmfb->update_info.top,
 		msmfb->update_info.eright, msmfb->update_info.ebottom,
 		msmfb->yoffset);
+
+	/* the dma for the pending request hasn't started yet, so it will
+	 * pick up the merged rectangle: don't ask for another vsync */
+	now = ktime_get();
+	merge = msmfb->update_pending &&
+		ktime_to_ns(ktime_sub(now, msmfb->vsync_request_time)) <
+		MSMFB_COALESCE_NS;
+	if (merge) {
+		msmfb->stats.merged++;
+		spin_unlock_irqrestore(&msmfb->update_lock, irq_flags);
+		return;
+	}
+	msmfb->update_pending = 1;
+	msmfb->vsync_request_time = now;
 	spin_unlock_irqrestore(&msmfb->update_lock, irq_flags);
 
 	/* if the panel is all the way on wait for vsync, otherwise sleep
 	 * for 16 ms (long enough for the dma to panel) and then begin dma */
-	msmfb->vsync_request_time = ktime_get();
 	if (panel->request_vsync && (sleeping == AWAKE)) {
 		wake_lock_timeout(&msmfb->idle_lock, HZ/4);
 		panel->request_vsync(panel, &msmfb->vsync_callback);
@@ -577,27 +717,70 @@ static void msmfb_imageblit(struct fb_info *p, const struct fb_image *image)
 }
 
 
+#define MSMFB_BLIT_BATCH 8
+
 static int msmfb_blit(struct fb_info *info,
 		      void __user *p)
 {
-	struct mdp_blit_req req;
 	struct mdp_blit_req_list req_list;
-	int i;
-	int ret;
+	struct mdp_blit_req_list *list = (struct mdp_blit_req_list *)p;
+	struct mdp_blit_req *req;
+	int i, n;
+	int ret = 0;
 
 	if (copy_from_user(&req_list, p, sizeof(req_list)))
 		return -EFAULT;
+	if (!req_list.count)
+		return 0;
 
-	for (i = 0; i < req_list.count; i++) {
-		struct mdp_blit_req_list *list =
-			(struct mdp_blit_req_list *)p;
-		if (copy_from_user(&req, &list->req[i], sizeof(req)))
-			return -EFAULT;
-		ret = mdp->blit(mdp, info, &req);
+	/* hand the requests to the mdp in batches so it can set up the
+	 * next blit while the current one is running */
+	n = min_t(uint32_t, req_list.count, MSMFB_BLIT_BATCH);
+	req = kmalloc(n * sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	for (i = 0; i < req_list.count; i += n) {
+		n = min_t(uint32_t, req_list.count - i, MSMFB_BLIT_BATCH);
+		if (copy_from_user(req, &list->req[i], n * sizeof(*req))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = mdp->blit_list(mdp, info, req, n);
 		if (ret)
-			return ret;
+			break;
 	}
-	return 0;
+
+	kfree(req);
+	return ret;
+}
+
+static int msmfb_async_blit(struct fb_info *info, void __user *p)
+{
+	struct mdp_async_blit ab;
+	struct mdp_blit_req *req;
+	int ret;
+
+	if (copy_from_user(&ab, p, sizeof(ab)))
+		return -EFAULT;
+	if (!ab.count || ab.count > MDP_ASYNC_BLIT_MAX)
+		return -EINVAL;
+
+	req = kmalloc(ab.count * sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	if (copy_from_user(req, ab.req, ab.count * sizeof(*req))) {
+		ret = -EFAULT;
+		goto done;
+	}
+
+	ret = mdp->blit_async(mdp, info, req, ab.count, &ab.fence);
+	if (!ret && copy_to_user(p, &ab, sizeof(ab)))
+		ret = -EFAULT;
+done:
+	kfree(req);
+	return ret;
 }
 
 
@@ -628,6 +811,16 @@ static int msmfb_ioctl(struct fb_info *p, unsigned int cmd, unsigned long arg)
 		       ktime_to_ns(t2) - ktime_to_ns(t1));
 #endif
 		break;
+	case MSMFB_ASYNC_BLIT:
+		ret = msmfb_async_blit(p, argp);
+		if (ret)
+			return ret;
+		break;
+	case MSMFB_BLIT_WAIT:
+		ret = mdp->blit_wait(mdp, arg);
+		if (ret)
+			return ret;
+		break;
 	default:
 			printk(KERN_INFO "msmfb unknown ioctl: %d\n", cmd);
 			return -EINVAL;
@@ -659,6 +852,35 @@ static ssize_t debug_open(struct inode *inode, struct file *file)
 }
 
 
+/* Called with update_lock held */
+static int msmfb_stats_print(struct msmfb_info *msmfb, char *buf, int size)
+{
+	struct msmfb_stats *st = &msmfb->stats;
+	u64 rate = st->bytes_per_sec;
+	s64 dt;
+	int n = 0;
+
+	/* no dma has closed the window for a while, report the rate
+	 * since the window was opened instead of a stale one */
+	dt = ktime_to_ns(ktime_sub(ktime_get(), st->window_start));
+	if (dt >= 2 * NSEC_PER_SEC)
+		rate = div64_u64(st->window_bytes * NSEC_PER_SEC, dt);
+
+	n += scnprintf(buf + n, size - n, "updates %lu\n", st->updates);
+	n += scnprintf(buf + n, size - n, "merged %lu\n", st->merged);
+	n += scnprintf(buf + n, size - n, "skipped %lu\n", st->skipped);
+	n += scnprintf(buf + n, size - n, "frames %lu\n", st->frames);
+	n += scnprintf(buf + n, size - n, "vsyncs %lu\n", st->vsyncs);
+	n += scnprintf(buf + n, size - n, "fake_vsyncs %lu\n",
+		       st->fake_vsyncs);
+	n += scnprintf(buf + n, size - n, "idle_wakeups %lu\n",
+		       st->idle_wakeups);
+	n += scnprintf(buf + n, size - n, "bytes %llu (full frames %llu)\n",
+		       st->bytes, st->full_bytes);
+	n += scnprintf(buf + n, size - n, "bytes_per_sec %llu\n", rate);
+	return n;
+}
+
 static ssize_t debug_read(struct file *file, char __user *buf, size_t count,
 			  loff_t *ppos)
 {
@@ -678,6 +900,7 @@ static ssize_t debug_read(struct file *file, char __user *buf, size_t count,
 		       msmfb->sleeping);
 	n += scnprintf(buffer + n, debug_bufmax, "update_frame %d\n",
 		       msmfb->update_frame);
+	n += msmfb_stats_print(msmfb, buffer + n, debug_bufmax - n);
 	spin_unlock_irqrestore(&msmfb->update_lock, irq_flags);
 	n++;
 	buffer[n] = 0;
@@ -688,6 +911,102 @@ static struct file_operations debug_fops = {
 	.read = debug_read,
 	.open = debug_open,
 };
+
+static int frame_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int frame_percentiles(char *buf, int size, const char *name,
+			     uint32_t *v, int count)
+{
+	if (!count)
+		return 0;
+	sort(v, count, sizeof(*v), frame_cmp, NULL);
+	return scnprintf(buf, size, "%-12s p50 %6u p90 %6u p99 %6u "
+			 "max %6u\n", name, v[count / 2],
+			 v[count * 9 / 10], v[count * 99 / 100],
+			 v[count - 1]);
+}
+
+static inline uint32_t frame_us(ktime_t from, ktime_t to)
+{
+	return (uint32_t)div_u64(ktime_to_ns(ktime_sub(to, from)),
+				 NSEC_PER_USEC);
+}
+
+/* Dumps the frame log, oldest first, as microseconds from the previous
+ * stage, followed by percentiles over the logged frames. */
+static ssize_t frames_read(struct file *file, char __user *buf, size_t count,
+			   loff_t *ppos)
+{
+	const int size = 16384;
+	struct msmfb_info *msmfb = file->private_data;
+	struct msmfb_frame *log;
+	uint32_t *total, *dma, *wait;
+	unsigned long irq_flags;
+	unsigned first, next;
+	unsigned long late;
+	int i, n = 0, nr, npan = 0;
+	char *tmp;
+	ssize_t ret;
+
+	tmp = kmalloc(size, GFP_KERNEL);
+	log = kmalloc(sizeof(msmfb->frame_log) +
+		      3 * MSMFB_FRAME_LOG * sizeof(uint32_t), GFP_KERNEL);
+	if (!tmp || !log) {
+		ret = -ENOMEM;
+		goto done;
+	}
+	total = (uint32_t *)(log + MSMFB_FRAME_LOG);
+	dma = total + MSMFB_FRAME_LOG;
+	wait = dma + MSMFB_FRAME_LOG;
+
+	spin_lock_irqsave(&msmfb->update_lock, irq_flags);
+	next = msmfb->frame_log_next;
+	first = next > MSMFB_FRAME_LOG ? next - MSMFB_FRAME_LOG : 0;
+	nr = next - first;
+	for (i = 0; i < nr; i++)
+		log[i] = msmfb->frame_log[(first + i) % MSMFB_FRAME_LOG];
+	late = msmfb->frames_late;
+	spin_unlock_irqrestore(&msmfb->update_lock, irq_flags);
+
+	n += scnprintf(tmp + n, size - n, "frame     pan>vsync vsync>dma "
+		       "dma>done      w    h\n");
+	for (i = 0; i < nr; i++) {
+		struct msmfb_frame *f = &log[i];
+		int has_pan = ktime_to_ns(f->pan) != 0;
+
+		n += scnprintf(tmp + n, size - n, "%8u %9u %9u %9u %6u %4u\n",
+			       first + i,
+			       has_pan ? frame_us(f->pan, f->vsync) : 0,
+			       frame_us(f->vsync, f->dma),
+			       frame_us(f->dma, f->done), f->w, f->h);
+		dma[i] = frame_us(f->dma, f->done);
+		if (has_pan) {
+			wait[npan] = frame_us(f->pan, f->vsync);
+			total[npan] = frame_us(f->pan, f->done);
+			npan++;
+		}
+	}
+	n += scnprintf(tmp + n, size - n, "frames %u late %lu\n", next, late);
+	n += frame_percentiles(tmp + n, size - n, "pan>vsync", wait, npan);
+	n += frame_percentiles(tmp + n, size - n, "dma>done", dma, nr);
+	n += frame_percentiles(tmp + n, size - n, "pan>done", total, npan);
+
+	ret = simple_read_from_buffer(buf, count, ppos, tmp, n);
+done:
+	kfree(log);
+	kfree(tmp);
+	return ret;
+}
+
+static struct file_operations frames_fops = {
+	.read = frames_read,
+	.open = debug_open,
+};
 #endif
 
 #define BITS_PER_PIXEL 16
@@ -852,6 +1171,8 @@ static int msmfb_probe(struct platform_device *pdev)
 #if MSMFB_DEBUG
 	debugfs_create_file("msm_fb", S_IFREG | S_IRUGO, NULL,
 			    (void *)fb->par, &debug_fops);
+	debugfs_create_file("msm_fb_frames", S_IFREG | S_IRUGO, NULL,
+			    (void *)fb->par, &frames_fops);
 #endif
 
 	printk(KERN_INFO "msmfb_probe() installing %d x %d panel\n",
@@ -29,6 +29,8 @@
  * the suspend handlers have already been called without a matching call to the
  * resume handlers, the suspend handler will be called directly from
  * register_early_suspend. This direct call can violate the normal level order.
+ * When the early_suspend.parallel parameter is set, handlers that share a level
+ * may be called concurrently; only handlers on different levels are ordered.
  */
 enum {
 	EARLY_SUSPEND_LEVEL_BLANK_SCREEN = 50,
@@ -41,6 +43,9 @@ struct early_suspend {
 	int level;
 	void (*suspend)(struct early_suspend *h);
 	void (*resume)(struct early_suspend *h);
+	/* how long the last calls took, filled in by the core */
+	unsigned suspend_us;
+	unsigned resume_us;
 #endif
 };
 
@@ -81,4 +81,22 @@ struct adsp_pmem_info {
 #define ADSP_IOCTL_LINK_TASK \
 	_IOW(ADSP_IOCTL_MAGIC, 16, unsigned)
 
+/* ADSP_IOCTL_WRITE_COMMANDS
+ * Verify and write up to ADSP_MAX_COMMANDS commands, possibly to
+ * different queues, in one call.  Nothing is written unless every
+ * command verifies.  written returns how many commands reached the
+ * DSP.
+ */
+#define ADSP_MAX_COMMANDS	16
+#define ADSP_MAX_COMMANDS_LEN	4096	/* bytes, all commands */
+
+struct adsp_command_list_t {
+	uint32_t count;
+	struct adsp_command_t *cmds;
+	uint32_t written;
+};
+
+#define ADSP_IOCTL_WRITE_COMMANDS \
+	_IOWR(ADSP_IOCTL_MAGIC, 17, struct adsp_command_list_t *)
+
 #endif
@@ -60,6 +60,8 @@
 #define AUDIO_ENABLE_AUXPGA_LOOPBACK _IOW(AUDIO_IOCTL_MAGIC, 40, unsigned)
 #define AUDIO_SET_AUXPGA_GAIN       _IOW(AUDIO_IOCTL_MAGIC, 41, unsigned)
 #define AUDIO_SET_RX_MUTE           _IOW(AUDIO_IOCTL_MAGIC, 42, unsigned)
+#define AUDIO_GET_MMAP_POS          _IOR(AUDIO_IOCTL_MAGIC, 43, unsigned)
+#define AUDIO_MMAP_ACK              _IOW(AUDIO_IOCTL_MAGIC, 44, unsigned)
 
 #define	AUDIO_MAX_COMMON_IOCTL_NUM	100
 
@@ -80,6 +82,17 @@ struct msm_audio_stats {
 	uint32_t unused[2];
 };
 
+/* AUDIO_GET_MMAP_POS: pcm output buffers mapped with mmap(), period
+ * n at offset n * buffer_size.  Fill the period returned here, then
+ * hand it to the DSP with AUDIO_MMAP_ACK (argument: bytes written).
+ */
+struct msm_audio_mmap_pos {
+	uint32_t period;	/* period to fill next */
+	uint32_t avail;		/* nonzero if it may be written */
+	uint32_t hw_bytes;	/* bytes played by the DSP so far */
+	uint32_t underruns;
+};
+
 struct msm_mute_info {
 	uint32_t mute;
 	uint32_t path;
@@ -19,6 +19,9 @@
 #define MSMFB_IOCTL_MAGIC 'm'
 #define MSMFB_GRP_DISP          _IOW(MSMFB_IOCTL_MAGIC, 1, unsigned int)
 #define MSMFB_BLIT              _IOW(MSMFB_IOCTL_MAGIC, 2, unsigned int)
+#define MSMFB_ASYNC_BLIT        _IOWR(MSMFB_IOCTL_MAGIC, 3, \
+				      struct mdp_async_blit)
+#define MSMFB_BLIT_WAIT         _IOW(MSMFB_IOCTL_MAGIC, 4, unsigned int)
 
 enum {
 	MDP_RGB_565,      // RGB 565 planer
@@ -85,4 +88,16 @@ struct mdp_blit_req_list {
 	struct mdp_blit_req req[];
 };
 
+/* MSMFB_ASYNC_BLIT queues count requests and returns at once, filling in
+ * fence.  MSMFB_BLIT_WAIT blocks until the given fence and every fence
+ * handed out before it have completed, and fails with the blit error if
+ * the requests queued under that fence failed. */
+#define MDP_ASYNC_BLIT_MAX 32
+
+struct mdp_async_blit {
+	uint32_t count;
+	uint32_t fence;
+	struct mdp_blit_req *req;
+};
+
 #endif //_MSM_MDP_H_
@@ -0,0 +1,70 @@
+/* include/linux/suspend_profile.h
+ *
+ * Suspend/resume latency profiler.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _LINUX_SUSPEND_PROFILE_H
+#define _LINUX_SUSPEND_PROFILE_H
+
+#include <linux/ktime.h>
+
+struct device;
+
+/* Device callback phases, in the order they run during a cycle */
+enum {
+	SUSPEND_PROFILE_SUSPEND,
+	SUSPEND_PROFILE_SUSPEND_LATE,
+	SUSPEND_PROFILE_RESUME_EARLY,
+	SUSPEND_PROFILE_RESUME,
+	SUSPEND_PROFILE_PHASES,
+};
+
+/* Points in a cycle that are timestamped.  Some of them fall between
+ * sysdev_suspend() and sysdev_resume(), where timekeeping and the clock
+ * event devices (and with them sched_clock() on some platforms) are
+ * stopped, so these are read from suspend_profile_clock().
+ */
+enum {
+	SUSPEND_PROFILE_BEGIN,
+	SUSPEND_PROFILE_DEVICES_OFF,	/* all suspend callbacks done */
+	SUSPEND_PROFILE_PLATFORM_ENTER,	/* calling suspend_ops->enter */
+	SUSPEND_PROFILE_SLEEP_ENTER,	/* platform is about to sleep */
+	SUSPEND_PROFILE_SLEEP_EXIT,	/* platform woke up */
+	SUSPEND_PROFILE_PLATFORM_EXIT,	/* suspend_ops->enter returned */
+	SUSPEND_PROFILE_DEVICES_ON,	/* all resume callbacks done */
+	SUSPEND_PROFILE_END,
+	SUSPEND_PROFILE_MARKS,
+};
+
+#ifdef CONFIG_SUSPEND_PROFILE
+/* Nanoseconds from a clock that keeps running through suspend.  The
+ * default uses read_persistent_clock(); platforms with a better counter
+ * override it.  Only called with interrupts off.
+ */
+u64 suspend_profile_clock(void);
+
+void suspend_profile_begin(void);
+void suspend_profile_end(int error);
+void suspend_profile_mark(int mark);
+void suspend_profile_device(struct device *dev, int phase, ktime_t start);
+static inline ktime_t suspend_profile_now(void) { return ktime_get(); }
+#else
+static inline void suspend_profile_begin(void) {}
+static inline void suspend_profile_end(int error) {}
+static inline void suspend_profile_mark(int mark) {}
+static inline void
+suspend_profile_device(struct device *dev, int phase, ktime_t start) {}
+static inline ktime_t suspend_profile_now(void) { return ktime_set(0, 0); }
+#endif
+
+#endif
@@ -20,6 +20,11 @@
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
 
 #include "power.h"
 
@@ -29,9 +34,20 @@ enum {
 };
 static int debug_mask = DEBUG_USER_STATE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
+static int parallel;
+module_param_named(parallel, parallel, int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+#define EARLY_SUSPEND_THREADS 4
 
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
+static int early_suspend_count;
+static struct workqueue_struct *early_suspend_wq[EARLY_SUSPEND_THREADS];
+
+/* duration of the last early_suspend and late_resume, in us */
+static unsigned last_suspend_us;
+static unsigned last_sync_us;
+static unsigned last_resume_us;
 static void early_suspend(struct work_struct *work);
 static void late_resume(struct work_struct *work);
 static DECLARE_WORK(early_suspend_work, early_suspend);
@@ -56,6 +72,7 @@ void register_early_suspend(struct early_suspend *handler)
 			break;
 	}
 	list_add_tail(&handler->link, pos);
+	early_suspend_count++;
 	if ((state & SUSPENDED) && handler->suspend)
 		handler->suspend(handler);
 	mutex_unlock(&early_suspend_lock);
@@ -66,15 +83,159 @@ void unregister_early_suspend(struct early_suspend *handler)
 {
 	mutex_lock(&early_suspend_lock);
 	list_del(&handler->link);
+	early_suspend_count--;
 	mutex_unlock(&early_suspend_lock);
 }
 EXPORT_SYMBOL(unregister_early_suspend);
 
-static void early_suspend(struct work_struct *work)
+struct early_suspend_job {
+	struct work_struct work;
+	struct early_suspend *handler;
+	int resume;
+	atomic_t *pending;
+	struct completion *done;
+};
+
+static void early_suspend_call(struct early_suspend *handler, int resume)
+{
+	ktime_t start = ktime_get();
+	unsigned us;
+
+	if (resume)
+		handler->resume(handler);
+	else
+		handler->suspend(handler);
+
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	if (resume)
+		handler->resume_us = us;
+	else
+		handler->suspend_us = us;
+}
+
+static void early_suspend_job_func(struct work_struct *work)
+{
+	struct early_suspend_job *job =
+		container_of(work, struct early_suspend_job, work);
+
+	early_suspend_call(job->handler, job->resume);
+	if (atomic_dec_and_test(job->pending))
+		complete(job->done);
+}
+
+/* Run handlers that share a level, handing all but the first to the
+ * early suspend threads, and wait for all of them.
+ */
+static void early_suspend_run_level(struct early_suspend_job *jobs, int count,
+				    int resume)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	atomic_t pending;
+	int i;
+
+	if (count == 1 || !parallel || !early_suspend_wq[0]) {
+		for (i = 0; i < count; i++)
+			early_suspend_call(jobs[i].handler, resume);
+		return;
+	}
+
+	atomic_set(&pending, count - 1);
+	for (i = 1; i < count; i++) {
+		INIT_WORK(&jobs[i].work, early_suspend_job_func);
+		jobs[i].resume = resume;
+		jobs[i].pending = &pending;
+		jobs[i].done = &done;
+		queue_work(early_suspend_wq[(i - 1) % EARLY_SUSPEND_THREADS],
+			   &jobs[i].work);
+	}
+	early_suspend_call(jobs[0].handler, resume);
+	wait_for_completion(&done);
+}
+
+/* Create the early suspend threads the first time parallel mode is
+ * used.  Must be called with early_suspend_lock held.
+ */
+static void early_suspend_start_threads(void)
+{
+	/* the workqueue keeps a pointer to its name */
+	static const char *names[EARLY_SUSPEND_THREADS] = {
+		"early_suspend/0", "early_suspend/1",
+		"early_suspend/2", "early_suspend/3",
+	};
+	struct workqueue_struct *wq[EARLY_SUSPEND_THREADS];
+	int i;
+
+	if (early_suspend_wq[0])
+		return;
+
+	for (i = 0; i < EARLY_SUSPEND_THREADS; i++) {
+		wq[i] = create_singlethread_workqueue(names[i]);
+		if (!wq[i]) {
+			pr_err("early_suspend: failed to create workqueue\n");
+			while (i--)
+				destroy_workqueue(wq[i]);
+			return;
+		}
+	}
+	memcpy(early_suspend_wq, wq, sizeof(wq));
+}
+
+/* Call every suspend (or resume) handler, level by level.  Must be called
+ * with early_suspend_lock held.
+ */
+static void early_suspend_run(int resume)
 {
 	struct early_suspend *pos;
+	struct early_suspend_job *jobs;
+	int count = 0;
+	int first, i;
+
+	if (parallel)
+		early_suspend_start_threads();
+
+	jobs = kcalloc(early_suspend_count, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs) {
+		/* fall back to calling them one at a time */
+		if (resume) {
+			list_for_each_entry_reverse(pos,
+					&early_suspend_handlers, link)
+				if (pos->resume != NULL)
+					early_suspend_call(pos, 1);
+		} else {
+			list_for_each_entry(pos, &early_suspend_handlers, link)
+				if (pos->suspend != NULL)
+					early_suspend_call(pos, 0);
+		}
+		return;
+	}
+
+	if (resume) {
+		list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
+			if (pos->resume != NULL)
+				jobs[count++].handler = pos;
+	} else {
+		list_for_each_entry(pos, &early_suspend_handlers, link)
+			if (pos->suspend != NULL)
+				jobs[count++].handler = pos;
+	}
+
+	for (first = 0; first < count; first = i) {
+		int level = jobs[first].handler->level;
+
+		for (i = first + 1; i < count; i++)
+			if (jobs[i].handler->level != level)
+				break;
+		early_suspend_run_level(jobs + first, i - first, resume);
+	}
+
+	kfree(jobs);
+}
+
+static void early_suspend(struct work_struct *work)
+{
 	unsigned long irqflags;
 	int abort = 0;
+	ktime_t start;
 
 	pr_info("[R] early_suspend start\n");
 	mutex_lock(&early_suspend_lock);
@@ -94,16 +255,17 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
-	list_for_each_entry(pos, &early_suspend_handlers, link) {
-		if (pos->suspend != NULL)
-			pos->suspend(pos);
-	}
+	start = ktime_get();
+	early_suspend_run(0);
+	last_suspend_us = ktime_to_us(ktime_sub(ktime_get(), start));
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: sync\n");
 
+	start = ktime_get();
 	sys_sync();
+	last_sync_us = ktime_to_us(ktime_sub(ktime_get(), start));
 abort:
 	spin_lock_irqsave(&state_lock, irqflags);
 	if (state == SUSPEND_REQUESTED_AND_SUSPENDED)
@@ -114,9 +276,9 @@ abort:
 
 static void late_resume(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	ktime_t start;
 
 	pr_info("[R] late_resume start\n");
 	mutex_lock(&early_suspend_lock);
@@ -134,9 +296,9 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
-	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
-		if (pos->resume != NULL)
-			pos->resume(pos);
+	start = ktime_get();
+	early_suspend_run(1);
+	last_resume_us = ktime_to_us(ktime_sub(ktime_get(), start));
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: done\n");
 abort:
@@ -180,3 +342,51 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_stats_show(struct seq_file *m, void *unused)
+{
+	struct early_suspend *pos;
+	unsigned suspend_sum = 0, resume_sum = 0;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(m, "level  suspend_us  resume_us  handler\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link) {
+		seq_printf(m, "%5d  %10u  %9u  %pF\n",
+			   pos->level, pos->suspend_us, pos->resume_us,
+			   pos->suspend ? (void *)pos->suspend :
+					  (void *)pos->resume);
+		suspend_sum += pos->suspend_us;
+		resume_sum += pos->resume_us;
+	}
+	seq_printf(m, "\nearly_suspend: %u us (handlers %u us), sync %u us\n",
+		   last_suspend_us, suspend_sum, last_sync_us);
+	seq_printf(m, "late_resume:   %u us (handlers %u us)\n",
+		   last_resume_us, resume_sum);
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_stats_show, NULL);
+}
+
+static const struct file_operations early_suspend_stats_fops = {
+	.open = early_suspend_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+#endif
+
+#ifdef CONFIG_DEBUG_FS
+static int __init early_suspend_init(void)
+{
+	debugfs_create_file("early_suspend", S_IRUGO, NULL, NULL,
+			    &early_suspend_stats_fops);
+	return 0;
+}
+
+late_initcall(early_suspend_init);
+#endif
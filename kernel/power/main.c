@@ -22,6 +22,7 @@
 #include <linux/freezer.h>
 #include <linux/vmstat.h>
 #include <linux/syscalls.h>
+#include <linux/suspend_profile.h>
 
 #include "power.h"
 
@@ -300,8 +301,11 @@ static int suspend_enter(suspend_state_t state)
 
 	error = sysdev_suspend(PMSG_SUSPEND);
 	if (!error) {
-		if (!suspend_test(TEST_CORE))
+		if (!suspend_test(TEST_CORE)) {
+			suspend_profile_mark(SUSPEND_PROFILE_PLATFORM_ENTER);
 			error = suspend_ops->enter(state);
+			suspend_profile_mark(SUSPEND_PROFILE_PLATFORM_EXIT);
+		}
 		sysdev_resume();
 	}
 
@@ -331,12 +335,14 @@ int suspend_devices_and_enter(suspend_state_t state)
 			goto Close;
 	}
 	suspend_console();
+	suspend_profile_begin();
 	suspend_test_start();
 	error = device_suspend(PMSG_SUSPEND);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to suspend\n");
 		goto Recover_platform;
 	}
+	suspend_profile_mark(SUSPEND_PROFILE_DEVICES_OFF);
 	suspend_test_finish("suspend devices");
 	if (suspend_test(TEST_DEVICES))
 		goto Recover_platform;
@@ -362,6 +368,8 @@ int suspend_devices_and_enter(suspend_state_t state)
 	suspend_test_start();
 	device_resume(PMSG_RESUME);
 	suspend_test_finish("resume devices");
+	suspend_profile_mark(SUSPEND_PROFILE_DEVICES_ON);
+	suspend_profile_end(error);
 	resume_console();
  Close:
 	if (suspend_ops->end)
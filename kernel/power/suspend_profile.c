@@ -0,0 +1,225 @@
+/* kernel/power/suspend_profile.c
+ *
+ * Suspend/resume latency profiler.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/init.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/suspend_profile.h>
+
+/*
+ * Keeps the last SUSPEND_PROFILE_CYCLES suspend cycles.  For each cycle only
+ * the SUSPEND_PROFILE_TOP slowest device callbacks are remembered, plus the
+ * per-phase totals, so recording never allocates and can run with
+ * interrupts off.
+ */
+#define SUSPEND_PROFILE_CYCLES 8
+#define SUSPEND_PROFILE_TOP 10
+
+struct suspend_profile_entry {
+	char name[24];
+	u32 us;
+	u8 phase;
+};
+
+struct suspend_profile_cycle {
+	unsigned seq;
+	int error;
+	u64 mark_ns[SUSPEND_PROFILE_MARKS];	/* suspend_profile_clock() */
+	u32 phase_us[SUSPEND_PROFILE_PHASES];
+	u16 phase_count[SUSPEND_PROFILE_PHASES];
+	int top_count;
+	struct suspend_profile_entry top[SUSPEND_PROFILE_TOP];
+};
+
+static struct suspend_profile_cycle cycles[SUSPEND_PROFILE_CYCLES];
+static struct suspend_profile_cycle *current_cycle;
+static unsigned cycle_seq;
+static DEFINE_SPINLOCK(suspend_profile_lock);
+
+static const char *phase_names[SUSPEND_PROFILE_PHASES] = {
+	[SUSPEND_PROFILE_SUSPEND] = "suspend",
+	[SUSPEND_PROFILE_SUSPEND_LATE] = "suspend_late",
+	[SUSPEND_PROFILE_RESUME_EARLY] = "resume_early",
+	[SUSPEND_PROFILE_RESUME] = "resume",
+};
+
+u64 __weak suspend_profile_clock(void)
+{
+	return (u64)read_persistent_clock() * NSEC_PER_SEC;
+}
+
+void suspend_profile_begin(void)
+{
+	struct suspend_profile_cycle *c;
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&suspend_profile_lock, irqflags);
+	c = &cycles[cycle_seq % SUSPEND_PROFILE_CYCLES];
+	memset(c, 0, sizeof(*c));
+	c->seq = ++cycle_seq;
+	c->mark_ns[SUSPEND_PROFILE_BEGIN] = suspend_profile_clock();
+	current_cycle = c;
+	spin_unlock_irqrestore(&suspend_profile_lock, irqflags);
+}
+
+void suspend_profile_end(int error)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&suspend_profile_lock, irqflags);
+	if (current_cycle) {
+		current_cycle->error = error;
+		current_cycle->mark_ns[SUSPEND_PROFILE_END] =
+			suspend_profile_clock();
+		current_cycle = NULL;
+	}
+	spin_unlock_irqrestore(&suspend_profile_lock, irqflags);
+}
+
+void suspend_profile_mark(int mark)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&suspend_profile_lock, irqflags);
+	if (current_cycle)
+		current_cycle->mark_ns[mark] = suspend_profile_clock();
+	spin_unlock_irqrestore(&suspend_profile_lock, irqflags);
+}
+
+void suspend_profile_device(struct device *dev, int phase, ktime_t start)
+{
+	struct suspend_profile_cycle *c;
+	struct suspend_profile_entry *e;
+	unsigned long irqflags;
+	u32 us = ktime_to_us(ktime_sub(ktime_get(), start));
+	int i;
+
+	spin_lock_irqsave(&suspend_profile_lock, irqflags);
+	c = current_cycle;
+	if (!c)
+		goto done;
+	c->phase_us[phase] += us;
+	c->phase_count[phase]++;
+
+	/* keep top[] sorted, slowest first */
+	i = c->top_count;
+	if (i == SUSPEND_PROFILE_TOP) {
+		if (us <= c->top[i - 1].us)
+			goto done;
+		i--;
+	} else {
+		c->top_count++;
+	}
+	for (; i > 0 && c->top[i - 1].us < us; i--)
+		c->top[i] = c->top[i - 1];
+	e = &c->top[i];
+	strlcpy(e->name, dev_name(dev), sizeof(e->name));
+	e->us = us;
+	e->phase = phase;
+done:
+	spin_unlock_irqrestore(&suspend_profile_lock, irqflags);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static long long mark_delta_us(struct suspend_profile_cycle *c,
+			       int from, int to)
+{
+	if (!c->mark_ns[from] || !c->mark_ns[to] ||
+	    c->mark_ns[to] < c->mark_ns[from])
+		return -1;
+	return div_u64(c->mark_ns[to] - c->mark_ns[from], NSEC_PER_USEC);
+}
+
+static void suspend_profile_show_cycle(struct seq_file *m,
+				       struct suspend_profile_cycle *c)
+{
+	int i;
+
+	seq_printf(m, "cycle %u: error %d, total %lld us\n", c->seq, c->error,
+		   mark_delta_us(c, SUSPEND_PROFILE_BEGIN, SUSPEND_PROFILE_END));
+	for (i = 0; i < SUSPEND_PROFILE_PHASES; i++)
+		seq_printf(m, "  %-12s %10u us  %4u devices\n", phase_names[i],
+			   c->phase_us[i], c->phase_count[i]);
+	seq_printf(m, "  devices off -> platform enter %lld us\n",
+		   mark_delta_us(c, SUSPEND_PROFILE_DEVICES_OFF,
+				 SUSPEND_PROFILE_PLATFORM_ENTER));
+	seq_printf(m, "  platform enter -> sleep %lld us, asleep %lld us, "
+		   "wake -> platform exit %lld us\n",
+		   mark_delta_us(c, SUSPEND_PROFILE_PLATFORM_ENTER,
+				 SUSPEND_PROFILE_SLEEP_ENTER),
+		   mark_delta_us(c, SUSPEND_PROFILE_SLEEP_ENTER,
+				 SUSPEND_PROFILE_SLEEP_EXIT),
+		   mark_delta_us(c, SUSPEND_PROFILE_SLEEP_EXIT,
+				 SUSPEND_PROFILE_PLATFORM_EXIT));
+	seq_printf(m, "  platform exit -> devices on %lld us\n",
+		   mark_delta_us(c, SUSPEND_PROFILE_PLATFORM_EXIT,
+				 SUSPEND_PROFILE_DEVICES_ON));
+	for (i = 0; i < c->top_count; i++)
+		seq_printf(m, "  %10u us  %-12s %s\n", c->top[i].us,
+			   phase_names[c->top[i].phase], c->top[i].name);
+}
+
+static int suspend_profile_show(struct seq_file *m, void *unused)
+{
+	struct suspend_profile_cycle *c;
+	unsigned long irqflags;
+	unsigned i;
+
+	c = kmalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+
+	/* newest first; -1 means the point was never reached */
+	for (i = 0; i < SUSPEND_PROFILE_CYCLES; i++) {
+		spin_lock_irqsave(&suspend_profile_lock, irqflags);
+		if (i >= cycle_seq) {
+			spin_unlock_irqrestore(&suspend_profile_lock, irqflags);
+			break;
+		}
+		*c = cycles[(cycle_seq - 1 - i) % SUSPEND_PROFILE_CYCLES];
+		spin_unlock_irqrestore(&suspend_profile_lock, irqflags);
+		suspend_profile_show_cycle(m, c);
+	}
+	kfree(c);
+	return 0;
+}
+
+static int suspend_profile_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_profile_show, NULL);
+}
+
+static const struct file_operations suspend_profile_fops = {
+	.open = suspend_profile_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init suspend_profile_init(void)
+{
+	debugfs_create_file("suspend_profile", S_IRUGO, NULL, NULL,
+			    &suspend_profile_fops);
+	return 0;
+}
+
+late_initcall(suspend_profile_init);
+#endif